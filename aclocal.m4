@@ -1214,6 +1214,7 @@ m4_include([m4/ax_arg_gnutls.m4])
 m4_include([m4/ax_arg_ioloop_mechanism.m4])
 m4_include([m4/ax_arg_libgeoip.m4])
 m4_include([m4/ax_arg_openssl.m4])
+m4_include([m4/ax_arg_zlib.m4])
 m4_include([m4/ax_check_compile_flag.m4])
 m4_include([m4/ax_library_net.m4])
 m4_include([m4/ax_mempool_chunksizes.m4])
@@ -28,6 +28,7 @@
 #define INCLUDED_channel_h
 
 #include "ircd_defs.h"        /* KEYLEN, CHANNELLEN */
+#include "irc_string.h"
 
 /* channel visible */
 #define ShowChannel(v,c)        (PubChannel(c) || IsMember((v),(c)))
@@ -39,7 +40,8 @@
 enum
 {
   MSG_FLOOD_NOTICED  = 0x00000001U,
-  JOIN_FLOOD_NOTICED = 0x00000002U
+  JOIN_FLOOD_NOTICED = 0x00000002U,
+  MEMBERS_REMOVED    = 0x00000004U  /**< Pending update in channel_remove_clients() */
 };
 
 #define SetFloodNoticed(x)   ((x)->flags |= MSG_FLOOD_NOTICED)
@@ -50,7 +52,21 @@ enum
 #define IsSetJoinFloodNoticed(x) ((x)->flags & JOIN_FLOOD_NOTICED)
 #define ClearJoinFloodNoticed(x) ((x)->flags &= ~JOIN_FLOOD_NOTICED)
 
+/*! \brief Orders in which channels are indexed for LIST (see hash.c) */
+enum
+{
+  CHANNEL_INDEX_USERS,    /**< By number of members */
+  CHANNEL_INDEX_CREATED,  /**< By creationtime */
+  CHANNEL_INDEX_TOPIC,    /**< By topic_time */
+  CHANNEL_INDEX_COUNT
+};
+
 struct Client;
+struct BanIndex;
+struct ResvItem;
+struct ChannelBucket;
+struct dbuf_block;
+struct dbuf_queue;
 
 /*! \brief Mode structure for channels */
 struct Mode
@@ -86,6 +102,14 @@ struct Channel
   dlink_list banlist;
   dlink_list exceptlist;
   dlink_list invexlist;
+  struct BanIndex *ban_index;  /**< b/e/I lookup index, compiled on demand */
+  struct ResvItem *resv;  /**< Matching channel RESV, if any; valid while resv_generation is current */
+  unsigned int resv_generation;  /**< resv_chan_get_generation() at the time resv was looked up */
+  dlink_node index_node[CHANNEL_INDEX_COUNT];  /**< Links into the LIST indexes */
+  struct ChannelBucket *index_bucket[CHANNEL_INDEX_COUNT];  /**< Index buckets the channel is in */
+  struct dbuf_block *list_reply;  /**< RPL_LIST parameters as non-members see them, if cached */
+  unsigned int list_reply_mode;  /**< Modes list_reply was rendered with; see list_one_channel() */
+  unsigned int list_reply_users;  /**< Member count list_reply was rendered with */
 
   float number_joined;
 
@@ -117,6 +141,10 @@ struct Ban
   struct irc_ssaddr addr;
   int bits;
   int type;
+  struct MatchMask name_mask;
+  struct MatchMask user_mask;
+  struct MatchMask host_mask;
+  struct Ban *hnext;  /**< Next mask in the same ban index bucket */
 };
 
 /*! \brief Invite structure */
@@ -133,21 +161,24 @@ extern dlink_list channel_list;
 
 extern int channel_check_name(const char *, const int);
 extern int can_send(struct Channel *, struct Client *, struct Membership *, const char *, int);
-extern int is_banned(const struct Channel *, const struct Client *);
+extern int is_banned(struct Channel *, const struct Client *);
 extern int has_member_flags(const struct Membership *, const unsigned int);
 
 extern void channel_do_join(struct Client *, char *, char *);
 extern void channel_do_join_0(struct Client *);
+extern void channel_send_join(struct Channel *, struct Client *, const struct Client *, unsigned int);
 extern void channel_do_part(struct Client *, char *, const char *);
-extern void remove_ban(struct Ban *, dlink_list *);
+extern void remove_ban(struct Channel *, struct Ban *, dlink_list *);
+extern void channel_clear_ban_index(struct Channel *);
 extern void channel_init(void);
 extern void add_user_to_channel(struct Channel *, struct Client *, unsigned int, int);
 extern void remove_user_from_channel(struct Membership *);
+extern void channel_remove_clients(struct Client *const *, unsigned int);
 extern void channel_member_names(struct Client *, struct Channel *, int);
 extern void add_invite(struct Channel *, struct Client *);
 extern void del_invite(struct Invite *);
 extern void clear_invite_list(dlink_list *);
-extern void channel_send_modes(struct Client *, struct Channel *);
+extern unsigned int channel_burst_modes(struct dbuf_queue *, struct Client *, struct Channel *, int);
 extern void channel_modes(struct Channel *, struct Client *, char *, char *);
 extern void check_spambot_warning(struct Client *, const char *);
 extern void channel_free(struct Channel *);
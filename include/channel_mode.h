@@ -95,6 +95,16 @@ enum
   MODE_EXTLIMIT   = 0x00008000U   /**< Channel can make use of the extended ban list limit */
 };
 
+/*
+ * Not modes: flags for the parameter modes, which RPL_LIST shows by
+ * letter only.  Kept in the top bits, clear of the MODE_* flags above.
+ */
+enum
+{
+  MODE_LIST_LIMIT = 0x40000000U,  /**< +l is set */
+  MODE_LIST_KEY   = 0x20000000U   /**< +k is set */
+};
+
 #define HasCMode(x, y) ((x)->mode.mode &   (y))
 #define AddCMode(x, y) ((x)->mode.mode |=  (y))
 #define DelCMode(x, y) ((x)->mode.mode &= ~(y))
@@ -133,4 +143,9 @@ extern int add_id(struct Client *, struct Channel *, char *, unsigned int);
 extern void set_channel_mode(struct Client *, struct Channel *,
                              struct Membership *, int, char **);
 extern void clear_ban_cache_list(dlink_list *);
+extern void channel_member_mode_add(struct Channel *, const char *, struct Client *, unsigned int);
+extern void channel_member_mode_flush(void);
+extern void channel_member_mode_drop(const struct Channel *);
+extern void channel_member_mode_sync(const struct Channel *);
+extern void channel_member_mode_hold(int);
 #endif /* INCLUDED_channel_mode_h */
@@ -35,6 +35,7 @@
 #include "channel.h"
 #include "auth.h"
 
+struct AddressRec;
 
 /*
  * status macros.
@@ -137,7 +138,9 @@ enum
   FLAGS_SERVICE       = 0x00200000U,  /**< Client/server is a network service */
   FLAGS_SSL           = 0x00400000U,  /**< User is connected via TLS/SSL */
   FLAGS_SQUIT         = 0x00800000U,
-  FLAGS_EXEMPTXLINE   = 0x01000000U   /**< Client is exempt from x-lines */
+  FLAGS_EXEMPTXLINE   = 0x01000000U,  /**< Client is exempt from x-lines */
+  FLAGS_FLUSH         = 0x02000000U,  /**< Client is on the list of sendqs to flush */
+  FLAGS_BANCHECK      = 0x04000000U   /**< Client is on the list of connections to check for bans */
 };
 
 #define HasFlag(x, y) ((x)->flags &   (y))
@@ -272,14 +275,26 @@ struct Server
   char by[NICKLEN + 1];   /**< Who activated this connection */
 };
 
+/*! \brief Channel mask given to LIST */
+struct ListMask
+{
+  char *mask;
+  struct MatchMask match;  /**< mask prepared for match_mask() */
+};
+
 /*! \brief ListTask structure */
 struct ListTask
 {
   dlink_node node;  /**< Embedded list node used to link into listing_client_list */
-  dlink_list show_mask; /**< Channels to show */
-  dlink_list hide_mask; /**< Channels to hide */
+  dlink_list show_mask; /**< ListMasks of channels to show */
+  dlink_list hide_mask; /**< ListMasks of channels to hide */
 
   unsigned int hash_index; /**< The hash bucket we are currently in */
+  unsigned int index;  /**< CHANNEL_INDEX_* walked instead of the hash table, or CHANNEL_INDEX_COUNT */
+  uintmax_t index_key;  /**< Key of the next index bucket to list */
+  unsigned int index_skip;  /**< Channels of that bucket already listed */
+  uintmax_t index_min;  /**< Smallest key the filters accept */
+  uintmax_t index_max;  /**< Largest key the filters accept */
   unsigned int users_min;
   unsigned int users_max;
   unsigned int created_min;
@@ -287,6 +302,18 @@ struct ListTask
   unsigned int topicts_min;
   unsigned int topicts_max;
   char topic[TOPICLEN + 1];
+  struct MatchMask topic_match;  /**< topic prepared for match_mask() */
+};
+
+/*! \brief BurstTask structure; state of the burst sent to a newly linked server */
+struct BurstTask
+{
+  dlink_node node;  /**< Embedded list node used to link into bursting_server_list */
+  dlink_node *client;  /**< global_client_list node to burst next, NULL once past the end */
+  dlink_node *channel;  /**< channel_list node to burst next, NULL once past the end */
+  struct dbuf_queue deferred;  /**< Other messages to the server, held back until the burst is done */
+  int generating;  /**< Set while server_burst_continue() is queueing burst messages */
+  struct SnapshotDelta *delta;  /**< Ranges the server replays from its snapshot instead, if CAPAB_SNAP */
 };
 
 /*! \brief Connection structure
@@ -324,9 +351,18 @@ struct Connection
   unsigned int received_number_of_privmsgs;
 
   struct ListTask  *list_task;
+  struct BurstTask *burst_task;  /**< Burst still being sent to this server, if any */
 
   struct dbuf_queue buf_sendq;
   struct dbuf_queue buf_recvq;
+  struct ZipLink *zip;  /**< Compression state, if the server link is compressed */
+  struct Snapshot *snapshot;  /**< Our snapshot of this server, offered for it to relink */
+  dlink_node flush_node;  /**< For the list of sendqs to flush */
+  dlink_node ban_check_node;  /**< For the list of connections to check for bans */
+  dlink_node ip_node;  /**< For the address index of local connections */
+  dlink_list *ip_list;  /**< Address index bucket ip_node is on */
+  dlink_node host_node[2];  /**< For the host index of local clients, by host and sockhost */
+  dlink_list *host_list[2];  /**< Host index buckets host_node[] are on */
 
   struct
   {
@@ -455,6 +491,13 @@ extern void del_all_accepts(struct Client *);
 extern void exit_client(struct Client *, const char *);
 extern void conf_try_ban(struct Client *, int, const char *);
 extern void check_conf_klines(void);
+extern void client_ban_index_add(struct Client *);
+extern void client_ban_index_del(struct Client *);
+extern void client_ban_check_address(const struct AddressRec *);
+extern void client_ban_check_all(void);
+extern void client_ban_check_gecos(void);
+extern void client_ban_index_host(struct Client *);
+extern void client_ban_check_run(void);
 extern void client_init(void);
 extern void dead_link_on_write(struct Client *, int);
 extern void dead_link_on_read(struct Client *, int);
@@ -27,9 +27,12 @@
 #ifndef INCLUDED_conf_gecos_h
 #define INCLUDED_conf_gecos_h
 
+#include "mask_index.h"
+
 struct GecosItem
 {
   dlink_node node;
+  struct MaskIndexEntry entry;
   char *mask;
   char *reason;
   uintmax_t expire;
@@ -39,7 +42,7 @@ struct GecosItem
 
 extern const dlink_list *gecos_get_list(void);
 extern void gecos_delete(struct GecosItem *);
-extern struct GecosItem *gecos_make(void);
+extern struct GecosItem *gecos_make(const char *);
 extern struct GecosItem *gecos_find(const char *, int (*)(const char *, const char *));
 extern void gecos_clear(void);
 extern void gecos_expire(void);
@@ -27,10 +27,13 @@
 #ifndef INCLUDED_conf_resv_h
 #define INCLUDED_conf_resv_h
 
+#include "mask_index.h"
+
 struct ResvItem
 {
   dlink_node node;
   dlink_list *list;
+  struct MaskIndexEntry entry;
   dlink_list exempt_list;
   char *mask;
   char *reason;
@@ -53,6 +56,7 @@ struct ResvExemptItem
 
 extern const dlink_list *resv_chan_get_list(void);
 extern const dlink_list *resv_nick_get_list(void);
+extern unsigned int resv_chan_get_generation(void);
 extern void resv_delete(struct ResvItem *);
 extern struct ResvItem *resv_make(const char *, const char *, const dlink_list *);
 extern int resv_exempt_find(const struct Client *, const struct ResvItem *);
@@ -30,28 +30,69 @@
 #define dbuf_length(x) ((x)->total_size)
 #define dbuf_clear(x) dbuf_delete(x, dbuf_length(x))
 
-enum { DBUF_BLOCK_SIZE = 1024 };
+/*
+ * Blocks come in several size classes, each from its own memory pool.
+ * Formatted messages are moved to the smallest class that holds them
+ * (see dbuf_shrink()), while received data is appended to the largest.
+ */
+enum
+{
+  DBUF_BLOCK_SIZE_MIN = 128,
+  DBUF_BLOCK_SIZE_MAX = 4096
+};
 
 struct dbuf_block
 {
   int refs;
-  size_t size;
-  char data[DBUF_BLOCK_SIZE];
+  unsigned int sclass;  /* Index of the size class the block came from */
+  size_t size;  /* Bytes used */
+  size_t capacity;  /* Bytes available in data[] */
+  char data[];
+};
+
+/*
+ * A queue refers to its blocks from chunks of slots.  Blocks are shared
+ * by reference among the queues of all recipients of a message, and
+ * queueing one only takes an allocation once every DBUF_CHUNK_SLOTS
+ * blocks.
+ */
+enum { DBUF_CHUNK_SLOTS = 12 };
+
+struct dbuf_chunk
+{
+  dlink_node node;
+  unsigned int first;  /* Slot of the oldest block still queued */
+  unsigned int count;  /* Slots used */
+  struct dbuf_block *block[DBUF_CHUNK_SLOTS];
 };
 
 struct dbuf_queue
 {
-  dlink_list blocks;
+  dlink_list chunks;
   size_t total_size;
-  size_t pos;
+  size_t pos;  /* Bytes of the first block already taken */
+};
+
+/* Where a walk over the blocks of a queue is at, see dbuf_first() */
+struct dbuf_iter
+{
+  const dlink_node *node;
+  unsigned int slot;
 };
 
 extern void dbuf_init(void);
-extern struct dbuf_block *dbuf_alloc(void);
+extern struct dbuf_block *dbuf_alloc(size_t);
+extern struct dbuf_block *dbuf_shrink(struct dbuf_block *);
 extern void dbuf_ref_free(struct dbuf_block *);
 extern void dbuf_add(struct dbuf_queue *, struct dbuf_block *);
+extern struct dbuf_block *dbuf_head(const struct dbuf_queue *);
+extern struct dbuf_block *dbuf_first(const struct dbuf_queue *, struct dbuf_iter *);
+extern struct dbuf_block *dbuf_next(struct dbuf_iter *);
 extern void dbuf_delete(struct dbuf_queue *, size_t);
+extern void dbuf_move(struct dbuf_queue *, struct dbuf_queue *);
 extern void dbuf_put_fmt(struct dbuf_block *, const char *, ...);
 extern void dbuf_put_args(struct dbuf_block *, const char *, va_list);
 extern void dbuf_put(struct dbuf_queue *, const char *, size_t);
+extern char *dbuf_reserve(struct dbuf_queue *, size_t *);
+extern void dbuf_commit(struct dbuf_queue *, size_t);
 #endif
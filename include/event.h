@@ -38,16 +38,19 @@ struct event
   unsigned int oneshot;
 
   /* private */
-  uintmax_t next;
+  uintmax_t next;  /* Due time in milliseconds */
   void *data;
   unsigned int active;
-  dlink_node node;
+  unsigned int heap_index;
+  dlink_node node;  /* On the STATS e list; unnamed events aren't listed */
 };
 
 extern const dlink_list *event_get_list(void);
 extern void event_add(struct event *, void *);
+extern void event_add_ms(struct event *, uintmax_t, void *);
 extern void event_addish(struct event *, void *);
 extern void event_delete(struct event *);
 extern void event_run(void);
+extern int event_next_delay(int);
 extern void event_set_back_events(uintmax_t);
 #endif /* INCLUDED_event_h */
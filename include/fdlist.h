@@ -28,11 +28,12 @@
 #define INCLUDED_fdlist_h
 
 #include "ircd_defs.h"
+#include "list.h"
+#include "event.h"
 #include "tls.h"
 
 
 enum { FD_DESC_SIZE = 128 };  /* hostlen + comment */
-enum { FD_HASH_SIZE = 1024 };
 
 enum
 {
@@ -46,6 +47,7 @@ enum
 };
 
 struct Client;
+struct netio_fd;
 
 typedef struct _fde
 {
@@ -57,6 +59,7 @@ typedef struct _fde
   int fd;  /* So we can use the fde_t as a callback ptr */
   int comm_index;  /* where in the poll list we live */
   int evcache;          /* current fd events as set up by the underlying I/O */
+  int evready;          /* events reported by edge-triggered I/O, not yet handled */
   char desc[FD_DESC_SIZE];
   void (*read_handler)(struct _fde *, void *);
   void *read_data;
@@ -64,10 +67,11 @@ typedef struct _fde
   void *write_data;
   void (*timeout_handler)(struct _fde *, void *);
   void *timeout_data;
-  uintmax_t timeout;
+  struct event timeout_ev;
   void (*flush_handler)(struct _fde *, void *);
   void *flush_data;
-  uintmax_t flush_timeout;
+  struct event flush_ev;
+  struct netio_fd *netio;  /* state of the network IO loop code, if it keeps any */
 
   struct
   {
@@ -86,13 +90,10 @@ typedef struct _fde
   } connect;
 
   tls_data_t ssl;
-  struct _fde *hnext;
 } fde_t;
 
 extern int number_fd;
 extern int hard_fdlimit;
-extern fde_t *fd_hash[];
-extern fde_t *fd_next_in_loop;
 
 extern void fdlist_init(void);
 extern fde_t *lookup_fd(int);
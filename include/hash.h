@@ -35,6 +35,7 @@
 struct Client;
 struct Channel;
 struct UserHost;
+struct ListTask;
 
 enum
 {
@@ -49,6 +50,7 @@ extern void hash_add_client(struct Client *);
 extern void hash_del_client(struct Client *);
 extern void hash_add_channel(struct Channel *);
 extern void hash_del_channel(struct Channel *);
+extern void hash_update_channel_index(struct Channel *, unsigned int);
 extern void hash_add_id(struct Client *);
 extern void hash_del_id(struct Client *);
 extern void hash_add_userhost(struct UserHost *);
@@ -62,6 +64,7 @@ extern struct Channel *hash_find_channel(const char *);
 extern void *hash_get_bucket(int, unsigned int);
 
 extern void free_list_task(struct Client *);
+extern void list_task_pick_index(struct ListTask *);
 extern void safe_list_channels(struct Client *, int);
 
 extern unsigned int strhash(const char *);
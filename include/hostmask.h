@@ -27,6 +27,8 @@
 #ifndef INCLUDED_hostmask_h
 #define INCLUDED_hostmask_h
 
+#include "irc_string.h"
+
 enum { ATABLE_SIZE = 0x1000 };
 
 enum hostmask_type
@@ -63,7 +65,15 @@ struct AddressRec
   const char *username;
   struct MaskItem *conf;
 
+  /* username and Mask.hostname prepared for match_mask() */
+  struct MatchMask user_mask;
+  struct MatchMask host_mask;
+
   dlink_node node;
+
+  /* Lookup index bucket (address trie or host trie) holding inode */
+  dlink_list *ilist;
+  dlink_node inode;
 };
 
 extern dlink_list atable[ATABLE_SIZE];
@@ -76,6 +86,9 @@ extern struct AddressRec *add_conf_by_address(const unsigned int, struct MaskIte
 extern void delete_one_address_conf(const char *, struct MaskItem *);
 extern void clear_out_address_conf(void);
 extern void hostmask_expire_temporary(void);
+extern dlink_list *host_name_index_add(const char *, void *, dlink_node *);
+extern void host_name_index_del(dlink_list *, dlink_node *);
+extern void host_name_index_walk(const char *, void (*)(void *));
 
 extern struct MaskItem *find_address_conf(const char *, const char *, const struct irc_ssaddr *,
                                           int, const char *);
@@ -33,6 +33,29 @@
 extern int has_wildcards(const char *);
 extern int match(const char *, const char *);
 
+/*
+ * MatchMask - a mask analysed once by match_mask_compile() so that
+ * match_mask() can reject most strings without walking the mask.
+ */
+enum
+{
+  MATCH_MASK_LITERAL = 1 << 0,  /**< No wildcards or escapes; compared with irccmp() */
+  MATCH_MASK_FIXED   = 1 << 1,  /**< Only matches strings of minlen characters */
+  MATCH_MASK_SIMPLE  = 1 << 2   /**< Of the form prefix*suffix */
+};
+
+struct MatchMask
+{
+  const char *mask;  /**< Must stay valid as long as the MatchMask is used */
+  unsigned int flags;
+  unsigned int prefix;  /**< Literal characters before the first wildcard */
+  unsigned int suffix;  /**< Literal characters after the last wildcard */
+  unsigned int minlen;  /**< Length of the shortest string the mask matches */
+};
+
+extern void match_mask_compile(struct MatchMask *, const char *);
+extern int match_mask(const struct MatchMask *, const char *);
+
 extern unsigned int token_vector(char *, char, char *[], unsigned int);
 
 /*
@@ -0,0 +1,64 @@
+/*
+ *  ircd-hybrid: an advanced, lightweight Internet Relay Chat Daemon (ircd)
+ *
+ *  Copyright (c) 2017 ircd-hybrid development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ *  USA
+ */
+
+/*! \file mask_index.h
+ * \brief Index of wildcard masks for match() and irccmp() lookups.
+ * \version $Id$
+ */
+
+#ifndef INCLUDED_mask_index_h
+#define INCLUDED_mask_index_h
+
+#include "list.h"
+#include "irc_string.h"
+
+enum { MASK_INDEX_SIZE = 0x1000 };
+
+/*! \brief Index entry, embedded in the item owning the mask */
+struct MaskIndexEntry
+{
+  dlink_node exact_node;  /**< Link in MaskIndex.exact */
+  dlink_node wild_node;  /**< Link in MaskIndex.wild or MaskIndex.other */
+  dlink_list *wild_list;  /**< List wild_node is on, or NULL */
+  const char *mask;
+  struct MatchMask match;  /**< mask prepared for match_mask() */
+  void *data;  /**< Item owning the mask */
+  unsigned int serial;  /**< Insertion order; the newest match wins */
+  unsigned int seen;  /**< Last lookup that visited this entry */
+};
+
+/*! \brief Index of masks. Every mask is hashed by its full text;
+ *         masks with wildcards are also hashed by three literal
+ *         characters a matching string must contain.
+ */
+struct MaskIndex
+{
+  dlink_list exact[MASK_INDEX_SIZE];
+  dlink_list wild[MASK_INDEX_SIZE];
+  dlink_list other;  /**< Wildcard masks without three literal characters in a row */
+  unsigned int serial;
+  unsigned int seen;
+};
+
+extern void mask_index_add(struct MaskIndex *, struct MaskIndexEntry *, const char *, void *);
+extern void mask_index_del(struct MaskIndex *, struct MaskIndexEntry *);
+extern void *mask_index_find(struct MaskIndex *, const char *, int (*)(const char *, const char *));
+#endif  /* INCLUDED_mask_index_h */
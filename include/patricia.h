@@ -80,6 +80,7 @@ typedef struct _patricia_tree_t
 extern patricia_node_t *patricia_search_exact(patricia_tree_t *, prefix_t *);
 extern patricia_node_t *patricia_search_best(patricia_tree_t *, prefix_t *);
 extern patricia_node_t *patricia_search_best2(patricia_tree_t *, prefix_t *, int);
+extern patricia_node_t *patricia_search_covered(patricia_tree_t *, prefix_t *);
 extern patricia_node_t *patricia_lookup(patricia_tree_t *, prefix_t *);
 extern void patricia_remove(patricia_tree_t *, patricia_node_t *);
 extern patricia_tree_t *patricia_new(unsigned int);
@@ -92,9 +93,11 @@ extern patricia_node_t *patricia_try_search_exact(patricia_tree_t *, const char
 extern patricia_node_t *patricia_try_search_best(patricia_tree_t *, const char *);
 extern patricia_node_t *patricia_try_search_exact_addr(patricia_tree_t *, struct sockaddr *, int);
 extern patricia_node_t *patricia_try_search_best_addr(patricia_tree_t *, struct sockaddr *, int);
+extern patricia_node_t *patricia_try_search_covered_addr(patricia_tree_t *, struct sockaddr *, int);
 
 /* { from demo.c */
 extern patricia_node_t *patricia_make_and_lookup(patricia_tree_t *, const char *);
+extern patricia_node_t *patricia_make_and_lookup_addr(patricia_tree_t *, struct sockaddr *, int);
 /* } */
 
 #define PATRICIA_MAXBITS   (sizeof(struct in6_addr) * 8)
@@ -33,14 +33,25 @@
 enum
 {
   COMM_SELECT_READ  = 1,
-  COMM_SELECT_WRITE = 2
+  COMM_SELECT_WRITE = 2,
+  COMM_SELECT_RECV  = 4,  /**< The read handler only takes data by netio_recv() */
+  COMM_SELECT_ACCEPT = 8  /**< The read handler only takes connections by comm_accept() */
 };
 
+/* Most blocks handed to netio_writev() at once */
+#if defined(IOV_MAX) && IOV_MAX < 64
+enum { COMM_IOV_MAX = IOV_MAX };
+#else
+enum { COMM_IOV_MAX = 64 };
+#endif
+
 /* How long can comm_select() wait for network events [milliseconds] */
 enum { SELECT_DELAY = 500 };
 
 struct Client;
 struct Listener;
+struct dbuf_queue;
+struct iovec;
 
 extern void add_connection(struct Listener *, struct irc_ssaddr *, int);
 extern void close_connection(struct Client *);
@@ -51,16 +62,26 @@ extern int ignoreErrno(int);
 
 extern void comm_settimeout(fde_t *, uintmax_t, void (*)(fde_t *, void *), void *);
 extern void comm_setflush(fde_t *, uintmax_t, void (*)(fde_t *, void *), void *);
-extern void comm_checktimeouts(void *);
 extern void comm_connect_tcp(fde_t *, const char *, unsigned short, struct sockaddr *, int,
                              void (struct _fde *, int, void *), void *, int, uintmax_t);
 extern const char *comm_errstr(int);
 extern int comm_open(fde_t *, int, int, int, const char *);
 extern int comm_accept(fde_t *, struct irc_ssaddr *);
+extern int comm_fill_iovec(const struct dbuf_queue *, struct iovec *, int);
 
 /* These must be defined in the network IO loop code of your choice */
 extern void netio_init(void);
 extern void comm_setselect(fde_t *, unsigned int, void (*)(fde_t *, void *), void *, uintmax_t);
 extern void comm_select(void);
+extern int netio_accept(fde_t *, struct irc_ssaddr *, socklen_t *);
+extern ssize_t netio_recv(fde_t *, char *, size_t);
+extern ssize_t netio_writev(fde_t *, const struct dbuf_queue *);
+extern void netio_close(fde_t *);
+#if USE_IOPOLL_MECHANISM == __IOPOLL_MECHANISM_IO_URING
+/* epoll backend, used when the running kernel can't do io_uring */
+extern void epoll_netio_init(void);
+extern void epoll_comm_setselect(fde_t *, unsigned int, void (*)(fde_t *, void *), void *, uintmax_t);
+extern void epoll_comm_select(void);
+#endif
 extern void remove_ipv6_mapping(struct irc_ssaddr *);
 #endif /* INCLUDED_s_bsd_h */
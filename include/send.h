@@ -51,26 +51,50 @@ enum
   MATCH_HOST   = 2
 };
 
+/* Versions sendto_channel_local_variants() picks from; two capabilities' worth */
+enum { SEND_VARIANTS_MAX = 4 };
+
+/* Arguments a SendVariant can have */
+enum { SEND_VARIANT_ARGS = 8 };
+
+/** One version of a message sent by sendto_channel_local_variants() */
+struct SendVariant
+{
+  const char *pattern;  /**< Format string with %s conversions only; NULL to send nothing */
+  const char *args[SEND_VARIANT_ARGS];  /**< Strings for the conversions, in order */
+};
+
 /*
  * struct decls
  */
 struct Channel;
 struct Client;
+struct dbuf_block;
+struct dbuf_queue;
 
 /* send.c prototypes */
 extern void sendq_unblocked(fde_t *, void *);
 extern void send_queued_write(struct Client *);
 extern void send_queued_all(void);
+extern void send_queued_flush(void);
 extern void sendto_one(struct Client *, const char *, ...) AFP(2,3);
+extern void sendto_one_queue(struct Client *, struct dbuf_queue *);
 extern void sendto_one_numeric(struct Client *, const struct Client *, enum irc_numerics, ...);
+extern void sendto_one_numeric_prepared(struct Client *, const struct Client *,
+                                        enum irc_numerics, struct dbuf_block *);
 extern void sendto_one_notice(struct Client *, const struct Client *, const char *, ...) AFP(3,4);
 extern void sendto_channel_butone(struct Client *, const struct Client *,
                                   struct Channel *, unsigned int,
                                   const char *, ...) AFP(5,6);
 extern void sendto_common_channels_local(struct Client *, int, unsigned int, unsigned int,
                                          const char *, ...) AFP(5,6);
+extern void sendto_common_channels_local_quits(struct Client *const *, unsigned int, const char *);
 extern void sendto_channel_local(const struct Client *, struct Channel *, unsigned int,
                                  unsigned int, unsigned int, const char *, ...)  AFP(6,7);
+extern void sendto_channel_local_variants(const struct Client *, struct Channel *, unsigned int,
+                                          unsigned int, unsigned int, const struct SendVariant *);
+extern struct dbuf_block *send_prepare(const char *, ...) AFP(1,2);
+extern void send_prepare_queue(struct dbuf_queue *, const char *, ...) AFP(2,3);
 extern void sendto_server(const struct Client *, const unsigned int,
                           const unsigned int, const char *, ...) AFP(4,5);
 extern void sendto_match_butone(const struct Client *, const struct Client *,
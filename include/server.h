@@ -27,8 +27,10 @@
 #ifndef INCLUDED_server_h
 #define INCLUDED_server_h
 
+struct Channel;
 struct Client;
 struct MaskItem;
+struct dbuf_queue;
 
 /*
  * Number of seconds to wait after server starts up, before
@@ -47,6 +49,12 @@ enum server_hunt_ret
   HUNTED_PASS    =  1   /**< If message passed onwards successfully */
 };
 
+/*
+ * Bytes of a burst that may be waiting in a server's sendq before
+ * server_burst_continue() stops producing more
+ */
+enum { SERVER_BURST_QUEUE = 65536 };
+
 struct server_hunt
 {
   enum server_hunt_ret ret;
@@ -61,4 +69,12 @@ extern void try_connections(void *);
 extern int serv_connect(struct MaskItem *, struct Client *);
 extern struct Client *find_servconn_in_progress(const char *);
 extern struct Server *make_server(struct Client *);
+extern void server_burst(struct Client *);
+extern void server_burst_client(struct dbuf_queue *, struct Client *, struct Client *);
+extern void server_burst_channel(struct dbuf_queue *, struct Client *, struct Channel *, int);
+extern void server_burst_continue(struct Client *);
+extern void server_burst_free(struct Client *);
+extern void server_burst_unlink(const dlink_node *);
+
+extern dlink_list bursting_server_list;
 #endif  /* INCLUDED_server_h */
@@ -43,7 +43,9 @@ enum
   CAPAB_DLN     = 0x00000400U,  /**< Can do DLINE message */
   CAPAB_UNDLN   = 0x00000800U,  /**< Can do UNDLINE message */
   CAPAB_CHW     = 0x00001000U,  /**< Can do channel wall @# */
-  CAPAB_RHOST   = 0x00002000U   /**< Can do extended realhost UID messages */
+  CAPAB_RHOST   = 0x00002000U,  /**< Can do extended realhost UID messages */
+  CAPAB_ZLIB    = 0x00004000U,  /**< Can do compressed links */
+  CAPAB_SNAP    = 0x00008000U   /**< Can relink from a snapshot (SNAPDIGEST/SNAPUSE) */
 };
 
 /*
@@ -0,0 +1,63 @@
+/*
+ *  ircd-hybrid: an advanced, lightweight Internet Relay Chat Daemon (ircd)
+ *
+ *  Copyright (c) 2017 ircd-hybrid development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ *  USA
+ */
+
+/*! \file server_zip.h
+ * \brief A header for compressed server links.
+ * \version $Id$
+ */
+
+#ifndef INCLUDED_server_zip_h
+#define INCLUDED_server_zip_h
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#include "dbuf.h"
+
+/*
+ * Compressed output kept ahead of the socket.  The rest stays uncompressed
+ * in the regular sendq so that sendq limits keep meaning the same.
+ */
+enum { ZIP_SENDQ_SIZE = 16384 };
+
+/** Compression state of a server link which negotiated CAPAB ZLIB */
+struct ZipLink
+{
+  struct dbuf_queue sendq;  /**< Compressed data not yet written to the socket */
+  uintmax_t in_wire;  /**< Compressed bytes received */
+  uintmax_t in_data;  /**< Bytes these inflated to */
+  uintmax_t out_data;  /**< Bytes handed to the compressor */
+  uintmax_t out_wire;  /**< Compressed bytes these deflated to */
+  int flushing;  /**< A sync flush didn't fit into the output space */
+  int reading;  /**< Received data is compressed, too */
+#ifdef HAVE_LIBZ
+  z_stream deflate;
+  z_stream inflate;
+#endif
+};
+
+extern int zip_start(struct Client *);
+extern int zip_start_read(struct Client *);
+extern void zip_free(struct Client *);
+extern int zip_fill(struct Client *);
+extern int zip_read(struct Client *, const char *, size_t);
+#endif  /* INCLUDED_server_zip_h */
@@ -0,0 +1,102 @@
+/*
+ *  ircd-hybrid: an advanced, lightweight Internet Relay Chat Daemon (ircd)
+ *
+ *  Copyright (c) 2017 ircd-hybrid development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ *  USA
+ */
+
+/*! \file snapshot.h
+ * \brief A header for relinking servers from snapshots.
+ * \version $Id$
+ */
+
+#ifndef INCLUDED_snapshot_h
+#define INCLUDED_snapshot_h
+
+#include "ircd_defs.h"
+#include "dbuf.h"
+
+/*
+ * Format of the SNAPDIGEST/SNAPUSE messages and of the digests.  Peers
+ * which don't agree on it just burst everything.
+ */
+enum { SNAPSHOT_VERSION = 1 };
+
+/*
+ * Clients and channels are split into SNAPSHOT_RANGES ranges by a hash
+ * of their ID or name; a range is either replayed or burst as a whole.
+ */
+enum
+{
+  SNAPSHOT_RANGE_BITS = 8,
+  SNAPSHOT_RANGES = 1 << SNAPSHOT_RANGE_BITS
+};
+
+enum
+{
+  SNAPSHOT_USERS,
+  SNAPSHOT_CHANNELS,
+  SNAPSHOT_TABLES
+};
+
+enum
+{
+  SNAPSHOT_LIFETIME = 600,  /**< Seconds a snapshot is kept for the server to relink */
+  SNAPSHOT_DIGESTS_PER_LINE = 24
+};
+
+/** Part of a snapshot */
+struct SnapshotRange
+{
+  uint64_t digest;  /**< Sum of the digests of the clients or channels; 0 if none */
+  struct dbuf_queue lines;  /**< What the server burst for them */
+};
+
+/** What a server that split from us burst us, kept for a while in case it relinks */
+struct Snapshot
+{
+  dlink_node node;  /**< Embedded list node used to link into snapshot_list */
+  char name[HOSTLEN + 1];  /**< Name of the server */
+  char id[IDLEN + 1];  /**< SID of the server */
+  uintmax_t created;  /**< When the server split */
+  unsigned int offered[SNAPSHOT_TABLES];  /**< Ranges with a digest sent in SNAPDIGEST */
+  unsigned int replayed[SNAPSHOT_TABLES];  /**< Ranges the server told us to use */
+  struct SnapshotRange range[SNAPSHOT_TABLES][SNAPSHOT_RANGES];
+  struct dbuf_queue replay;  /**< Lines to parse before the rest of the receive queue */
+};
+
+/** Which parts of our burst a server replays from its snapshot of us */
+struct SnapshotDelta
+{
+  uint64_t digest[SNAPSHOT_TABLES][SNAPSHOT_RANGES];  /**< Digests from SNAPDIGEST */
+  unsigned char use[SNAPSHOT_TABLES][SNAPSHOT_RANGES / 8];  /**< Ranges left out of the burst */
+  unsigned int announced;  /**< Tables SNAPUSE was sent for, by bit */
+  int ignore;  /**< Digests in a format we don't understand */
+  int ready;  /**< Set once SNAPDIGEST END was received */
+};
+
+extern void snapshot_init(void);
+extern void snapshot_take(struct Client *);
+extern void snapshot_offer(struct Client *);
+extern void snapshot_release(struct Client *);
+extern int snapshot_table(const char *);
+extern void snapshot_delta_digests(struct Client *, unsigned int, unsigned int, unsigned int, char *);
+extern void snapshot_delta_ready(struct Client *);
+extern void snapshot_delta_announce(struct Client *, struct SnapshotDelta *, unsigned int);
+extern int snapshot_delta_skip(const struct SnapshotDelta *, unsigned int, const char *);
+extern void snapshot_replay(struct Client *, unsigned int, const char *);
+#endif  /* INCLUDED_snapshot_h */
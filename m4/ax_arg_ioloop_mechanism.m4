@@ -4,8 +4,18 @@ AC_DEFUN([AX_ARG_IOLOOP_MECHANISM],[
 
   AC_ARG_ENABLE([kqueue], [AS_HELP_STRING([--enable-kqueue], [Force kqueue usage.])], [desired_iopoll_mechanism="kqueue"])
   AC_ARG_ENABLE([epoll],  [AS_HELP_STRING([--enable-epoll],  [Force epoll usage.])],  [desired_iopoll_mechanism="epoll"])
+  AC_ARG_ENABLE([epoll-et], [AS_HELP_STRING([--enable-epoll-et], [Force edge-triggered epoll usage.])],
+    [AS_IF([test "$enableval" != "no"], [
+      desired_iopoll_mechanism="epoll"
+      AC_DEFINE([USE_EPOLL_ET], [1], [Define to 1 to use edge-triggered epoll.])])])
   AC_ARG_ENABLE([devpoll],[AS_HELP_STRING([--enable-devpoll],[Force devpoll usage.])],[desired_iopoll_mechanism="devpoll"])
   AC_ARG_ENABLE([poll],   [AS_HELP_STRING([--enable-poll],   [Force poll usage.])],   [desired_iopoll_mechanism="poll"])
+  AC_ARG_ENABLE([io-uring], [AS_HELP_STRING([--enable-io-uring], [Force io_uring usage (falls back to epoll at runtime).])], [desired_iopoll_mechanism="io_uring"])
+
+  AC_ARG_WITH([epoll-max-events],
+    [AS_HELP_STRING([--with-epoll-max-events=NUMBER], [Maximum number of events harvested by one epoll_wait() call. Default: 1024])],
+    [epoll_max_events="$withval"], [epoll_max_events=1024])
+  AC_DEFINE_UNQUOTED([EPOLL_MAX_EVENTS], [$epoll_max_events], [Maximum number of events harvested by one epoll_wait() call.])
 
   AC_MSG_CHECKING([for optimal/desired iopoll mechanism])
 
@@ -35,6 +45,13 @@ AC_DEFUN([AX_ARG_IOLOOP_MECHANISM],[
   AC_DEFINE_UNQUOTED([__IOPOLL_MECHANISM_POLL],[$iopoll_mechanism_poll],[poll mechanism])
   AC_LINK_IFELSE([AC_LANG_FUNC_LINK_TRY([poll])],[is_poll_mechanism_available="yes"],[is_poll_mechanism_available="no"])
 
+  iopoll_mechanism_io_uring=5
+  AC_DEFINE_UNQUOTED([__IOPOLL_MECHANISM_IO_URING],[$iopoll_mechanism_io_uring],[io_uring mechanism])
+  AC_LINK_IFELSE([AC_LANG_PROGRAM([#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>], [struct io_uring_getevents_arg arg; struct io_uring_buf_reg reg; epoll_create(256); return syscall(__NR_io_uring_setup, 0, (void *)0) + IORING_FEAT_EXT_ARG + IORING_OP_POLL_ADD + IORING_RECV_MULTISHOT + IORING_ACCEPT_MULTISHOT + IORING_REGISTER_PBUF_RING + IOSQE_CQE_SKIP_SUCCESS;])],
+    [is_io_uring_mechanism_available="yes"],[is_io_uring_mechanism_available="no"])
+
   optimal_iopoll_mechanism="none"
   for mechanism in "kqueue" "epoll" "devpoll" "poll" ; do # order is important
     eval "is_optimal_iopoll_mechanism_available=\$is_${mechanism}_mechanism_available"
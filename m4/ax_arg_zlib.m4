@@ -0,0 +1,11 @@
+AC_DEFUN([AX_ARG_ZLIB],[
+  AC_ARG_ENABLE([zlib],[AS_HELP_STRING([--enable-zlib],[Enable compressed server links.])],[zlib="$enableval"],[zlib="no"])
+
+  AS_IF([test "$zlib" = "yes"], [
+    AC_CHECK_HEADER(zlib.h,
+      [AC_SEARCH_LIBS(deflateInit_, z,
+        [AC_DEFINE(HAVE_LIBZ, 1, [Define to 1 if zlib (-lz) is available.])],
+        [AC_MSG_ERROR([--enable-zlib was given, but zlib (-lz) could not be found])])],
+      [AC_MSG_ERROR([--enable-zlib was given, but zlib.h could not be found])])
+  ])
+])
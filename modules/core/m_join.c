@@ -173,6 +173,8 @@ ms_join(struct Client *source_p, int parc, char *parv[])
   else
     keep_new_modes = 0;
 
+  hash_update_channel_index(chptr, CHANNEL_INDEX_CREATED);
+
   if (!keep_new_modes)
     mode = *oldmode;
   else if (keep_our_modes)
@@ -223,12 +225,7 @@ ms_join(struct Client *source_p, int parc, char *parv[])
   {
     add_user_to_channel(chptr, source_p, 0, 1);
 
-    sendto_channel_local(NULL, chptr, 0, CAP_EXTENDED_JOIN, 0, ":%s!%s@%s JOIN %s %s :%s",
-                         source_p->name, source_p->username,
-                         source_p->host, chptr->name, source_p->account, source_p->info);
-    sendto_channel_local(NULL, chptr, 0, 0, CAP_EXTENDED_JOIN, ":%s!%s@%s JOIN :%s",
-                         source_p->name, source_p->username,
-                         source_p->host, chptr->name);
+    channel_send_join(chptr, source_p, NULL, 0);
 
     if (source_p->away[0])
       sendto_channel_local(source_p, chptr, 0, CAP_AWAY_NOTIFY, 0,
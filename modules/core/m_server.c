@@ -39,6 +39,8 @@
 #include "misc.h"
 #include "server.h"
 #include "server_capab.h"
+#include "server_zip.h"
+#include "snapshot.h"
 #include "user.h"
 #include "send.h"
 #include "parse.h"
@@ -71,138 +73,6 @@ server_set_flags(struct Client *client_p, const char *flags)
   }
 }
 
-/*
- * send_tb
- *
- * inputs       - pointer to Client
- *              - pointer to channel
- * output       - NONE
- * side effects - Called on a server burst when
- *                server is CAPAB_TBURST capable
- */
-static void
-server_send_tburst(struct Client *client_p, const struct Channel *chptr)
-{
-  /*
-   * We may also send an empty topic here, but only if topic_time isn't 0,
-   * i.e. if we had a topic that got unset.  This is required for syncing
-   * topics properly.
-   *
-   * Imagine the following scenario: Our downlink introduces a channel
-   * to us with a TS that is equal to ours, but the channel topic on
-   * their side got unset while the servers were in splitmode, which means
-   * their 'topic' is newer.  They simply wanted to unset it, so we have to
-   * deal with it in a more sophisticated fashion instead of just resetting
-   * it to their old topic they had before.  Read m_tburst.c:ms_tburst
-   * for further information   -Michael
-   */
-  if (chptr->topic_time)
-    sendto_one(client_p, ":%s TBURST %ju %s %ju %s :%s", me.id,
-               chptr->creationtime, chptr->name,
-               chptr->topic_time,
-               chptr->topic_info,
-               chptr->topic);
-}
-
-/* sendnick_TS()
- *
- * inputs       - client (server) to send nick towards
- *          - client to send nick for
- * output       - NONE
- * side effects - NICK message is sent towards given client_p
- */
-static void
-server_send_client(struct Client *client_p, struct Client *target_p)
-{
-  dlink_node *node;
-  char buf[UMODE_MAX_STR] = "";
-
-  assert(IsClient(target_p));
-
-  send_umode(target_p, 0, 0, buf);
-
-  if (buf[0] == '\0')
-  {
-    buf[0] = '+';
-    buf[1] = '\0';
-  }
-
-    /* TBR: compatibility mode */
-  if (IsCapable(client_p, CAPAB_RHOST))
-    sendto_one(client_p, ":%s UID %s %u %ju %s %s %s %s %s %s %s :%s",
-               target_p->servptr->id,
-               target_p->name, target_p->hopcount + 1,
-               target_p->tsinfo,
-               buf, target_p->username, target_p->host, target_p->realhost,
-               target_p->sockhost, target_p->id,
-               target_p->account, target_p->info);
-  else
-    sendto_one(client_p, ":%s UID %s %u %ju %s %s %s %s %s %s :%s",
-               target_p->servptr->id,
-               target_p->name, target_p->hopcount + 1,
-               target_p->tsinfo,
-               buf, target_p->username, target_p->host,
-               target_p->sockhost, target_p->id,
-               target_p->account, target_p->info);
-
-  if (!EmptyString(target_p->certfp))
-    sendto_one(client_p, ":%s CERTFP %s", target_p->id, target_p->certfp);
-
-  if (target_p->away[0])
-    sendto_one(client_p, ":%s AWAY :%s", target_p->id, target_p->away);
-
-
-  DLINK_FOREACH(node, target_p->svstags.head)
-  {
-    const struct ServicesTag *svstag = node->data;
-    char *m = buf;
-
-    for (const struct user_modes *tab = umode_tab; tab->c; ++tab)
-      if (svstag->umodes & tab->flag)
-        *m++ = tab->c;
-    *m = '\0';
-
-    sendto_one(client_p, ":%s SVSTAG %s %ju %u +%s :%s", me.id, target_p->id,
-               target_p->tsinfo, svstag->numeric, buf, svstag->tag);
-  }
-}
-
-/* burst_all()
- *
- * inputs       - pointer to server to send burst to
- * output       - NONE
- * side effects - complete burst of channels/nicks is sent to client_p
- */
-static void
-server_burst(struct Client *client_p)
-{
-  dlink_node *node = NULL;
-
-  DLINK_FOREACH(node, global_client_list.head)
-  {
-    struct Client *target_p = node->data;
-
-    if (target_p->from != client_p)
-      server_send_client(client_p, target_p);
-  }
-
-  DLINK_FOREACH(node, channel_list.head)
-  {
-    struct Channel *chptr = node->data;
-
-    if (dlink_list_length(&chptr->members))
-    {
-      channel_send_modes(client_p, chptr);
-
-      if (IsCapable(client_p, CAPAB_TBURST))
-        server_send_tburst(client_p, chptr);
-    }
-  }
-
-  /* Always send a PING after connect burst is done */
-  sendto_one(client_p, "PING :%s", me.id);
-}
-
 /* server_estab()
  *
  * inputs       - pointer to a struct Client
@@ -251,6 +121,17 @@ server_estab(struct Client *client_p)
   sendto_one(client_p, ":%s SVINFO %u %u 0 :%ju", me.id, TS_CURRENT, TS_MIN,
              CurrentTime);
 
+  /*
+   * Once both sides have sent CAPAB ZLIB, everything after SVINFO is
+   * compressed.  Unlike SERVER, nothing unsolicited (like replies to
+   * the peer's auth notices) can follow it before we get here.
+   */
+  if (IsCapable(client_p, CAPAB_ZLIB) && zip_start(client_p) == 0)
+  {
+    exit_client(client_p, "Unable to set up link compression");
+    return;
+  }
+
   /* *WARNING*
   **    In the following code in place of plain server's
   **    name we send what is returned by client_get_name
@@ -360,21 +241,11 @@ server_estab(struct Client *client_p)
                target_p->info);
   }
 
-  server_burst(client_p);
-
-  if (IsCapable(client_p, CAPAB_EOB))
-  {
-    DLINK_FOREACH_PREV(node, global_server_list.tail)
-    {
-      struct Client *target_p = node->data;
+  /* Ahead of the burst, which is held back until the server's digests arrive */
+  if (IsCapable(client_p, CAPAB_SNAP))
+    snapshot_offer(client_p);
 
-      if (target_p->from == client_p)
-        continue;
-
-      if (IsMe(target_p) || HasFlag(target_p, FLAGS_EOB))
-        sendto_one(client_p, ":%s EOB", target_p->id);
-    }
-  }
+  server_burst(client_p);
 }
 
 /* set_server_gecos()
@@ -44,9 +44,7 @@
 static char modebuf[MODEBUFLEN];
 static char parabuf[MODEBUFLEN];
 static char sendbuf[MODEBUFLEN];
-static const char *para[MAXMODEPARAMS];
 static char *mbuf;
-static int pargs;
 
 static void set_final_mode(struct Mode *, struct Mode *);
 static void remove_our_modes(struct Channel *, struct Client *);
@@ -79,16 +77,13 @@ ms_sjoin(struct Client *source_p, int parc, char *parv[])
   char           keep_our_modes = 1;
   char           keep_new_modes = 1;
   char           have_many_uids = 0;
-  int            lcount;
   char           uid_prefix[CMEMBER_STATUS_FLAGS_LEN + 1];
   char           *up = NULL;
   int            len_uid = 0;
   int            isnew = 0;
   int            buflen = 0;
-  int            slen;
   unsigned       int fl;
   char           *s;
-  char           *sptr;
   char uid_buf[IRCD_BUFSIZE];  /* buffer for modes/prefixes */
   char           *uid_ptr;
   char           *p; /* pointer used making sjbuf */
@@ -108,7 +103,6 @@ ms_sjoin(struct Client *source_p, int parc, char *parv[])
 
   modebuf[0] = '\0';
   mbuf = modebuf;
-  pargs = 0;
   newts = strtoumax(parv[1], NULL, 10);
 
   mode.mode = 0;
@@ -198,6 +192,8 @@ ms_sjoin(struct Client *source_p, int parc, char *parv[])
     tstosend = oldts;
   }
 
+  hash_update_channel_index(chptr, CHANNEL_INDEX_CREATED);
+
   if (!keep_new_modes)
     mode = *oldmode;
   else if (keep_our_modes)
@@ -282,12 +278,6 @@ ms_sjoin(struct Client *source_p, int parc, char *parv[])
     return 0;
   }
 
-  mbuf = modebuf;
-  sendbuf[0] = '\0';
-  pargs = 0;
-
-  *mbuf++ = '+';
-
   s = parv[args + 4];
   while (*s == ' ')
     ++s;
@@ -301,6 +291,9 @@ ms_sjoin(struct Client *source_p, int parc, char *parv[])
     have_many_uids = *p;
   }
 
+  /* The JOINs sent below go ahead of member modes held back so far */
+  channel_member_mode_hold(1);
+
   while (*s)
   {
     int valid_mode = 1;
@@ -381,12 +374,7 @@ ms_sjoin(struct Client *source_p, int parc, char *parv[])
     {
       add_user_to_channel(chptr, target_p, fl, !have_many_uids);
 
-      sendto_channel_local(NULL, chptr, 0, CAP_EXTENDED_JOIN, 0, ":%s!%s@%s JOIN %s %s :%s",
-                           target_p->name, target_p->username,
-                           target_p->host, chptr->name, target_p->account, target_p->info);
-      sendto_channel_local(NULL, chptr, 0, 0, CAP_EXTENDED_JOIN, ":%s!%s@%s JOIN :%s",
-                           target_p->name, target_p->username,
-                           target_p->host, chptr->name);
+      channel_send_join(chptr, target_p, NULL, 0);
 
       if (target_p->away[0])
         sendto_channel_local(target_p, chptr, 0, CAP_AWAY_NOTIFY, 0,
@@ -395,94 +383,14 @@ ms_sjoin(struct Client *source_p, int parc, char *parv[])
                              target_p->host, target_p->away);
     }
 
-    if (fl & CHFL_CHANOP)
-    {
-      *mbuf++ = 'o';
-      para[pargs++] = target_p->name;
-
-      if (pargs >= MAXMODEPARAMS)
-      {
-        /*
-         * Ok, the code is now going to "walk" through
-         * sendbuf, filling in para strings. So, I will use sptr
-         * to point into the sendbuf.
-         * Notice, that ircsprintf() returns the number of chars
-         * successfully inserted into string.
-         * - Dianora
-         */
-
-        sptr = sendbuf;
-        *mbuf = '\0';
-
-        for (lcount = 0; lcount < MAXMODEPARAMS; ++lcount)
-        {
-          slen = sprintf(sptr, " %s", para[lcount]);  /* see? */
-          sptr += slen;  /* ready for next */
-        }
-
-        sendto_channel_local(NULL, chptr, 0, 0, 0, ":%s MODE %s %s%s",
-                             servername, chptr->name, modebuf, sendbuf);
-        mbuf = modebuf;
-        *mbuf++ = '+';
-
-        sendbuf[0] = '\0';
-        pargs = 0;
-      }
-    }
-
-    if (fl & CHFL_HALFOP)
-    {
-      *mbuf++ = 'h';
-      para[pargs++] = target_p->name;
-
-      if (pargs >= MAXMODEPARAMS)
-      {
-        sptr = sendbuf;
-        *mbuf = '\0';
-
-        for (lcount = 0; lcount < MAXMODEPARAMS; ++lcount)
-        {
-          slen = sprintf(sptr, " %s", para[lcount]);
-          sptr += slen;
-        }
-
-        sendto_channel_local(NULL, chptr, 0, 0, 0, ":%s MODE %s %s%s",
-                             servername, chptr->name, modebuf, sendbuf);
-
-        mbuf = modebuf;
-        *mbuf++ = '+';
-
-        sendbuf[0] = '\0';
-        pargs = 0;
-      }
-    }
-
-    if (fl & CHFL_VOICE)
-    {
-      *mbuf++ = 'v';
-      para[pargs++] = target_p->name;
-
-      if (pargs >= MAXMODEPARAMS)
-      {
-        sptr = sendbuf;
-        *mbuf = '\0';
-
-        for (lcount = 0; lcount < MAXMODEPARAMS; ++lcount)
-        {
-          slen = sprintf(sptr, " %s", para[lcount]);
-          sptr += slen;
-        }
-
-        sendto_channel_local(NULL, chptr, 0, 0, 0, ":%s MODE %s %s%s",
-                             servername, chptr->name, modebuf, sendbuf);
-
-        mbuf = modebuf;
-        *mbuf++ = '+';
+    /*
+     * No local members to show the +o/+h/+v to.  Members of a SJOIN are
+     * remote, so this holds for the rest of the line.
+     */
+    if (chptr->locmembers.head == NULL)
+      goto nextnick;
 
-        sendbuf[0] = '\0';
-        pargs = 0;
-      }
-    }
+    channel_member_mode_add(chptr, servername, target_p, fl);
 
   nextnick:
     if ((s = p) == NULL)
@@ -500,30 +408,9 @@ ms_sjoin(struct Client *source_p, int parc, char *parv[])
     }
   }
 
-  *mbuf = '\0';
-  *(uid_ptr - 1) = '\0';
-
-  /*
-   * checking for lcount < MAXMODEPARAMS at this time is wrong
-   * since the code has already verified above that pargs < MAXMODEPARAMS
-   * checking for para[lcount] != '\0' is also wrong, since
-   * there is no place where para[lcount] is set!
-   * - Dianora
-   */
+  channel_member_mode_hold(0);
 
-  if (pargs)
-  {
-    sptr = sendbuf;
-
-    for (lcount = 0; lcount < pargs; ++lcount)
-    {
-      slen = sprintf(sptr, " %s", para[lcount]);
-      sptr += slen;
-    }
-
-    sendto_channel_local(NULL, chptr, 0, 0, 0, ":%s MODE %s %s%s",
-                         servername, chptr->name, modebuf, sendbuf);
-  }
+  *(uid_ptr - 1) = '\0';
 
   /*
    * If this happens, it's the result of a malformed SJOIN
@@ -575,7 +462,6 @@ set_final_mode(struct Mode *mode, struct Mode *oldmode)
     *mbuf++ = 'k';
     len = sprintf(pbuf, "%s ", oldmode->key);
     pbuf += len;
-    pargs++;
   }
 
   if (*(mbuf - 1) == '-')
@@ -592,7 +478,6 @@ set_final_mode(struct Mode *mode, struct Mode *oldmode)
     *mbuf++ = 'l';
     len = sprintf(pbuf, "%u ", mode->limit);
     pbuf += len;
-    pargs++;
   }
 
   if (mode->key[0] && strcmp(oldmode->key, mode->key))
@@ -600,7 +485,6 @@ set_final_mode(struct Mode *mode, struct Mode *oldmode)
     *mbuf++ = 'k';
     len = sprintf(pbuf, "%s ", mode->key);
     pbuf += len;
-    pargs++;
   }
 
   if (*(mbuf - 1) == '+')
@@ -745,7 +629,7 @@ remove_ban_list(struct Channel *chptr, struct Client *source_p,
     pbuf += sprintf(pbuf, "%s!%s@%s ", ban->name, ban->user, ban->host);
     ++count;
 
-    remove_ban(ban, list);
+    remove_ban(chptr, ban, list);
   }
 
   *mbuf = *(pbuf - 1) = '\0';
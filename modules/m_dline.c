@@ -43,58 +43,6 @@
 #include "memory.h"
 
 
-static void
-dline_check(const struct AddressRec *arec)
-{
-  dlink_node *node, *node_next;
-
-  DLINK_FOREACH_SAFE(node, node_next, local_client_list.head)
-  {
-    struct Client *client_p = node->data;
-
-    if (IsDead(client_p))
-      continue;
-
-    switch (arec->masktype)
-    {
-      case HM_IPV4:
-        if (client_p->connection->aftype == AF_INET)
-          if (match_ipv4(&client_p->connection->ip, &arec->Mask.ipa.addr, arec->Mask.ipa.bits))
-            conf_try_ban(client_p, CLIENT_BAN_DLINE, arec->conf->reason);
-        break;
-      case HM_IPV6:
-        if (client_p->connection->aftype == AF_INET6)
-          if (match_ipv6(&client_p->connection->ip, &arec->Mask.ipa.addr, arec->Mask.ipa.bits))
-            conf_try_ban(client_p, CLIENT_BAN_DLINE, arec->conf->reason);
-        break;
-      default: break;
-    }
-  }
-
-  DLINK_FOREACH_SAFE(node, node_next, unknown_list.head)
-  {
-    struct Client *client_p = node->data;
-
-    if (IsDead(client_p))
-      continue;
-
-    switch (arec->masktype)
-    {
-      case HM_IPV4:
-        if (client_p->connection->aftype == AF_INET)
-          if (match_ipv4(&client_p->connection->ip, &arec->Mask.ipa.addr, arec->Mask.ipa.bits))
-            conf_try_ban(client_p, CLIENT_BAN_DLINE, arec->conf->reason);
-        break;
-      case HM_IPV6:
-        if (client_p->connection->aftype == AF_INET6)
-          if (match_ipv6(&client_p->connection->ip, &arec->Mask.ipa.addr, arec->Mask.ipa.bits))
-            conf_try_ban(client_p, CLIENT_BAN_DLINE, arec->conf->reason);
-        break;
-      default: break;
-    }
-  }
-}
-
 /* dline_add()
  *
  * inputs	-
@@ -192,7 +140,7 @@ dline_handle(struct Client *source_p, const char *addr, const char *reason, uint
          get_oper_name(source_p), conf->host, conf->reason);
   }
 
-  dline_check(add_conf_by_address(CONF_DLINE, conf));
+  client_ban_check_address(add_conf_by_address(CONF_DLINE, conf));
 }
 
 /* mo_dline()
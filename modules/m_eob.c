@@ -31,6 +31,7 @@
 #include "parse.h"
 #include "modules.h"
 #include "server.h"
+#include "snapshot.h"
 
 
 /*! \brief EOB command handler
@@ -57,6 +58,9 @@ ms_eob(struct Client *source_p, int parc, char *parv[])
   AddFlag(source_p, FLAGS_EOB);
   sendto_server(source_p, 0, 0, ":%s EOB", source_p->id);
 
+  if (MyConnect(source_p))
+    snapshot_release(source_p);
+
   return 0;
 }
 
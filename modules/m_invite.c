@@ -40,6 +40,26 @@
 #include "packet.h"
 
 
+/*! \brief Tells channel operators of an invite-only channel about an INVITE,
+ *         as an INVITE to clients with invite-notify and a NOTICE otherwise
+ * \param source_p Client issuing the invite
+ * \param target_p Client being invited
+ * \param chptr    Channel the invite is for
+ */
+static void
+invite_notify(const struct Client *source_p, const struct Client *target_p, struct Channel *chptr)
+{
+  const struct SendVariant variants[] =
+  {
+    { ":%s NOTICE %%%s :%s is inviting %s to %s.",
+      { me.name, chptr->name, source_p->name, target_p->name, chptr->name } },
+    { ":%s!%s@%s INVITE %s %s",
+      { source_p->name, source_p->username, source_p->host, target_p->name, chptr->name } }
+  };
+
+  sendto_channel_local_variants(NULL, chptr, CHFL_CHANOP | CHFL_HALFOP, 0, CAP_INVITE_NOTIFY, variants);
+}
+
 /*! \brief INVITE command handler
  *
  * \param source_p Pointer to allocated Client struct from which the message
@@ -148,12 +168,7 @@ m_invite(struct Client *source_p, int parc, char *parv[])
 
   if (HasCMode(chptr, MODE_INVITEONLY))
   {
-    sendto_channel_local(NULL, chptr, CHFL_CHANOP | CHFL_HALFOP, 0, CAP_INVITE_NOTIFY,
-                         ":%s NOTICE %%%s :%s is inviting %s to %s.",
-                         me.name, chptr->name, source_p->name, target_p->name, chptr->name);
-    sendto_channel_local(NULL, chptr, CHFL_CHANOP | CHFL_HALFOP, CAP_INVITE_NOTIFY, 0,
-                         ":%s!%s@%s INVITE %s %s", source_p->name, source_p->username,
-                         source_p->host, target_p->name, chptr->name);
+    invite_notify(source_p, target_p, chptr);
   }
 
   sendto_server(source_p, 0, 0, ":%s INVITE %s %s %ju",
@@ -212,12 +227,7 @@ ms_invite(struct Client *source_p, int parc, char *parv[])
 
   if (HasCMode(chptr, MODE_INVITEONLY))
   {
-    sendto_channel_local(NULL, chptr, CHFL_CHANOP | CHFL_HALFOP, 0, CAP_INVITE_NOTIFY,
-                         ":%s NOTICE %%%s :%s is inviting %s to %s.",
-                         me.name, chptr->name, source_p->name, target_p->name, chptr->name);
-    sendto_channel_local(NULL, chptr, CHFL_CHANOP | CHFL_HALFOP, CAP_INVITE_NOTIFY, 0,
-                         ":%s!%s@%s INVITE %s %s", source_p->name, source_p->username,
-                         source_p->host, target_p->name, chptr->name);
+    invite_notify(source_p, target_p, chptr);
   }
 
   sendto_server(source_p, 0, 0, ":%s INVITE %s %s %ju",
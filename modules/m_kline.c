@@ -43,41 +43,6 @@
 #include "memory.h"
 
 
-static void
-kline_check(const struct AddressRec *arec)
-{
-  dlink_node *node, *node_next;
-
-  DLINK_FOREACH_SAFE(node, node_next, local_client_list.head)
-  {
-    struct Client *client_p = node->data;
-
-    if (IsDead(client_p))
-      continue;
-
-    if (match(arec->username, client_p->username))
-      continue;
-
-    switch (arec->masktype)
-    {
-      case HM_IPV4:
-        if (client_p->connection->aftype == AF_INET)
-          if (match_ipv4(&client_p->connection->ip, &arec->Mask.ipa.addr, arec->Mask.ipa.bits))
-            conf_try_ban(client_p, CLIENT_BAN_KLINE, arec->conf->reason);
-        break;
-      case HM_IPV6:
-        if (client_p->connection->aftype == AF_INET6)
-          if (match_ipv6(&client_p->connection->ip, &arec->Mask.ipa.addr, arec->Mask.ipa.bits))
-            conf_try_ban(client_p, CLIENT_BAN_KLINE, arec->conf->reason);
-        break;
-      default:  /* HM_HOST */
-        if (!match(arec->Mask.hostname, client_p->host) || !match(arec->Mask.hostname, client_p->sockhost))
-          conf_try_ban(client_p, CLIENT_BAN_KLINE, arec->conf->reason);
-        break;
-    }
-  }
-}
-
 /* apply_tkline()
  *
  * inputs       -
@@ -183,7 +148,7 @@ kline_handle(struct Client *source_p, const char *user, const char *host,
          get_oper_name(source_p), conf->user, conf->host, conf->reason);
   }
 
-  kline_check(add_conf_by_address(CONF_KLINE, conf));
+  client_ban_check_address(add_conf_by_address(CONF_KLINE, conf));
 }
 
 /* mo_kline()
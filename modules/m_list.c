@@ -122,6 +122,7 @@ do_list(struct Client *source_p, char *arg)
             case ':':
               if (strlcpy(lt->topic, opt + 1, sizeof(lt->topic)) == 0)
                 errors = 1;
+              match_mask_compile(&lt->topic_match, lt->topic);
               break;
             default:
               errors = 1;
@@ -147,7 +148,13 @@ do_list(struct Client *source_p, char *arg)
             errors = 1;
 
           if (!errors)
-            dlinkAdd(xstrdup(opt), make_dlink_node(), list);
+          {
+            struct ListMask *lm = xcalloc(sizeof(*lm));
+
+            lm->mask = xstrdup(opt);
+            match_mask_compile(&lm->match, lm->mask);
+            dlinkAdd(lm, make_dlink_node(), list);
+          }
       }
     }
 
@@ -159,6 +166,8 @@ do_list(struct Client *source_p, char *arg)
     }
   }
 
+  list_task_pick_index(lt);
+
   sendto_one_numeric(source_p, &me, RPL_LISTSTART);
   safe_list_channels(source_p, no_masked_channels && lt->show_mask.head != NULL);
 }
@@ -0,0 +1,137 @@
+/*
+ *  ircd-hybrid: an advanced, lightweight Internet Relay Chat Daemon (ircd)
+ *
+ *  Copyright (c) 2017 ircd-hybrid development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ *  USA
+ */
+
+/*! \file m_snapshot.c
+ * \brief Includes required functions for processing the SNAPDIGEST and SNAPUSE commands.
+ * \version $Id$
+ */
+
+
+#include "stdinc.h"
+#include "client.h"
+#include "irc_string.h"
+#include "ircd.h"
+#include "send.h"
+#include "snapshot.h"
+#include "parse.h"
+#include "modules.h"
+
+
+/*! \brief SNAPDIGEST command handler
+ *
+ * \param source_p Pointer to allocated Client struct from which the message
+ *                 originally comes from.  This can be a local or remote client.
+ * \param parc     Integer holding the number of supplied arguments.
+ * \param parv     Argument vector where parv[0] .. parv[parc-1] are non-NULL
+ *                 pointers.
+ * \note Valid arguments for this command are:
+ *      - parv[0] = command
+ *      - parv[1] = SNAPSHOT_VERSION of the server
+ *      - parv[2] = table, or END after the last digests
+ *      - parv[3] = first range
+ *      - parv[4] = space separated digests of that and the following ranges
+ */
+static int
+ms_snapdigest(struct Client *source_p, int parc, char *parv[])
+{
+  if (!MyConnect(source_p))
+    return 0;
+
+  if (!strcmp(parv[2], "END"))
+  {
+    snapshot_delta_ready(source_p);
+    return 0;
+  }
+
+  if (parc < 5)
+    return 0;
+
+  snapshot_delta_digests(source_p, strtoul(parv[1], NULL, 10), snapshot_table(parv[2]),
+                         strtoul(parv[3], NULL, 10), parv[4]);
+  return 0;
+}
+
+/*! \brief SNAPUSE command handler
+ *
+ * \param source_p Pointer to allocated Client struct from which the message
+ *                 originally comes from.  This can be a local or remote client.
+ * \param parc     Integer holding the number of supplied arguments.
+ * \param parv     Argument vector where parv[0] .. parv[parc-1] are non-NULL
+ *                 pointers.
+ * \note Valid arguments for this command are:
+ *      - parv[0] = command
+ *      - parv[1] = table
+ *      - parv[2] = bitmap in hex of the ranges to use from our snapshot
+ */
+static int
+ms_snapuse(struct Client *source_p, int parc, char *parv[])
+{
+  if (!MyConnect(source_p))
+    return 0;
+
+  snapshot_replay(source_p, snapshot_table(parv[1]), parv[2]);
+  return 0;
+}
+
+static struct Message snapdigest_msgtab =
+{
+  .cmd = "SNAPDIGEST",
+  .args_min = 3,
+  .args_max = MAXPARA,
+  .handlers[UNREGISTERED_HANDLER] = m_unregistered,
+  .handlers[CLIENT_HANDLER] = m_ignore,
+  .handlers[SERVER_HANDLER] = ms_snapdigest,
+  .handlers[ENCAP_HANDLER] = m_ignore,
+  .handlers[OPER_HANDLER] = m_ignore
+};
+
+static struct Message snapuse_msgtab =
+{
+  .cmd = "SNAPUSE",
+  .args_min = 3,
+  .args_max = MAXPARA,
+  .handlers[UNREGISTERED_HANDLER] = m_unregistered,
+  .handlers[CLIENT_HANDLER] = m_ignore,
+  .handlers[SERVER_HANDLER] = ms_snapuse,
+  .handlers[ENCAP_HANDLER] = m_ignore,
+  .handlers[OPER_HANDLER] = m_ignore
+};
+
+static void
+module_init(void)
+{
+  mod_add_cmd(&snapdigest_msgtab);
+  mod_add_cmd(&snapuse_msgtab);
+}
+
+static void
+module_exit(void)
+{
+  mod_del_cmd(&snapdigest_msgtab);
+  mod_del_cmd(&snapuse_msgtab);
+}
+
+struct module module_entry =
+{
+  .version = "$Revision$",
+  .modinit = module_init,
+  .modexit = module_exit,
+};
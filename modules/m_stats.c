@@ -44,6 +44,7 @@
 #include "misc.h"
 #include "server.h"
 #include "server_capab.h"
+#include "server_zip.h"
 #include "event.h"
 #include "parse.h"
 #include "modules.h"
@@ -346,10 +347,12 @@ stats_memory(struct Client *source_p, int parc, char *parv[])
       const struct Client *acptr = node->data;
 
       DLINK_FOREACH(node2, acptr->connection->list_task->show_mask.head)
-        safelist_memory += strlen(node2->data);
+        safelist_memory += sizeof(struct ListMask) +
+                           strlen(((const struct ListMask *)node2->data)->mask);
 
       DLINK_FOREACH(node2, acptr->connection->list_task->hide_mask.head)
-        safelist_memory += strlen(node2->data);
+        safelist_memory += sizeof(struct ListMask) +
+                           strlen(((const struct ListMask *)node2->data)->mask);
     }
   }
 
@@ -566,7 +569,7 @@ stats_events(struct Client *source_p, int parc, char *parv[])
 
     sendto_one_numeric(source_p, &me, RPL_STATSDEBUG | SND_EXPLICIT,
                        "E :%-30s %-4ji seconds",
-                       ev->name, ev->next - CurrentTime);
+                       ev->name, ev->next / 1000 - CurrentTime);
   }
 }
 
@@ -1085,6 +1088,19 @@ stats_servlinks(struct Client *source_p, int parc, char *parv[])
                (unsigned int)(CurrentTime - target_p->connection->firsttime),
                (CurrentTime > target_p->connection->since) ? (unsigned int)(CurrentTime - target_p->connection->since) : 0,
                HasUMode(source_p, UMODE_OPER) ? capab_get(target_p) : "TS");
+
+    if (target_p->connection->zip)
+    {
+      const struct ZipLink *const zip = target_p->connection->zip;
+
+      sendto_one_numeric(source_p, &me, RPL_STATSDEBUG | SND_EXPLICIT,
+                         "? :%s compression: sent %ju/%ju K (%.1f%%), received %ju/%ju K (%.1f%%)",
+                         target_p->name,
+                         zip->out_wire >> 10, zip->out_data >> 10,
+                         zip->out_data ? 100.0 * zip->out_wire / zip->out_data : 100.0,
+                         zip->in_wire >> 10, zip->in_data >> 10,
+                         zip->in_data ? 100.0 * zip->in_wire / zip->in_data : 100.0);
+    }
   }
 
   sendB >>= 10;
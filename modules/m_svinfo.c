@@ -29,6 +29,7 @@
 #include "irc_string.h"
 #include "ircd.h"
 #include "send.h"
+#include "server_zip.h"
 #include "conf.h"
 #include "log.h"
 #include "parse.h"
@@ -57,6 +58,13 @@ ms_svinfo(struct Client *source_p, int parc, char *parv[])
   if (!IsServer(source_p) || !MyConnect(source_p))
     return 0;
 
+  /* Whatever follows SVINFO on a compressed link has to be inflated */
+  if (source_p->connection->zip && zip_start_read(source_p) == 0)
+  {
+    exit_client(source_p, "Decompression error");
+    return 0;
+  }
+
   if (TS_CURRENT < atoi(parv[2]) || atoi(parv[1]) < TS_MIN)
   {
     /*
@@ -107,11 +107,13 @@ mr_webirc(struct Client *source_p, int parc, char *parv[])
 
   assert(res);
 
+  client_ban_index_del(source_p);
   memcpy(&source_p->connection->ip, res->ai_addr, res->ai_addrlen);
   source_p->connection->ip.ss_len = res->ai_addrlen;
   source_p->connection->ip.ss.ss_family = res->ai_family;
   source_p->connection->aftype = res->ai_family;
   freeaddrinfo(res);
+  client_ban_index_add(source_p);
 
   strlcpy(source_p->sockhost, addr, sizeof(source_p->sockhost));
 
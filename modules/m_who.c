@@ -85,43 +85,71 @@ do_who(struct Client *source_p, const struct Client *target_p,
 /*!
  * \param source_p Pointer to client requesting who
  * \param target_p Pointer to client to do who on
- * \param mask Mask to match
+ * \param mask Compiled mask to match, or NULL to match everyone
  * \return 1 if mask matches, 0 otherwise
+ * \note Servers whose name matches are marked by who_mark_servers()
+ *       beforehand, so the server name isn't matched once per client.
  */
 static int
-who_matches(struct Client *source_p, struct Client *target_p, const char *mask)
+who_matches(struct Client *source_p, struct Client *target_p, const struct MatchMask *mask)
 {
   if (!mask)
     return 1;
 
-  if (!match(mask, target_p->name))
+  if (HasFlag(target_p->servptr, FLAGS_MARK))
     return 1;
 
-  if (!match(mask, target_p->username))
+  if (!match_mask(mask, target_p->name))
     return 1;
 
-  if (!match(mask, target_p->host))
+  if (!match_mask(mask, target_p->username))
     return 1;
 
-  if (!match(mask, target_p->info))
+  if (!match_mask(mask, target_p->host))
     return 1;
 
-  if (HasUMode(source_p, UMODE_OPER))
-    if (!match(mask, target_p->sockhost))
-      return 1;
+  if (!match_mask(mask, target_p->info))
+    return 1;
 
-  if (HasUMode(source_p, UMODE_OPER) ||
-      (!ConfigServerHide.hide_servers && !IsHidden(target_p->servptr)))
-    if (!match(mask, target_p->servptr->name))
+  if (HasUMode(source_p, UMODE_OPER))
+    if (!match_mask(mask, target_p->sockhost))
       return 1;
 
   return 0;
 }
 
+/* who_mark_servers()
+ *
+ * inputs	- pointer to client requesting who
+ *		- compiled mask to match
+ *		- 1 to mark matching servers, 0 to unmark them again
+ * output	- NONE
+ * side effects - marks the servers whose name matches the mask and is
+ *		  visible to source_p; who_matches() accepts all their
+ *		  clients without looking at them any further
+ */
+static void
+who_mark_servers(struct Client *source_p, const struct MatchMask *mask, int mark)
+{
+  dlink_node *node = NULL;
+
+  DLINK_FOREACH(node, global_server_list.head)
+  {
+    struct Client *target_p = node->data;
+
+    if (!mark)
+      DelFlag(target_p, FLAGS_MARK);
+    else if ((HasUMode(source_p, UMODE_OPER) ||
+              (!ConfigServerHide.hide_servers && !IsHidden(target_p))) &&
+             !match_mask(mask, target_p->name))
+      AddFlag(target_p, FLAGS_MARK);
+  }
+}
+
 /* who_common_channel
  * inputs	- pointer to client requesting who
  * 		- pointer to channel member chain.
- *		- char * mask to match
+ *		- compiled mask to match
  *		- int if oper on a server or not
  *		- pointer to int maxmatches
  * output	- NONE
@@ -130,7 +158,7 @@ who_matches(struct Client *source_p, struct Client *target_p, const char *mask)
  *
  */
 static void
-who_common_channel(struct Client *source_p, struct Channel *chptr, const char *mask,
+who_common_channel(struct Client *source_p, struct Channel *chptr, const struct MatchMask *mask,
                    int server_oper, unsigned int *maxmatches)
 {
   dlink_node *node = NULL;
@@ -165,32 +193,20 @@ who_common_channel(struct Client *source_p, struct Channel *chptr, const char *m
   }
 }
 
-/* who_global()
+/* who_global_scan()
  *
  * inputs	- pointer to client requesting who
- *		- char * mask to match
+ *		- compiled mask to match
  *		- int if oper on a server or not
  * output	- NONE
  * side effects - do a global scan of all clients looking for match
  *		  this is slightly expensive on EFnet ...
  */
 static void
-who_global(struct Client *source_p, const char *mask, int server_oper)
+who_global_scan(struct Client *source_p, const struct MatchMask *mask, int server_oper)
 {
   dlink_node *node = NULL;
   unsigned int maxmatches = WHO_MAX_REPLIES;
-  static uintmax_t last_used = 0;
-
-  if (!HasUMode(source_p, UMODE_OPER))
-  {
-    if ((last_used + ConfigGeneral.pace_wait) > CurrentTime)
-    {
-      sendto_one_numeric(source_p, &me, RPL_LOAD2HI, "WHO");
-      return;
-    }
-
-    last_used = CurrentTime;
-  }
 
   /* First, list all matching invisible clients on common channels */
   DLINK_FOREACH(node, source_p->channel.head)
@@ -233,6 +249,45 @@ who_global(struct Client *source_p, const char *mask, int server_oper)
   }
 }
 
+/* who_global()
+ *
+ * inputs	- pointer to client requesting who
+ *		- char * mask to match
+ *		- int if oper on a server or not
+ * output	- NONE
+ * side effects - the mask is compiled and matched against the server
+ *		  names once, then all clients are scanned
+ */
+static void
+who_global(struct Client *source_p, const char *mask, int server_oper)
+{
+  struct MatchMask mm;
+  static uintmax_t last_used = 0;
+
+  if (!HasUMode(source_p, UMODE_OPER))
+  {
+    if ((last_used + ConfigGeneral.pace_wait) > CurrentTime)
+    {
+      sendto_one_numeric(source_p, &me, RPL_LOAD2HI, "WHO");
+      return;
+    }
+
+    last_used = CurrentTime;
+  }
+
+  if (!mask)
+  {
+    who_global_scan(source_p, NULL, server_oper);
+    return;
+  }
+
+  match_mask_compile(&mm, mask);
+
+  who_mark_servers(source_p, &mm, 1);
+  who_global_scan(source_p, &mm, server_oper);
+  who_mark_servers(source_p, &mm, 0);
+}
+
 /* do_who_on_channel()
  *
  * inputs	- pointer to client requesting who
@@ -43,23 +43,6 @@
 #include "memory.h"
 
 
-static void
-xline_check(const struct GecosItem *gecos)
-{
-  dlink_node *node, *node_next;
-
-  DLINK_FOREACH_SAFE(node, node_next, local_client_list.head)
-  {
-    struct Client *client_p = node->data;
-
-    if (IsDead(client_p))
-      continue;
-
-    if (!match(gecos->mask, client_p->info))
-      conf_try_ban(client_p, CLIENT_BAN_XLINE, gecos->reason);
-  }
-}
-
 /* xline_handle()
  *
  * inputs       - client taking credit for xline, gecos, reason, xline type
@@ -97,8 +80,7 @@ xline_handle(struct Client *source_p, const char *mask, const char *reason, uint
   else
     snprintf(buf, sizeof(buf), "%.*s (%s)", REASONLEN, reason, date_iso8601(0));
 
-  gecos = gecos_make();
-  gecos->mask = xstrdup(mask);
+  gecos = gecos_make(mask);
   gecos->reason = xstrdup(buf);
   gecos->setat = CurrentTime;
   gecos->in_database = 1;
@@ -132,7 +114,7 @@ xline_handle(struct Client *source_p, const char *mask, const char *reason, uint
          get_oper_name(source_p), gecos->mask, gecos->reason);
   }
 
-  xline_check(gecos);
+  client_ban_check_gecos();
 }
 
 /* mo_xline()
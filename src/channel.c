@@ -38,12 +38,47 @@
 #include "numeric.h"
 #include "server.h"
 #include "send.h"
+#include "dbuf.h"
 #include "event.h"
 #include "memory.h"
 #include "mempool.h"
 #include "misc.h"
+#include "patricia.h"
 
 
+/* b/e/I lists shorter than this are cheaper to scan than to index */
+#define BAN_INDEX_MIN       8
+#define BAN_INDEX_HASH_SIZE 64
+
+enum
+{
+  BAN_INDEX_BAN,
+  BAN_INDEX_EXCEPT,
+  BAN_INDEX_INVEX,
+  BAN_INDEX_LAST
+};
+
+/*! \brief Lookup index compiled from one of a channel's b/e/I lists.
+ * Every mask sits in exactly one bucket, chained through Ban.hnext:
+ * literal hosts are hashed, wildcard hosts with a literal tail are
+ * hashed by the part of that tail starting at its first dot, and CIDR
+ * masks live in a patricia tree. Whatever is left is scanned.
+ */
+struct BanIndexList
+{
+  int compiled;
+  struct Ban *exact[BAN_INDEX_HASH_SIZE];
+  struct Ban *suffix[BAN_INDEX_HASH_SIZE];
+  struct Ban *other;
+  patricia_tree_t *ipv4;
+  patricia_tree_t *ipv6;
+};
+
+struct BanIndex
+{
+  struct BanIndexList list[BAN_INDEX_LAST];
+};
+
 dlink_list channel_list;
 mp_pool_t *ban_pool;    /*! \todo ban_pool shouldn't be a global var */
 
@@ -111,6 +146,7 @@ add_user_to_channel(struct Channel *chptr, struct Client *client_p,
   member->flags = flags;
 
   dlinkAdd(member, &member->channode, &chptr->members);
+  hash_update_channel_index(chptr, CHANNEL_INDEX_USERS);
 
   if (MyConnect(client_p))
     dlinkAdd(member, &member->locchannode, &chptr->locmembers);
@@ -118,12 +154,14 @@ add_user_to_channel(struct Channel *chptr, struct Client *client_p,
   dlinkAdd(member, &member->usernode, &client_p->channel);
 }
 
-/*! \brief Deletes an user from a channel by removing a link in the
- *         channels member chain.
- * \param member Pointer to Membership struct
+/*! \brief Unlinks a member from its channel and client.
+ * \param member  Pointer to Membership struct
+ * \param changed NULL to free the channel or update its LIST index
+ *                entry right away; otherwise the channel is added to
+ *                this list, once, for the caller to do so
  */
-void
-remove_user_from_channel(struct Membership *member)
+static void
+channel_unlink_member(struct Membership *member, dlink_list *changed)
 {
   struct Client *const client_p = member->client_p;
   struct Channel *const chptr = member->chptr;
@@ -137,33 +175,95 @@ remove_user_from_channel(struct Membership *member)
 
   mp_pool_release(member);
 
-  if (chptr->members.head == NULL)
+  if (changed)
+  {
+    if (!(chptr->flags & MEMBERS_REMOVED))
+    {
+      chptr->flags |= MEMBERS_REMOVED;
+      dlinkAdd(chptr, make_dlink_node(), changed);
+    }
+  }
+  else if (chptr->members.head == NULL)
     channel_free(chptr);
+  else
+    hash_update_channel_index(chptr, CHANNEL_INDEX_USERS);
 }
 
-/* channel_send_members()
+/*! \brief Deletes an user from a channel by removing a link in the
+ *         channels member chain.
+ * \param member Pointer to Membership struct
+ */
+void
+remove_user_from_channel(struct Membership *member)
+{
+  channel_unlink_member(member, NULL);
+}
+
+/*! \brief Removes a number of clients from all of their channels, such as
+ *         the users behind a netsplit.  Channels are freed or have their
+ *         LIST index entry updated once, after all members have left.
+ * \param clients Clients to remove
+ * \param count   Number of clients
+ */
+void
+channel_remove_clients(struct Client *const *clients, unsigned int count)
+{
+  dlink_list changed = { NULL, NULL, 0 };
+  dlink_node *node, *node_next;
+
+  for (unsigned int i = 0; i < count; ++i)
+    while (clients[i]->channel.head)
+      channel_unlink_member(clients[i]->channel.head->data, &changed);
+
+  DLINK_FOREACH_SAFE(node, node_next, changed.head)
+  {
+    struct Channel *const chptr = node->data;
+
+    chptr->flags &= ~MEMBERS_REMOVED;
+
+    if (chptr->members.head == NULL)
+      channel_free(chptr);
+    else
+      hash_update_channel_index(chptr, CHANNEL_INDEX_USERS);
+
+    dlinkDelete(node, &changed);
+    free_dlink_node(node);
+  }
+}
+
+/* channel_burst_members()
  *
- * inputs       -
- * output       - NONE
- * side effects -
+ * inputs       - queue to add the SJOIN lines to
+ *              - server the burst is meant for
+ *              - channel to burst
+ *              - mode and parameter strings
+ *              - nonzero for the members behind client_p, zero for
+ *                the others
+ * output       - number of members listed
+ * side effects - nothing is added if no member qualifies
  */
-static void
-channel_send_members(struct Client *client_p, const struct Channel *chptr,
-                     const char *modebuf, const char *parabuf)
+static unsigned int
+channel_burst_members(struct dbuf_queue *queue, struct Client *client_p,
+                      const struct Channel *chptr, const char *modebuf,
+                      const char *parabuf, int behind)
 {
   dlink_node *node;
   char buf[IRCD_BUFSIZE] = "";
   int tlen;              /* length of text to append */
   char *t, *start;       /* temp char pointer */
+  unsigned int count = 0;
 
   start = t = buf + snprintf(buf, sizeof(buf), ":%s SJOIN %ju %s %s %s:",
-                             me.id, chptr->creationtime,
+                             behind ? client_p->id : me.id, chptr->creationtime,
                              chptr->name, modebuf, parabuf);
 
   DLINK_FOREACH(node, chptr->members.head)
   {
     const struct Membership *member = node->data;
 
+    if ((member->client_p->from == client_p) != !!behind)
+      continue;
+
     tlen = strlen(member->client_p->id) + 1;  /* +1 for space */
 
     if (member->flags & CHFL_CHANOP)
@@ -180,7 +280,7 @@ channel_send_members(struct Client *client_p, const struct Channel *chptr,
     if (t + tlen - buf > IRCD_BUFSIZE - 1)
     {
       *(t - 1) = '\0';  /* Kill the space and terminate the string */
-      sendto_one(client_p, "%s", buf);
+      send_prepare_queue(queue, "%s", buf);
       t = start;
     }
 
@@ -195,24 +295,28 @@ channel_send_members(struct Client *client_p, const struct Channel *chptr,
 
     t += strlen(t);
     *t++ = ' ';
+    ++count;
   }
 
-  /* Should always be non-NULL unless we have a kind of persistent channels */
-  if (chptr->members.head)
-    t--;  /* Take the space out */
+  if (count == 0)
+    return 0;
+
+  t--;  /* Take the space out */
   *t = '\0';
-  sendto_one(client_p, "%s", buf);
+  send_prepare_queue(queue, "%s", buf);
+  return count;
 }
 
-/*! \brief Sends +b/+e/+I
- * \param client_p Client pointer to server
- * \param chptr    Pointer to channel
- * \param list     Pointer to list of modes to send
- * \param flag     Char flag flagging type of mode. Currently this can be 'b', e' or 'I'
+/*! \brief Adds +b/+e/+I lines to a burst
+ * \param queue  Queue to add the BMASK lines to
+ * \param source ID of the server the lines are from
+ * \param chptr  Pointer to channel
+ * \param list   Pointer to list of modes to send
+ * \param flag   Char flag flagging type of mode. Currently this can be 'b', e' or 'I'
  */
 static void
-channel_send_mask_list(struct Client *client_p, const struct Channel *chptr,
-                       const dlink_list *list, const char flag)
+channel_burst_mask_list(struct dbuf_queue *queue, const char *source, const struct Channel *chptr,
+                        const dlink_list *list, const char flag)
 {
   dlink_node *node;
   char mbuf[IRCD_BUFSIZE] = "";
@@ -223,7 +327,7 @@ channel_send_mask_list(struct Client *client_p, const struct Channel *chptr,
   if (!dlink_list_length(list))
     return;
 
-  mlen = snprintf(mbuf, sizeof(mbuf), ":%s BMASK %ju %s %c :", me.id,
+  mlen = snprintf(mbuf, sizeof(mbuf), ":%s BMASK %ju %s %c :", source,
                   chptr->creationtime, chptr->name, flag);
   cur_len = mlen;
 
@@ -239,7 +343,7 @@ channel_send_mask_list(struct Client *client_p, const struct Channel *chptr,
     if (cur_len + (tlen - 1) > IRCD_BUFSIZE - 2)
     {
       *(pp - 1) = '\0';  /* Get rid of trailing space on buffer */
-      sendto_one(client_p, "%s%s", mbuf, pbuf);
+      send_prepare_queue(queue, "%s%s", mbuf, pbuf);
 
       cur_len = mlen;
       pp = pbuf;
@@ -250,25 +354,36 @@ channel_send_mask_list(struct Client *client_p, const struct Channel *chptr,
   }
 
   *(pp - 1) = '\0';  /* Get rid of trailing space on buffer */
-  sendto_one(client_p, "%s%s", mbuf, pbuf);
+  send_prepare_queue(queue, "%s%s", mbuf, pbuf);
 }
 
-/*! \brief Send "client_p" a full list of the modes for channel chptr
- * \param client_p Pointer to client client_p
- * \param chptr    Pointer to channel pointer
+/*! \brief Adds the SJOIN and BMASK lines describing a channel to a burst
+ * \param queue    Queue to add the lines to
+ * \param client_p Pointer to the server the burst is meant for
+ * \param chptr    Pointer to channel
+ * \param behind   Nonzero to describe the channel the way client_p
+ *                 bursts it to us, with only the members behind it;
+ *                 zero for the burst we send with all other members
+ * \return Number of members listed; nothing is added if there are none
  */
-void
-channel_send_modes(struct Client *client_p, struct Channel *chptr)
+unsigned int
+channel_burst_modes(struct dbuf_queue *queue, struct Client *client_p,
+                    struct Channel *chptr, int behind)
 {
+  const char *const source = behind ? client_p->id : me.id;
   char modebuf[MODEBUFLEN] = "";
   char parabuf[MODEBUFLEN] = "";
 
   channel_modes(chptr, client_p, modebuf, parabuf);
-  channel_send_members(client_p, chptr, modebuf, parabuf);
 
-  channel_send_mask_list(client_p, chptr, &chptr->banlist, 'b');
-  channel_send_mask_list(client_p, chptr, &chptr->exceptlist, 'e');
-  channel_send_mask_list(client_p, chptr, &chptr->invexlist, 'I');
+  const unsigned int count = channel_burst_members(queue, client_p, chptr, modebuf, parabuf, behind);
+  if (count == 0)
+    return 0;
+
+  channel_burst_mask_list(queue, source, chptr, &chptr->banlist, 'b');
+  channel_burst_mask_list(queue, source, chptr, &chptr->exceptlist, 'e');
+  channel_burst_mask_list(queue, source, chptr, &chptr->invexlist, 'I');
+  return count;
 }
 
 /*! \brief Check channel name for invalid characters
@@ -302,26 +417,54 @@ channel_check_name(const char *name, const int local)
   return p - name <= CHANNELLEN;
 }
 
+/*! \brief Throw away the compiled b/e/I index of a channel. It gets
+ *         rebuilt on the next lookup; must be called whenever one of
+ *         the mask lists changes.
+ * \param chptr Pointer to channel
+ */
+void
+channel_clear_ban_index(struct Channel *chptr)
+{
+  struct BanIndex *index = chptr->ban_index;
+
+  if (index == NULL)
+    return;
+
+  for (unsigned int i = 0; i < BAN_INDEX_LAST; ++i)
+  {
+    if (index->list[i].ipv4)
+      patricia_destroy(index->list[i].ipv4, NULL);
+    if (index->list[i].ipv6)
+      patricia_destroy(index->list[i].ipv6, NULL);
+  }
+
+  xfree(index);
+  chptr->ban_index = NULL;
+}
+
 void
-remove_ban(struct Ban *ban, dlink_list *list)
+remove_ban(struct Channel *chptr, struct Ban *ban, dlink_list *list)
 {
+  channel_clear_ban_index(chptr);
+
   dlinkDelete(&ban->node, list);
   mp_pool_release(ban);
 }
 
 /* channel_free_mask_list()
  *
- * inputs       - pointer to dlink_list
+ * inputs       - pointer to channel
+ *              - pointer to dlink_list
  * output       - NONE
  * side effects -
  */
 static void
-channel_free_mask_list(dlink_list *list)
+channel_free_mask_list(struct Channel *chptr, dlink_list *list)
 {
   while (list->head)
   {
     struct Ban *ban = list->head->data;
-    remove_ban(ban, list);
+    remove_ban(chptr, ban, list);
   }
 }
 
@@ -360,10 +503,16 @@ channel_free(struct Channel *chptr)
   clear_invite_list(&chptr->invites);
 
   /* Free ban/exception/invex lists */
-  channel_free_mask_list(&chptr->banlist);
-  channel_free_mask_list(&chptr->exceptlist);
-  channel_free_mask_list(&chptr->invexlist);
+  channel_free_mask_list(chptr, &chptr->banlist);
+  channel_free_mask_list(chptr, &chptr->exceptlist);
+  channel_free_mask_list(chptr, &chptr->invexlist);
+  channel_clear_ban_index(chptr);
+  channel_member_mode_drop(chptr);
+
+  if (chptr->list_reply)
+    dbuf_ref_free(chptr->list_reply);
 
+  server_burst_unlink(&chptr->node);
   dlinkDelete(&chptr->node, &channel_list);
   hash_del_channel(chptr);
 
@@ -584,55 +733,211 @@ get_member_status(const struct Membership *member, const int combine)
 
 /*!
  * \param client_p Pointer to Client to check
- * \param list     Pointer to ban list to search
- * \return 1 if ban found for given n!u\@h mask, 0 otherwise
+ * \param ban      Pointer to ban to check against
+ * \return 1 if the given n!u\@h mask matches the client, 0 otherwise
  */
 static int
-find_bmask(const struct Client *client_p, const dlink_list *list)
+ban_match(const struct Client *client_p, const struct Ban *ban)
+{
+  if (match_mask(&ban->name_mask, client_p->name) ||
+      match_mask(&ban->user_mask, client_p->username))
+    return 0;
+
+  switch (ban->type)
+  {
+    case HM_HOST:
+      if (!match_mask(&ban->host_mask, client_p->host) ||
+          !match_mask(&ban->host_mask, client_p->sockhost))
+        return 1;
+      break;
+    case HM_IPV4:
+      if (client_p->connection->aftype == AF_INET)
+        if (match_ipv4(&client_p->connection->ip, &ban->addr, ban->bits))
+          return 1;
+      break;
+    case HM_IPV6:
+      if (client_p->connection->aftype == AF_INET6)
+        if (match_ipv6(&client_p->connection->ip, &ban->addr, ban->bits))
+          return 1;
+      break;
+    default:
+      assert(0);
+  }
+
+  return 0;
+}
+
+static int
+ban_match_chain(const struct Client *client_p, const struct Ban *ban)
+{
+  for (; ban; ban = ban->hnext)
+    if (ban_match(client_p, ban))
+      return 1;
+
+  return 0;
+}
+
+static void
+ban_index_add_cidr(patricia_tree_t **tree, unsigned int maxbits, struct Ban *ban)
+{
+  if (*tree == NULL)
+    *tree = patricia_new(maxbits);
+
+  patricia_node_t *pnode = patricia_make_and_lookup_addr(*tree, (struct sockaddr *)&ban->addr, ban->bits);
+
+  ban->hnext = pnode->data;
+  pnode->data = ban;
+}
+
+/*! \brief Sort every mask of a b/e/I list into its index bucket
+ * \param index Pointer to index to fill in
+ * \param list  Pointer to ban list
+ */
+static void
+ban_index_compile(struct BanIndexList *index, const dlink_list *list)
 {
   dlink_node *node;
 
   DLINK_FOREACH(node, list->head)
   {
-    const struct Ban *ban = node->data;
+    struct Ban *ban = node->data;
+    struct Ban **bucket = &index->other;
 
-    if (!match(ban->name, client_p->name) && !match(ban->user, client_p->username))
+    switch (ban->type)
     {
-      switch (ban->type)
+      case HM_IPV4:
+        /* A /0 would be taken for a host address by the patricia code */
+        if (ban->bits > 0)
+        {
+          ban_index_add_cidr(&index->ipv4, 32, ban);
+          continue;
+        }
+        break;
+      case HM_IPV6:
+        if (ban->bits > 0)
+        {
+          ban_index_add_cidr(&index->ipv6, 128, ban);
+          continue;
+        }
+        break;
+      default:
       {
-        case HM_HOST:
-          if (!match(ban->host, client_p->host) || !match(ban->host, client_p->sockhost))
-            return 1;
-          break;
-        case HM_IPV4:
-          if (client_p->connection->aftype == AF_INET)
-            if (match_ipv4(&client_p->connection->ip, &ban->addr, ban->bits))
-              return 1;
-          break;
-        case HM_IPV6:
-          if (client_p->connection->aftype == AF_INET6)
-            if (match_ipv6(&client_p->connection->ip, &ban->addr, ban->bits))
-              return 1;
-          break;
-        default:
-          assert(0);
+        const char *tail = ban->host;
+
+        for (const char *p = ban->host; *p; ++p)
+          if (IsMWildChar(*p) || *p == '\\')
+            tail = p + 1;
+
+        if (tail == ban->host)
+          bucket = &index->exact[strhash(ban->host) & (BAN_INDEX_HASH_SIZE - 1)];
+        else if ((tail = strchr(tail, '.')))
+          bucket = &index->suffix[strhash(tail) & (BAN_INDEX_HASH_SIZE - 1)];
+        break;
       }
     }
+
+    ban->hnext = *bucket;
+    *bucket = ban;
   }
 
+  index->compiled = 1;
+}
+
+/*!
+ * \param client_p Pointer to Client to check
+ * \param host     Host name or IP string of that client
+ * \param index    Pointer to compiled index to search
+ * \return 1 if a hashed host mask matches, 0 otherwise
+ */
+static int
+ban_index_find_host(const struct Client *client_p, const char *host,
+                    const struct BanIndexList *index)
+{
+  if (ban_match_chain(client_p, index->exact[strhash(host) & (BAN_INDEX_HASH_SIZE - 1)]))
+    return 1;
+
+  for (const char *p = strchr(host, '.'); p; p = strchr(p + 1, '.'))
+    if (ban_match_chain(client_p, index->suffix[strhash(p) & (BAN_INDEX_HASH_SIZE - 1)]))
+      return 1;
+
   return 0;
 }
 
+/*!
+ * \param client_p Pointer to Client to check
+ * \param tree     Patricia tree of CIDR masks for the client's address family
+ * \return 1 if a CIDR mask covering the client's address matches, 0 otherwise
+ */
+static int
+ban_index_find_cidr(const struct Client *client_p, patricia_tree_t *tree)
+{
+  patricia_node_t *pnode = patricia_try_search_best_addr(tree, (struct sockaddr *)&client_p->connection->ip, 0);
+
+  /* Every prefix-bearing ancestor of the best match covers the address as well */
+  for (; pnode; pnode = pnode->parent)
+    if (pnode->prefix && ban_match_chain(client_p, pnode->data))
+      return 1;
+
+  return 0;
+}
+
+/*!
+ * \param chptr    Pointer to channel the list belongs to
+ * \param client_p Pointer to Client to check
+ * \param list     Pointer to ban list to search
+ * \param which    BAN_INDEX_BAN, BAN_INDEX_EXCEPT or BAN_INDEX_INVEX
+ * \return 1 if ban found for given n!u\@h mask, 0 otherwise
+ */
+static int
+find_bmask(struct Channel *chptr, const struct Client *client_p, const dlink_list *list,
+           unsigned int which)
+{
+  dlink_node *node;
+
+  if (dlink_list_length(list) < BAN_INDEX_MIN)
+  {
+    DLINK_FOREACH(node, list->head)
+      if (ban_match(client_p, node->data))
+        return 1;
+
+    return 0;
+  }
+
+  if (chptr->ban_index == NULL)
+    chptr->ban_index = xcalloc(sizeof(*chptr->ban_index));
+
+  struct BanIndexList *index = &chptr->ban_index->list[which];
+  if (!index->compiled)
+    ban_index_compile(index, list);
+
+  if (ban_index_find_host(client_p, client_p->host, index) ||
+      ban_index_find_host(client_p, client_p->sockhost, index))
+    return 1;
+
+  if (client_p->connection->aftype == AF_INET && index->ipv4)
+  {
+    if (ban_index_find_cidr(client_p, index->ipv4))
+      return 1;
+  }
+  else if (client_p->connection->aftype == AF_INET6 && index->ipv6)
+  {
+    if (ban_index_find_cidr(client_p, index->ipv6))
+      return 1;
+  }
+
+  return ban_match_chain(client_p, index->other);
+}
+
 /*!
  * \param chptr    Pointer to channel block
  * \param client_p Pointer to client to check access fo
  * \return 0 if not banned, 1 otherwise
  */
 int
-is_banned(const struct Channel *chptr, const struct Client *client_p)
+is_banned(struct Channel *chptr, const struct Client *client_p)
 {
-  if (find_bmask(client_p, &chptr->banlist))
-    if (!find_bmask(client_p, &chptr->exceptlist))
+  if (find_bmask(chptr, client_p, &chptr->banlist, BAN_INDEX_BAN))
+    if (!find_bmask(chptr, client_p, &chptr->exceptlist, BAN_INDEX_EXCEPT))
       return 1;
 
   return 0;
@@ -659,7 +964,7 @@ can_join(struct Client *client_p, struct Channel *chptr, const char *key)
 
   if (HasCMode(chptr, MODE_INVITEONLY))
     if (!find_invite(chptr, client_p))
-      if (!find_bmask(client_p, &chptr->invexlist))
+      if (!find_bmask(chptr, client_p, &chptr->invexlist, BAN_INDEX_INVEX))
         return ERR_INVITEONLYCHAN;
 
   if (chptr->mode.key[0] && (!key || strcmp(chptr->mode.key, key)))
@@ -736,6 +1041,25 @@ msg_has_ctrls(const char *message)
   return 0;  /* No control code found */
 }
 
+/*! \brief Find the RESV matching a channel's name. The result is cached
+ *         in the channel until the channel RESV list changes.
+ * \param chptr Pointer to Channel struct
+ * \return Pointer to matching ResvItem or NULL
+ */
+static const struct ResvItem *
+channel_find_resv(struct Channel *chptr)
+{
+  const unsigned int generation = resv_chan_get_generation();
+
+  if (chptr->resv_generation != generation)
+  {
+    chptr->resv = resv_find(chptr->name, match);
+    chptr->resv_generation = generation;
+  }
+
+  return chptr->resv;
+}
+
 /*! Tests if a client can send to a channel
  * \param chptr    Pointer to Channel struct
  * \param client_p Pointer to Client struct
@@ -756,7 +1080,7 @@ can_send(struct Channel *chptr, struct Client *client_p,
 
   if (MyConnect(client_p) && !HasFlag(client_p, FLAGS_EXEMPTRESV))
     if (!(HasUMode(client_p, UMODE_OPER) && HasOFlag(client_p, OPER_FLAG_JOIN_RESV)))
-      if ((resv = resv_find(chptr->name, match)) && !resv_exempt_find(client_p, resv))
+      if ((resv = channel_find_resv(chptr)) && !resv_exempt_find(client_p, resv))
         return ERR_CANNOTSENDTOCHAN;
 
   if (HasCMode(chptr, MODE_NOCTRL) && msg_has_ctrls(message))
@@ -884,6 +1208,36 @@ channel_set_topic(struct Channel *chptr, const char *topic,
 
   strlcpy(chptr->topic_info, topic_info, sizeof(chptr->topic_info));
   chptr->topic_time = topicts;
+  hash_update_channel_index(chptr, CHANNEL_INDEX_TOPIC);
+
+  if (chptr->list_reply)
+  {
+    dbuf_ref_free(chptr->list_reply);
+    chptr->list_reply = NULL;
+  }
+}
+
+/*! \brief Announces a JOIN to the locally connected members of a channel,
+ *         using the extended-join form for those which asked for it
+ * \param chptr    Channel that has been joined
+ * \param client_p Client that joined
+ * \param one      Client to skip; can be NULL
+ * \param negcap   Members with any of these capabilities (CAP) are skipped
+ */
+void
+channel_send_join(struct Channel *chptr, struct Client *client_p,
+                  const struct Client *one, unsigned int negcap)
+{
+  const struct SendVariant variants[] =
+  {
+    { ":%s!%s@%s JOIN :%s",
+      { client_p->name, client_p->username, client_p->host, chptr->name } },
+    { ":%s!%s@%s JOIN %s %s :%s",
+      { client_p->name, client_p->username, client_p->host, chptr->name,
+        client_p->account, client_p->info } }
+  };
+
+  sendto_channel_local_variants(one, chptr, 0, negcap, CAP_EXTENDED_JOIN, variants);
 }
 
 /* do_join_0()
@@ -1037,6 +1391,7 @@ channel_do_join(struct Client *client_p, char *channel, char *key_list)
     if (flags == CHFL_CHANOP)
     {
       chptr->creationtime = CurrentTime;
+      hash_update_channel_index(chptr, CHANNEL_INDEX_CREATED);
       AddCMode(chptr, MODE_TOPICLIMIT);
       AddCMode(chptr, MODE_NOPRIVMSGS);
 
@@ -1047,12 +1402,7 @@ channel_do_join(struct Client *client_p, char *channel, char *key_list)
       /*
        * Notify all other users on the new channel
        */
-      sendto_channel_local(NULL, chptr, 0, CAP_EXTENDED_JOIN, 0, ":%s!%s@%s JOIN %s %s :%s",
-                           client_p->name, client_p->username,
-                           client_p->host, chptr->name, client_p->account, client_p->info);
-      sendto_channel_local(NULL, chptr, 0, 0, CAP_EXTENDED_JOIN, ":%s!%s@%s JOIN :%s",
-                           client_p->name, client_p->username,
-                           client_p->host, chptr->name);
+      channel_send_join(chptr, client_p, NULL, 0);
       sendto_channel_local(NULL, chptr, 0, 0, 0, ":%s MODE %s +nt",
                            me.name, chptr->name);
 
@@ -1068,12 +1418,7 @@ channel_do_join(struct Client *client_p, char *channel, char *key_list)
                     client_p->id, chptr->creationtime,
                     chptr->name);
 
-      sendto_channel_local(NULL, chptr, 0, CAP_EXTENDED_JOIN, 0, ":%s!%s@%s JOIN %s %s :%s",
-                           client_p->name, client_p->username,
-                           client_p->host, chptr->name, client_p->account, client_p->info);
-      sendto_channel_local(NULL, chptr, 0, 0, CAP_EXTENDED_JOIN, ":%s!%s@%s JOIN :%s",
-                           client_p->name, client_p->username,
-                           client_p->host, chptr->name);
+      channel_send_join(chptr, client_p, NULL, 0);
 
       if (client_p->away[0])
         sendto_channel_local(client_p, chptr, 0, CAP_AWAY_NOTIFY, 0,
@@ -164,6 +164,9 @@ add_id(struct Client *client_p, struct Channel *chptr, char *banid, unsigned int
   strlcpy(ban->name, name, sizeof(ban->name));
   strlcpy(ban->user, user, sizeof(ban->user));
   strlcpy(ban->host, host, sizeof(ban->host));
+  match_mask_compile(&ban->name_mask, ban->name);
+  match_mask_compile(&ban->user_mask, ban->user);
+  match_mask_compile(&ban->host_mask, ban->host);
 
   if (IsClient(client_p))
     snprintf(ban->who, sizeof(ban->who), "%s!%s@%s", client_p->name,
@@ -174,6 +177,7 @@ add_id(struct Client *client_p, struct Channel *chptr, char *banid, unsigned int
     strlcpy(ban->who, client_p->name, sizeof(ban->who));
 
   dlinkAdd(ban, &ban->node, list);
+  channel_clear_ban_index(chptr);
 
   return 1;
 }
@@ -239,7 +243,7 @@ del_id(struct Channel *chptr, char *banid, unsigned int type)
         !irccmp(user, ban->user) &&
         !irccmp(host, ban->host))
     {
-      remove_ban(ban, list);
+      remove_ban(chptr, ban, list);
       return 1;
     }
   }
@@ -1211,3 +1215,141 @@ set_channel_mode(struct Client *source_p, struct Channel *chptr,
   send_mode_changes_client(source_p, chptr);
   send_mode_changes_server(source_p, chptr);
 }
+
+/*
+ * The +o/+h/+v of members joined by SJOIN, held back so that the
+ * consecutive SJOIN lines of a channel share MODE lines.  They are sent
+ * once the server's read pass is over, by read_packet(), or before
+ * anything else is sent to the channel; the clients named stay
+ * allocated until then.  Whatever else that pass did to the
+ * members is checked for when the line is made.
+ */
+static struct
+{
+  struct Channel *chptr;
+  char source[HOSTLEN + 1];
+  unsigned int count;
+  int hold;  /* Sends to chptr leave the line held back */
+  struct
+  {
+    struct Client *client_p;
+    unsigned int flag;
+    char letter;
+  } mode[MAXMODEPARAMS];
+} member_modes;
+
+/*! \brief Send the MODE line held back by channel_member_mode_add(), if any.
+ *         Modes of members that have left the channel or lost the
+ *         status in the meantime are left out.
+ */
+void
+channel_member_mode_flush(void)
+{
+  char modebuf[MAXMODEPARAMS + 2] = "+";
+  char parabuf[MAXMODEPARAMS * (NICKLEN + 1) + 1] = "";
+  char *mbuf = modebuf + 1, *pbuf = parabuf;
+  struct Channel *const chptr = member_modes.chptr;
+  const unsigned int count = member_modes.count;
+
+  if (count == 0)
+    return;
+
+  /* Nothing is held back any more once the line is sent below */
+  member_modes.chptr = NULL;
+  member_modes.count = 0;
+
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    const struct Membership *member = find_channel_link(member_modes.mode[i].client_p, chptr);
+
+    if (member == NULL || !(member->flags & member_modes.mode[i].flag))
+      continue;
+
+    *mbuf++ = member_modes.mode[i].letter;
+    pbuf += sprintf(pbuf, " %s", member_modes.mode[i].client_p->name);
+  }
+
+  *mbuf = '\0';
+
+  if (pbuf != parabuf)
+    sendto_channel_local(NULL, chptr, 0, 0, 0, ":%s MODE %s %s%s",
+                         member_modes.source, chptr->name, modebuf, parabuf);
+}
+
+/*! \brief Send the MODE line held back for a channel ahead of anything
+ *         else sent to the channel, unless channel_member_mode_hold()
+ *         is in effect.
+ * \param chptr Pointer to channel
+ */
+void
+channel_member_mode_sync(const struct Channel *chptr)
+{
+  if (member_modes.chptr == chptr && !member_modes.hold)
+    channel_member_mode_flush();
+}
+
+/*! \brief While set, sends to the channel the modes are held back for
+ *         don't push them out; for the JOINs the modes refer to.
+ * \param hold 1 to set, 0 to clear
+ */
+void
+channel_member_mode_hold(int hold)
+{
+  member_modes.hold = hold;
+}
+
+/*! \brief Drop the MODE line held back for a channel about to be freed
+ * \param chptr Pointer to channel
+ */
+void
+channel_member_mode_drop(const struct Channel *chptr)
+{
+  if (member_modes.chptr == chptr)
+  {
+    member_modes.chptr = NULL;
+    member_modes.count = 0;
+  }
+}
+
+/*! \brief Show the local members of a channel the status a member joined
+ *         with.  The modes are held back for channel_member_mode_flush(),
+ *         and sent at once when a full MODE line is collected or when
+ *         the status of a member of another channel is added.
+ * \param chptr    Pointer to channel
+ * \param source   Name the MODE is sent from
+ * \param target_p Member
+ * \param flags    CHFL_CHANOP, CHFL_HALFOP and CHFL_VOICE of the member
+ */
+void
+channel_member_mode_add(struct Channel *chptr, const char *source,
+                        struct Client *target_p, unsigned int flags)
+{
+  static const struct
+  {
+    unsigned int flag;
+    char letter;
+  } status[] = { { CHFL_CHANOP, 'o' }, { CHFL_HALFOP, 'h' }, { CHFL_VOICE, 'v' } };
+
+  if (member_modes.count &&
+      (member_modes.chptr != chptr || strcmp(member_modes.source, source)))
+    channel_member_mode_flush();
+
+  for (unsigned int i = 0; i < sizeof(status) / sizeof(status[0]); ++i)
+  {
+    if (!(flags & status[i].flag))
+      continue;
+
+    if (member_modes.count == 0)
+    {
+      member_modes.chptr = chptr;
+      strlcpy(member_modes.source, source, sizeof(member_modes.source));
+    }
+
+    member_modes.mode[member_modes.count].client_p = target_p;
+    member_modes.mode[member_modes.count].flag = status[i].flag;
+    member_modes.mode[member_modes.count].letter = status[i].letter;
+
+    if (++member_modes.count == MAXMODEPARAMS)
+      channel_member_mode_flush();
+  }
+}
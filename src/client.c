@@ -39,6 +39,8 @@
 #include "log.h"
 #include "misc.h"
 #include "server.h"
+#include "server_capab.h"
+#include "snapshot.h"
 #include "send.h"
 #include "whowas.h"
 #include "user.h"
@@ -51,6 +53,7 @@
 #include "rng_mt.h"
 #include "parse.h"
 #include "ipcache.h"
+#include "patricia.h"
 
 
 dlink_list listing_client_list;
@@ -65,6 +68,22 @@ static mp_pool_t *client_pool, *connection_pool;
 static dlink_list dead_list, abort_list;
 static dlink_node *eac_next;  /* next aborted client to exit */
 
+/*
+ * Local connections by address, so a new D/K-line only has to look at
+ * the connections it can cover. Those are put on ban_check_list and
+ * checked once at the end of the loop pass, however many bans arrived.
+ */
+struct ClientAddressBucket
+{
+  dlink_list list;  /* Must be first */
+  patricia_node_t *pnode;
+};
+
+static patricia_tree_t *client_ipv4_tree, *client_ipv6_tree;
+static dlink_list ban_check_list;
+static int ban_check_all;  /* Check every connection instead */
+static int ban_check_gecos;  /* Check every client against the X-lines only */
+
 
 /*
  * make_client - create a new Client struct and set it to initial state.
@@ -147,6 +166,10 @@ client_free(struct Client *client_p)
       client_p->connection->listener = NULL;
     }
 
+    assert(!HasFlag(client_p, FLAGS_FLUSH));
+    assert(!HasFlag(client_p, FLAGS_BANCHECK));
+    assert(client_p->connection->ip_list == NULL);
+
     dbuf_clear(&client_p->connection->buf_recvq);
     dbuf_clear(&client_p->connection->buf_sendq);
 
@@ -316,6 +339,57 @@ check_pings(void *unused)
   check_unknowns_list();
 }
 
+/* client_ban_check()
+ *
+ * inputs       - pointer to client
+ * output       - NONE
+ * side effects - Exit the client if a D-line, K-line or X-line
+ *                matches it. Unknown connections are only checked
+ *                for D-lines.
+ */
+static void
+client_ban_check(struct Client *client_p)
+{
+  const void *ptr;
+
+  /* If a client is already being exited */
+  if (IsDead(client_p))
+    return;
+
+  if (IsServer(client_p))
+    return;
+
+  if ((ptr = find_conf_by_address(NULL, &client_p->connection->ip, CONF_DLINE,
+                                  client_p->connection->aftype, NULL, NULL, 1)))
+  {
+    const struct MaskItem *conf = ptr;
+    conf_try_ban(client_p, CLIENT_BAN_DLINE, conf->reason);
+    return;
+  }
+
+  if (!IsClient(client_p))
+    return;
+
+  if ((ptr = find_conf_by_address(client_p->host, &client_p->connection->ip,
+                                  CONF_KLINE, client_p->connection->aftype,
+                                  client_p->username, NULL, 1)) ||
+      (strcmp(client_p->host, client_p->sockhost) &&
+       (ptr = find_conf_by_address(client_p->sockhost, NULL, CONF_KLINE, 0,
+                                   client_p->username, NULL, 1))))
+  {
+    const struct MaskItem *conf = ptr;
+    conf_try_ban(client_p, CLIENT_BAN_KLINE, conf->reason);
+    return;
+  }
+
+  if ((ptr = gecos_find(client_p->info, match)))
+  {
+    const struct GecosItem *conf = ptr;
+    conf_try_ban(client_p, CLIENT_BAN_XLINE, conf->reason);
+    return;
+  }
+}
+
 /* check_conf_klines()
  *
  * inputs       - NONE
@@ -327,53 +401,245 @@ void
 check_conf_klines(void)
 {
   dlink_node *node = NULL, *node_next = NULL;
-  const void *ptr;
 
   DLINK_FOREACH_SAFE(node, node_next, local_client_list.head)
+    client_ban_check(node->data);
+
+  /* Also check the unknowns list for new dlines */
+  DLINK_FOREACH_SAFE(node, node_next, unknown_list.head)
+    client_ban_check(node->data);
+}
+
+static patricia_tree_t **
+client_ban_index_tree(int aftype)
+{
+  switch (aftype)
   {
-    struct Client *client_p = node->data;
+    case AF_INET:
+      return &client_ipv4_tree;
+    case AF_INET6:
+      return &client_ipv6_tree;
+    default:
+      return NULL;
+  }
+}
 
-    /* If a client is already being exited */
-    if (IsDead(client_p))
+/*! \brief Add a local connection to the address index. Must be
+ *         called again whenever its address changes.
+ * \param client_p Pointer to client
+ */
+void
+client_ban_index_add(struct Client *client_p)
+{
+  struct Connection *connection = client_p->connection;
+  patricia_tree_t **tree = client_ban_index_tree(connection->aftype);
+
+  assert(connection->ip_list == NULL);
+
+  if (tree == NULL)
+    return;
+
+  if (*tree == NULL)
+    *tree = patricia_new(connection->aftype == AF_INET6 ? 128 : 32);
+
+  patricia_node_t *pnode = patricia_make_and_lookup_addr(*tree, (struct sockaddr *)&connection->ip, 0);
+  if (pnode->data == NULL)
+  {
+    struct ClientAddressBucket *bucket = xcalloc(sizeof(*bucket));
+    bucket->pnode = pnode;
+    pnode->data = bucket;
+  }
+
+  connection->ip_list = &((struct ClientAddressBucket *)pnode->data)->list;
+  dlinkAdd(client_p, &connection->ip_node, connection->ip_list);
+}
+
+static void
+client_ban_index_host_del(struct Client *client_p)
+{
+  struct Connection *connection = client_p->connection;
+
+  for (unsigned int i = 0; i < 2; ++i)
+  {
+    if (connection->host_list[i] == NULL)
       continue;
 
-    if ((ptr = find_conf_by_address(NULL, &client_p->connection->ip, CONF_DLINE,
-                                    client_p->connection->aftype, NULL, NULL, 1)))
-    {
-      const struct MaskItem *conf = ptr;
-      conf_try_ban(client_p, CLIENT_BAN_DLINE, conf->reason);
-      continue;  /* and go examine next Client */
-    }
+    host_name_index_del(connection->host_list[i], &connection->host_node[i]);
+    connection->host_list[i] = NULL;
+  }
+}
 
-    if ((ptr = find_conf_by_address(client_p->host, &client_p->connection->ip,
-                                    CONF_KLINE, client_p->connection->aftype,
-                                    client_p->username, NULL, 1)))
-    {
-      const struct MaskItem *conf = ptr;
-      conf_try_ban(client_p, CLIENT_BAN_KLINE, conf->reason);
-      continue;  /* and go examine next Client */
-    }
+/*! \brief Add a local client to the host index, by host and sockhost.
+ *         Must be called again whenever its host changes.
+ * \param client_p Pointer to client
+ */
+void
+client_ban_index_host(struct Client *client_p)
+{
+  struct Connection *connection = client_p->connection;
 
-    if ((ptr = gecos_find(client_p->info, match)))
-    {
-      const struct GecosItem *conf = ptr;
-      conf_try_ban(client_p, CLIENT_BAN_XLINE, conf->reason);
-      continue;  /* and go examine next Client */
-    }
+  client_ban_index_host_del(client_p);
+
+  connection->host_list[0] = host_name_index_add(client_p->host, client_p, &connection->host_node[0]);
+
+  if (strcmp(client_p->host, client_p->sockhost))
+    connection->host_list[1] = host_name_index_add(client_p->sockhost, client_p, &connection->host_node[1]);
+}
+
+/*! \brief Take a local connection off the address index and the
+ *         list of connections waiting for a ban check
+ * \param client_p Pointer to client
+ */
+void
+client_ban_index_del(struct Client *client_p)
+{
+  struct Connection *connection = client_p->connection;
+
+  if (HasFlag(client_p, FLAGS_BANCHECK))
+  {
+    DelFlag(client_p, FLAGS_BANCHECK);
+    dlinkDelete(&connection->ban_check_node, &ban_check_list);
   }
 
-  /* Also check the unknowns list for new dlines */
-  DLINK_FOREACH_SAFE(node, node_next, unknown_list.head)
+  client_ban_index_host_del(client_p);
+
+  if (connection->ip_list == NULL)
+    return;
+
+  dlinkDelete(&connection->ip_node, connection->ip_list);
+
+  if (dlink_list_length(connection->ip_list) == 0)
+  {
+    struct ClientAddressBucket *bucket = (struct ClientAddressBucket *)connection->ip_list;
+
+    bucket->pnode->data = NULL;
+    patricia_remove(*client_ban_index_tree(connection->aftype), bucket->pnode);
+    xfree(bucket);
+  }
+
+  connection->ip_list = NULL;
+}
+
+static void
+client_ban_check_queue(void *data)
+{
+  struct Client *client_p = data;
+
+  if (HasFlag(client_p, FLAGS_BANCHECK) || IsDead(client_p))
+    return;
+
+  AddFlag(client_p, FLAGS_BANCHECK);
+  dlinkAdd(client_p, &client_p->connection->ban_check_node, &ban_check_list);
+}
+
+/*! \brief Schedule a ban check for the connections a new D-line or
+ *         K-line may cover: those in its range of addresses, or for
+ *         host masks, the clients with a host ending in its literal
+ *         labels
+ * \param arec Pointer to the address record of the new ban
+ */
+void
+client_ban_check_address(const struct AddressRec *arec)
+{
+  patricia_tree_t **tree = NULL;
+  patricia_node_t *pnode = NULL;
+
+  if (ban_check_all)
+    return;
+
+  switch (arec->masktype)
+  {
+    case HM_IPV4:
+      tree = client_ban_index_tree(AF_INET);
+      break;
+    case HM_IPV6:
+      tree = client_ban_index_tree(AF_INET6);
+      break;
+    default:  /* HM_HOST */
+      host_name_index_walk(arec->Mask.hostname, client_ban_check_queue);
+      return;
+  }
+
+  if (tree == NULL || arec->Mask.ipa.bits == 0)
+  {
+    client_ban_check_all();
+    return;
+  }
+
+  if (*tree == NULL)
+    return;
+
+  patricia_node_t *top = patricia_try_search_covered_addr(*tree, (struct sockaddr *)&arec->Mask.ipa.addr,
+                                                          arec->Mask.ipa.bits);
+  if (top == NULL)
+    return;
+
+  PATRICIA_WALK(top, pnode) {
+    dlink_node *node;
+
+    DLINK_FOREACH(node, ((struct ClientAddressBucket *)pnode->data)->list.head)
+      client_ban_check_queue(node->data);
+  } PATRICIA_WALK_END;
+}
+
+/*! \brief Schedule a ban check for every local connection, e.g.
+ *         after the configuration has been reloaded
+ */
+void
+client_ban_check_all(void)
+{
+  ban_check_all = 1;
+}
+
+/*! \brief Schedule a check of every local client against the X-lines,
+ *         after one has been added
+ */
+void
+client_ban_check_gecos(void)
+{
+  ban_check_gecos = 1;
+}
+
+/*! \brief Run the ban checks scheduled since the last call. A
+ *         connection is only checked once, however many new bans
+ *         may cover it.
+ */
+void
+client_ban_check_run(void)
+{
+  const int all = ban_check_all, gecos = ban_check_gecos;
+  dlink_node *node, *node_next;
+
+  ban_check_all = 0;
+  ban_check_gecos = 0;
+
+  while (ban_check_list.head)
+  {
+    struct Client *client_p = ban_check_list.head->data;
+
+    DelFlag(client_p, FLAGS_BANCHECK);
+    dlinkDelete(&client_p->connection->ban_check_node, &ban_check_list);
+
+    if (!all)
+      client_ban_check(client_p);
+  }
+
+  if (all)
+  {
+    check_conf_klines();
+    return;
+  }
+
+  if (gecos == 0)
+    return;
+
+  DLINK_FOREACH_SAFE(node, node_next, local_client_list.head)
   {
     struct Client *client_p = node->data;
+    const struct GecosItem *conf;
 
-    if ((ptr = find_conf_by_address(NULL, &client_p->connection->ip, CONF_DLINE,
-                                    client_p->connection->aftype, NULL, NULL, 1)))
-    {
-      const struct MaskItem *conf = ptr;
-      conf_try_ban(client_p, CLIENT_BAN_DLINE, conf->reason);
-      continue;  /* and go examine next Client */
-    }
+    if (!IsDead(client_p) && (conf = gecos_find(client_p->info, match)))
+      conf_try_ban(client_p, CLIENT_BAN_XLINE, conf->reason);
   }
 }
 
@@ -573,6 +839,7 @@ exit_one_client(struct Client *source_p, const char *comment)
       --Count.invisi;
 
     dlinkDelete(&source_p->lnode, &source_p->servptr->serv->client_list);
+    server_burst_unlink(&source_p->node);
     dlinkDelete(&source_p->node, &global_client_list);
 
     /*
@@ -630,26 +897,75 @@ exit_one_client(struct Client *source_p, const char *comment)
 }
 
 /*
- * Remove all clients that depend on source_p; assumes all (S)QUITs have
- * already been sent.  we make sure to exit a server's dependent clients
- * and servers before the server itself; exit_one_client takes care of
- * actually removing things off llists.   tweaked from +CSr31  -orabidoo
+ * Gather the users behind source_p, for exit_server_clients().
  */
 static void
-recurse_remove_clients(struct Client *source_p, const char *comment)
+split_gather_users(struct Client *source_p, struct Client ***users,
+                   unsigned int *count, unsigned int *size)
 {
-  dlink_node *node, *node_next;
+  dlink_node *node;
 
-  DLINK_FOREACH_SAFE(node, node_next, source_p->serv->client_list.head)
-    exit_one_client(node->data, comment);
+  DLINK_FOREACH(node, source_p->serv->client_list.head)
+  {
+    if (*count == *size)
+    {
+      *size = *size ? *size * 2 : 64;
+      *users = xrealloc(*users, *size * sizeof(**users));
+    }
+
+    (*users)[(*count)++] = node->data;
+  }
+
+  DLINK_FOREACH(node, source_p->serv->server_list.head)
+    split_gather_users(node->data, users, count, size);
+}
+
+/*
+ * Remove all servers that depend on source_p, once their users are gone.
+ * Dependent servers are exited before the server they are linked to.
+ */
+static void
+recurse_remove_servers(struct Client *source_p, const char *comment)
+{
+  dlink_node *node, *node_next;
 
   DLINK_FOREACH_SAFE(node, node_next, source_p->serv->server_list.head)
   {
-    recurse_remove_clients(node->data, comment);
+    recurse_remove_servers(node->data, comment);
     exit_one_client(node->data, comment);
   }
 }
 
+/*
+ * Remove all clients that depend on source_p; assumes all (S)QUITs have
+ * already been sent.  Rather than exiting one user after another, all
+ * users behind the split are gathered first; then their QUITs are
+ * delivered, all of those for one local client together, then they
+ * leave their channels, with every channel freed or
+ * updated only once, and only then exit_one_client() takes them off the
+ * remaining lists.  The servers go last, leaves first.
+ */
+static void
+exit_server_clients(struct Client *source_p, const char *comment)
+{
+  struct Client **users = NULL;
+  unsigned int count = 0, size = 0;
+
+  split_gather_users(source_p, &users, &count, &size);
+
+  sendto_common_channels_local_quits(users, count, comment);
+
+  channel_remove_clients(users, count);
+
+  /* No channels left, so no more QUITs are sent from here */
+  for (unsigned int i = 0; i < count; ++i)
+    exit_one_client(users[i], comment);
+
+  xfree(users);
+
+  recurse_remove_servers(source_p, comment);
+}
+
 /*
  * exit_client - exit a client of any type. Generally, you can use
  * this on any struct Client, regardless of its state.
@@ -722,6 +1038,14 @@ exit_client(struct Client *source_p, const char *comment)
     }
     else if (IsServer(source_p))
     {
+      if (source_p->connection->burst_task)
+        server_burst_free(source_p);
+
+      /* Before exit_server_clients() removes what is behind it */
+      if (IsCapable(source_p, CAPAB_SNAP))
+        snapshot_take(source_p);
+      snapshot_release(source_p);
+
       assert(dlinkFind(&local_server_list, source_p));
       dlinkDelete(&source_p->connection->lclient_node, &local_server_list);
     }
@@ -777,7 +1101,7 @@ exit_client(struct Client *source_p, const char *comment)
       sendto_server(NULL, 0, 0, "SQUIT %s :%s", source_p->id, comment);
 
     /* Now exit the clients internally */
-    recurse_remove_clients(source_p, splitstr);
+    exit_server_clients(source_p, splitstr);
 
     if (MyConnect(source_p))
     {
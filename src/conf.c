@@ -768,7 +768,7 @@ conf_rehash(int sig)
   read_conf_files(0);
 
   load_conf_modules();
-  check_conf_klines();
+  client_ban_check_all();
 }
 
 /* lookup_confhost()
@@ -832,12 +832,13 @@ load_xline_database(const char *filename)
     SAFE_READ(read_uint64(&tmp64_setat, f));
     SAFE_READ(read_uint64(&tmp64_hold, f));
 
-    gecos = gecos_make();
+    gecos = gecos_make(name);
     gecos->in_database = 1;
-    gecos->mask = name;
     gecos->reason = reason;
     gecos->setat = tmp64_setat;
     gecos->expire = tmp64_hold;
+
+    xfree(name);
   }
 
   close_db(f);
@@ -33,9 +33,11 @@
 #include "memory.h"
 #include "conf.h"
 #include "conf_gecos.h"
+#include "mask_index.h"
 
 
 static dlink_list gecos_list;
+static struct MaskIndex gecos_index;
 
 
 const dlink_list *
@@ -61,6 +63,8 @@ gecos_clear(void)
 void
 gecos_delete(struct GecosItem *gecos)
 {
+  mask_index_del(&gecos_index, &gecos->entry);
+
   dlinkDelete(&gecos->node, &gecos_list);
   xfree(gecos->mask);
   xfree(gecos->reason);
@@ -68,28 +72,25 @@ gecos_delete(struct GecosItem *gecos)
 }
 
 struct GecosItem *
-gecos_make(void)
+gecos_make(const char *mask)
 {
   struct GecosItem *gecos = xcalloc(sizeof(*gecos));
+  gecos->mask = xstrdup(mask);
   dlinkAdd(gecos, &gecos->node, &gecos_list);
+  mask_index_add(&gecos_index, &gecos->entry, gecos->mask, gecos);
 
   return gecos;
 }
 
+/*! \brief Find the most recently added X-line matching a gecos
+ * \param name    Gecos (real name) field
+ * \param compare match() or irccmp()
+ * \return Pointer to GecosItem or NULL
+ */
 struct GecosItem *
 gecos_find(const char *name, int (*compare)(const char *, const char *))
 {
-  dlink_node *node;
-
-  DLINK_FOREACH(node, gecos_list.head)
-  {
-    struct GecosItem *gecos = node->data;
-
-    if (!compare(gecos->mask, name))
-      return gecos;
-  }
-
-  return NULL;
+  return mask_index_find(&gecos_index, name, compare);
 }
 
 void
@@ -5665,8 +5665,7 @@ yyreduce:
   if (!block_state.name.buf[0])
     break;
 
-  struct GecosItem *gecos = gecos_make();
-  gecos->mask = xstrdup(block_state.name.buf);
+  struct GecosItem *gecos = gecos_make(block_state.name.buf);
 
   if (block_state.rpass.buf[0])
     gecos->reason = xstrdup(block_state.rpass.buf);
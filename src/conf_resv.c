@@ -36,10 +36,14 @@
 #include "conf.h"
 #include "conf_resv.h"
 #include "hostmask.h"
+#include "mask_index.h"
 
 
 static dlink_list resv_chan_list;
 static dlink_list resv_nick_list;
+static struct MaskIndex resv_chan_index;
+static struct MaskIndex resv_nick_index;
+static unsigned int resv_chan_generation = 1;
 
 
 const dlink_list *
@@ -54,6 +58,24 @@ resv_nick_get_list(void)
   return &resv_nick_list;
 }
 
+/*! \brief Get the channel RESV list generation. It changes whenever a
+ *         channel RESV is added or removed, so a cached resv_find()
+ *         result is valid for as long as it stays the same.
+ * \return Current generation, never 0
+ */
+unsigned int
+resv_chan_get_generation(void)
+{
+  return resv_chan_generation;
+}
+
+static void
+resv_chan_changed(void)
+{
+  if (++resv_chan_generation == 0)
+    resv_chan_generation = 1;
+}
+
 void
 resv_delete(struct ResvItem *resv)
 {
@@ -68,6 +90,10 @@ resv_delete(struct ResvItem *resv)
     xfree(exempt);
   }
 
+  if (resv->list == &resv_chan_list)
+    resv_chan_changed();
+
+  mask_index_del(resv->list == &resv_chan_list ? &resv_chan_index : &resv_nick_index, &resv->entry);
   dlinkDelete(&resv->node, resv->list);
   xfree(resv->mask);
   xfree(resv->reason);
@@ -86,20 +112,31 @@ struct ResvItem *
 resv_make(const char *mask, const char *reason, const dlink_list *elist)
 {
   dlink_list *list;
+  struct MaskIndex *index;
 
   if (resv_find(mask, irccmp))
     return NULL;
 
   if (IsChanPrefix(*mask))
+  {
     list = &resv_chan_list;
+    index = &resv_chan_index;
+  }
   else
+  {
     list = &resv_nick_list;
+    index = &resv_nick_index;
+  }
 
   struct ResvItem *resv = xcalloc(sizeof(*resv));
   resv->list = list;
   resv->mask = xstrdup(mask);
   resv->reason = xstrndup(reason, IRCD_MIN(strlen(reason), REASONLEN));
   dlinkAdd(resv, &resv->node, resv->list);
+  mask_index_add(index, &resv->entry, resv->mask, resv);
+
+  if (list == &resv_chan_list)
+    resv_chan_changed();
 
   if (elist)
   {
@@ -148,26 +185,18 @@ resv_make(const char *mask, const char *reason, const dlink_list *elist)
   return resv;
 }
 
+/*! \brief Find the most recently added RESV matching a nick or channel name
+ * \param name    Nick or channel name
+ * \param compare match() or irccmp()
+ * \return Pointer to ResvItem or NULL
+ */
 struct ResvItem *
 resv_find(const char *name, int (*compare)(const char *, const char *))
 {
-  dlink_node *node;
-  dlink_list *list;
-
   if (IsChanPrefix(*name))
-    list = &resv_chan_list;
-  else
-    list = &resv_nick_list;
-
-  DLINK_FOREACH(node, list->head)
-  {
-    struct ResvItem *resv = node->data;
-
-    if (!compare(resv->mask, name))
-      return resv;
-  }
+    return mask_index_find(&resv_chan_index, name, compare);
 
-  return NULL;
+  return mask_index_find(&resv_nick_index, name, compare);
 }
 
 int
@@ -31,23 +31,70 @@
 #include "mempool.h"
 
 
-static mp_pool_t *dbuf_pool;
+static const size_t dbuf_class_size[] = { DBUF_BLOCK_SIZE_MIN, 256, 512, 1024, DBUF_BLOCK_SIZE_MAX };
+static mp_pool_t *dbuf_pool[sizeof(dbuf_class_size) / sizeof(dbuf_class_size[0])];
+static mp_pool_t *dbuf_chunk_pool;
+
+enum { DBUF_CLASSES = sizeof(dbuf_class_size) / sizeof(dbuf_class_size[0]) };
 
 void
 dbuf_init(void)
 {
-  dbuf_pool = mp_pool_new(sizeof(struct dbuf_block), MP_CHUNK_SIZE_DBUF);
+  for (unsigned int i = 0; i < DBUF_CLASSES; ++i)
+    dbuf_pool[i] = mp_pool_new(sizeof(struct dbuf_block) + dbuf_class_size[i], MP_CHUNK_SIZE_DBUF);
+
+  dbuf_chunk_pool = mp_pool_new(sizeof(struct dbuf_chunk), MP_CHUNK_SIZE_DBUF);
+}
+
+static unsigned int
+dbuf_class(size_t size)
+{
+  unsigned int i = 0;
+
+  while (i < DBUF_CLASSES - 1 && dbuf_class_size[i] < size)
+    ++i;
+
+  return i;
 }
 
+/*
+ * dbuf_alloc() - get a block with room for at least 'size' bytes, or
+ * DBUF_BLOCK_SIZE_MAX bytes if that is less
+ */
 struct dbuf_block *
-dbuf_alloc(void)
+dbuf_alloc(size_t size)
 {
-  struct dbuf_block *block = mp_pool_get(dbuf_pool);
+  const unsigned int sclass = dbuf_class(size);
+  struct dbuf_block *block = mp_pool_get(dbuf_pool[sclass]);
 
+  block->sclass = sclass;
+  block->capacity = dbuf_class_size[sclass];
   ++block->refs;
   return block;
 }
 
+/*
+ * dbuf_shrink() - move the contents of an unshared block into one of
+ * the smallest size class that holds them.  Returns the block to use
+ * from now on; the old one is released if it was replaced.
+ */
+struct dbuf_block *
+dbuf_shrink(struct dbuf_block *block)
+{
+  assert(block->refs == 1);
+
+  const unsigned int sclass = dbuf_class(block->size);
+  if (sclass >= block->sclass)
+    return block;
+
+  struct dbuf_block *fit = dbuf_alloc(block->size);
+  memcpy(fit->data, block->data, block->size);
+  fit->size = block->size;
+
+  dbuf_ref_free(block);
+  return fit;
+}
+
 void
 dbuf_ref_free(struct dbuf_block *block)
 {
@@ -55,21 +102,104 @@ dbuf_ref_free(struct dbuf_block *block)
     mp_pool_release(block);
 }
 
+/*
+ * dbuf_append() - put a block, whose reference the queue takes over, in
+ * the next free slot of a queue
+ */
+static void
+dbuf_append(struct dbuf_queue *queue, struct dbuf_block *block)
+{
+  struct dbuf_chunk *chunk = queue->chunks.tail ? queue->chunks.tail->data : NULL;
+
+  if (chunk == NULL || chunk->count == DBUF_CHUNK_SLOTS)
+  {
+    chunk = mp_pool_get(dbuf_chunk_pool);
+    dlinkAddTail(chunk, &chunk->node, &queue->chunks);
+  }
+
+  chunk->block[chunk->count++] = block;
+}
+
+/* dbuf_tail() - the newest block of a queue, or NULL if it has none */
+static struct dbuf_block *
+dbuf_tail(const struct dbuf_queue *queue)
+{
+  const struct dbuf_chunk *chunk = queue->chunks.tail ? queue->chunks.tail->data : NULL;
+
+  return chunk ? chunk->block[chunk->count - 1] : NULL;
+}
+
+/* dbuf_drop() - release the oldest block of a queue */
+static void
+dbuf_drop(struct dbuf_queue *queue)
+{
+  struct dbuf_chunk *chunk = queue->chunks.head->data;
+
+  dbuf_ref_free(chunk->block[chunk->first++]);
+
+  if (chunk->first == chunk->count)
+  {
+    dlinkDelete(&chunk->node, &queue->chunks);
+    mp_pool_release(chunk);
+  }
+}
+
 void
 dbuf_add(struct dbuf_queue *queue, struct dbuf_block *block)
 {
   block->refs++;
-  dlinkAddTail(block, make_dlink_node(), &queue->blocks);
+  dbuf_append(queue, block);
   queue->total_size += block->size;
 }
 
+/* dbuf_head() - the oldest block of a queue, or NULL if it has none */
+struct dbuf_block *
+dbuf_head(const struct dbuf_queue *queue)
+{
+  const struct dbuf_chunk *chunk = queue->chunks.head ? queue->chunks.head->data : NULL;
+
+  return chunk ? chunk->block[chunk->first] : NULL;
+}
+
+/*
+ * dbuf_first() - start walking the blocks of a queue, oldest first;
+ * returns NULL at the end.  queue->pos applies to the first one.
+ */
+struct dbuf_block *
+dbuf_first(const struct dbuf_queue *queue, struct dbuf_iter *iter)
+{
+  iter->node = queue->chunks.head;
+
+  if (iter->node == NULL)
+    return NULL;
+
+  iter->slot = ((const struct dbuf_chunk *)iter->node->data)->first;
+  return ((const struct dbuf_chunk *)iter->node->data)->block[iter->slot];
+}
+
+struct dbuf_block *
+dbuf_next(struct dbuf_iter *iter)
+{
+  const struct dbuf_chunk *chunk = iter->node->data;
+
+  if (++iter->slot == chunk->count)
+  {
+    if ((iter->node = iter->node->next) == NULL)
+      return NULL;
+
+    chunk = iter->node->data;
+    iter->slot = chunk->first;
+  }
+
+  return chunk->block[iter->slot];
+}
+
 void
 dbuf_delete(struct dbuf_queue *queue, size_t count)
 {
   while (count > 0 && dbuf_length(queue) > 0)
   {
-    dlink_node *node = queue->blocks.head;
-    struct dbuf_block *block = node->data;
+    struct dbuf_block *block = dbuf_head(queue);
     size_t avail = block->size - queue->pos;
 
     if (count >= avail)
@@ -77,10 +207,7 @@ dbuf_delete(struct dbuf_queue *queue, size_t count)
       count -= avail;
       queue->total_size -= avail;
 
-      dbuf_ref_free(block);
-
-      dlinkDelete(node, &queue->blocks);
-      free_dlink_node(node);
+      dbuf_drop(queue);
 
       queue->pos = 0;
     }
@@ -94,6 +221,27 @@ dbuf_delete(struct dbuf_queue *queue, size_t count)
   }
 }
 
+/*
+ * dbuf_move() - append all blocks of a queue nothing has been taken from
+ * yet to another queue, leaving the first one empty
+ */
+void
+dbuf_move(struct dbuf_queue *to, struct dbuf_queue *from)
+{
+  assert(from->pos == 0);
+
+  while (from->chunks.head)
+  {
+    dlink_node *node = from->chunks.head;
+
+    dlinkDelete(node, &from->chunks);
+    dlinkAddTail(node->data, node, &to->chunks);
+  }
+
+  to->total_size += from->total_size;
+  from->total_size = 0;
+}
+
 void
 dbuf_put_fmt(struct dbuf_block *dbuf, const char *pattern, ...)
 {
@@ -111,11 +259,11 @@ dbuf_put_args(struct dbuf_block *dbuf, const char *data, va_list args)
 {
   assert(dbuf->refs == 1);
 
-  dbuf->size += vsnprintf(dbuf->data + dbuf->size, sizeof(dbuf->data) - dbuf->size, data, args);
+  dbuf->size += vsnprintf(dbuf->data + dbuf->size, dbuf->capacity - dbuf->size, data, args);
 
   /* As per C99, (v)snprintf returns the length the resulting string would be */
-  if (dbuf->size > sizeof(dbuf->data))
-    dbuf->size = sizeof(dbuf->data);
+  if (dbuf->size > dbuf->capacity)
+    dbuf->size = dbuf->capacity;
 }
 
 void
@@ -123,15 +271,15 @@ dbuf_put(struct dbuf_queue *queue, const char *buf, size_t sz)
 {
   while (sz > 0)
   {
-    struct dbuf_block *block = dbuf_length(queue) ? queue->blocks.tail->data : NULL;
+    struct dbuf_block *block = dbuf_length(queue) ? dbuf_tail(queue) : NULL;
 
-    if (block == NULL || sizeof(block->data) - block->size == 0)
+    if (block == NULL || block->capacity - block->size == 0)
     {
-      block = dbuf_alloc();
-      dlinkAddTail(block, make_dlink_node(), &queue->blocks);
+      block = dbuf_alloc(DBUF_BLOCK_SIZE_MAX);
+      dbuf_append(queue, block);
     }
 
-    size_t avail = sizeof(block->data) - block->size;
+    size_t avail = block->capacity - block->size;
     if (avail > sz)
       avail = sz;
 
@@ -144,3 +292,53 @@ dbuf_put(struct dbuf_queue *queue, const char *buf, size_t sz)
     buf += avail;
   }
 }
+
+/*
+ * dbuf_reserve() - return the free space at the end of a queue, adding
+ * a block if the last one is full.  Data written there becomes part of
+ * the queue once passed to dbuf_commit().
+ */
+char *
+dbuf_reserve(struct dbuf_queue *queue, size_t *avail)
+{
+  struct dbuf_block *block = dbuf_tail(queue);
+
+  if (block == NULL || block->capacity - block->size == 0)
+  {
+    block = dbuf_alloc(DBUF_BLOCK_SIZE_MAX);
+    dbuf_append(queue, block);
+  }
+
+  *avail = block->capacity - block->size;
+  return block->data + block->size;
+}
+
+/*
+ * dbuf_commit() - append 'count' bytes written to the space returned by
+ * dbuf_reserve().  A block added by dbuf_reserve() that is left empty is
+ * removed again.
+ */
+void
+dbuf_commit(struct dbuf_queue *queue, size_t count)
+{
+  struct dbuf_chunk *chunk = queue->chunks.tail->data;
+  struct dbuf_block *block = chunk->block[chunk->count - 1];
+
+  assert(block->capacity - block->size >= count);
+
+  if (block->size == 0 && count == 0)
+  {
+    dbuf_ref_free(block);
+
+    if (--chunk->count == chunk->first)
+    {
+      dlinkDelete(&chunk->node, &queue->chunks);
+      mp_pool_release(chunk);
+    }
+
+    return;
+  }
+
+  block->size += count;
+  queue->total_size += count;
+}
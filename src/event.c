@@ -27,11 +27,24 @@
 #include "stdinc.h"
 #include "list.h"
 #include "ircd.h"
+#include "memory.h"
 #include "event.h"
 #include "rng_mt.h"
 
 
+/*
+ * Pending events are kept in a 4-ary min-heap ordered by their due time
+ * in milliseconds, so adding, deleting and finding the next due event
+ * doesn't depend on how many timers are armed.  Named events are also
+ * linked on event_list for STATS e.
+ */
 static dlink_list event_list;
+static struct event **event_heap;
+static unsigned int event_heap_len;
+static unsigned int event_heap_size;
+
+enum { EVENT_HEAP_ARITY = 4 };
+
 
 const dlink_list *
 event_get_list(void)
@@ -39,29 +52,103 @@ event_get_list(void)
   return &event_list;
 }
 
-void
-event_add(struct event *ev, void *data)
+static uintmax_t
+event_time_ms(void)
 {
-  dlink_node *node;
+  return SystemTime.tv_sec * 1000 + SystemTime.tv_usec / 1000;
+}
 
-  event_delete(ev);
+static void
+event_heap_set(unsigned int i, struct event *ev)
+{
+  event_heap[i] = ev;
+  ev->heap_index = i;
+}
 
-  ev->data = data;
-  ev->next = CurrentTime + ev->when;
-  ev->active = 1;
+static void
+event_heap_up(unsigned int i)
+{
+  struct event *ev = event_heap[i];
 
-  DLINK_FOREACH(node, event_list.head)
+  while (i)
   {
-    struct event *e = node->data;
+    unsigned int parent = (i - 1) / EVENT_HEAP_ARITY;
+
+    if (event_heap[parent]->next <= ev->next)
+      break;
+
+    event_heap_set(i, event_heap[parent]);
+    i = parent;
+  }
 
-    if (e->next > ev->next)
+  event_heap_set(i, ev);
+}
+
+static void
+event_heap_down(unsigned int i)
+{
+  struct event *ev = event_heap[i];
+
+  while (1)
+  {
+    unsigned int child = i * EVENT_HEAP_ARITY + 1;
+    unsigned int last = child + EVENT_HEAP_ARITY;
+    unsigned int min = i;
+    uintmax_t min_next = ev->next;
+
+    if (last > event_heap_len)
+      last = event_heap_len;
+
+    for (; child < last; ++child)
     {
-      dlinkAddBefore(node, ev, &ev->node, &event_list);
-      return;
+      if (event_heap[child]->next < min_next)
+      {
+        min = child;
+        min_next = event_heap[child]->next;
+      }
     }
+
+    if (min == i)
+      break;
+
+    event_heap_set(i, event_heap[min]);
+    i = min;
+  }
+
+  event_heap_set(i, ev);
+}
+
+/*
+ * event_add_ms() - schedule an event to run in "ms" milliseconds,
+ * regardless of its "when" value.  Used for timers with sub-second
+ * resolution, like the per-fd timeout and flush handlers.
+ */
+void
+event_add_ms(struct event *ev, uintmax_t ms, void *data)
+{
+  event_delete(ev);
+
+  ev->data = data;
+  ev->next = event_time_ms() + ms;
+  ev->active = 1;
+
+  if (event_heap_len == event_heap_size)
+  {
+    event_heap_size = event_heap_size ? event_heap_size * 2 : 64;
+    event_heap = xrealloc(event_heap, sizeof(*event_heap) * event_heap_size);
   }
 
-  dlinkAddTail(ev, &ev->node, &event_list);
+  event_heap_set(event_heap_len, ev);
+  event_heap_up(event_heap_len++);
+
+  if (ev->name)
+    dlinkAdd(ev, &ev->node, &event_list);
+}
+
+void
+event_add(struct event *ev, void *data)
+{
+  event_add_ms(ev, ev->when * 1000, data);
 }
 
 void
@@ -83,36 +170,80 @@ event_delete(struct event *ev)
   if (!ev->active)
     return;
 
-  dlinkDelete(&ev->node, &event_list);
+  const unsigned int i = ev->heap_index;
+
+  assert(event_heap[i] == ev);
+
+  if (--event_heap_len != i)
+  {
+    event_heap_set(i, event_heap[event_heap_len]);
+
+    if (i && event_heap[(i - 1) / EVENT_HEAP_ARITY]->next > event_heap[i]->next)
+      event_heap_up(i);
+    else
+      event_heap_down(i);
+  }
+
+  if (ev->name)
+    dlinkDelete(&ev->node, &event_list);
   ev->active = 0;
 }
 
 void
 event_run(void)
 {
-  static uintmax_t last = 0;
-
-  if (last == CurrentTime)
-    return;
-  last = CurrentTime;
+  const uintmax_t now = event_time_ms();
 
-  unsigned int len = dlink_list_length(&event_list);
-  while (len-- && dlink_list_length(&event_list))
+  /*
+   * Don't run events which have been (re)scheduled by handlers of this
+   * run, or a zero "when" would keep us here forever
+   */
+  unsigned int len = event_heap_len;
+  while (len-- && event_heap_len)
   {
-    struct event *ev = event_list.head->data;
+    struct event *ev = event_heap[0];
 
-    if (ev->next > CurrentTime)
+    if (ev->next > now)
       break;
 
+    /*
+     * The handler may free or clear the event, as fd_close() does with
+     * those of an fde_t; only events that recur are looked at again
+     */
+    const unsigned int oneshot = ev->oneshot;
+    void *const data = ev->data;
+
     event_delete(ev);
 
-    ev->handler(ev->data);
+    ev->handler(data);
 
-    if (!ev->oneshot)
-      event_add(ev, ev->data);
+    if (!oneshot)
+      event_add(ev, data);
   }
 }
 
+/*
+ * int event_next_delay(int max)
+ * Input: Upper bound in milliseconds.
+ * Output: Milliseconds until the next event is due, at most "max".
+ * Side-effects: None.
+ */
+int
+event_next_delay(int max)
+{
+  if (event_heap_len == 0)
+    return max;
+
+  const uintmax_t now = event_time_ms();
+  const uintmax_t next = event_heap[0]->next;
+
+  if (next <= now)
+    return 0;
+  if (next - now < (uintmax_t)max)
+    return next - now;
+  return max;
+}
+
 /*
  * void event_set_back_events(uintmax_t by)
  * Input: Time to set back events by.
@@ -122,11 +253,7 @@ event_run(void)
 void
 event_set_back_events(uintmax_t by)
 {
-  dlink_node *node;
-
-  DLINK_FOREACH(node, event_list.head)
-  {
-    struct event *ev = node->data;
-    ev->next -= by;
-  }
+  /* Shifting every entry by the same amount keeps the heap ordered */
+  for (unsigned int i = 0; i < event_heap_len; ++i)
+    event_heap[i]->next -= by * 1000;
 }
@@ -38,8 +38,10 @@
 #include "misc.h"
 #include "res.h"
 
-fde_t *fd_hash[FD_HASH_SIZE];
-fde_t *fd_next_in_loop = NULL;
+/* Open descriptors, indexed by fd */
+static fde_t **fd_table;
+static int fd_table_size;
+
 int number_fd = LEAKED_FDS;
 int hard_fdlimit = 0;
 
@@ -65,38 +67,44 @@ fdlist_init(void)
   /* under no condition shall this raise over 65536
    * for example user ip heap is sized 2*hard_fdlimit */
   hard_fdlimit = IRCD_MIN(fdmax, 65536);
-}
 
-static inline unsigned int
-hash_fd(int fd)
-{
-  return ((unsigned int)fd) % FD_HASH_SIZE;
+  fd_table_size = hard_fdlimit;
+  fd_table = xcalloc(sizeof(*fd_table) * fd_table_size);
 }
 
 fde_t *
 lookup_fd(int fd)
 {
-  fde_t *F = fd_hash[hash_fd(fd)];
-
-  while (F)
-  {
-    if (F->fd == fd)
-      return F;
-    F = F->hnext;
-  }
-
-  return NULL;
+  if (fd < 0 || fd >= fd_table_size)
+    return NULL;
+  return fd_table[fd];
 }
 
 /* Called to open a given filedescriptor */
 void
 fd_open(fde_t *F, int fd, int is_socket, const char *desc)
 {
-  unsigned int hashv = hash_fd(fd);
-
   assert(fd >= 0);
   assert(!F->flags.open);
 
+  /*
+   * Descriptors not tracked here (log files and the like) may push
+   * fd numbers past hard_fdlimit
+   */
+  if (fd >= fd_table_size)
+  {
+    int size = fd_table_size;
+
+    while (fd >= size)
+      size *= 2;
+
+    fd_table = xrealloc(fd_table, sizeof(*fd_table) * size);
+    memset(fd_table + fd_table_size, 0, sizeof(*fd_table) * (size - fd_table_size));
+    fd_table_size = size;
+  }
+
+  assert(fd_table[fd] == NULL);
+
   F->fd = fd;
   F->comm_index = -1;
 
@@ -107,8 +115,7 @@ fd_open(fde_t *F, int fd, int is_socket, const char *desc)
    * but currently F is always cleared before calling us.. */
   F->flags.open = 1;
   F->flags.is_socket = is_socket;
-  F->hnext = fd_hash[hashv];
-  fd_hash[hashv] = F;
+  fd_table[fd] = F;
 
   number_fd++;
 }
@@ -117,32 +124,25 @@ fd_open(fde_t *F, int fd, int is_socket, const char *desc)
 void
 fd_close(fde_t *F)
 {
-  unsigned int hashv = hash_fd(F->fd);
-
   assert(F->flags.open);
-
-  if (F == fd_next_in_loop)
-    fd_next_in_loop = F->hnext;
+  assert(fd_table[F->fd] == F);
 
   if (F->flags.is_socket)
     comm_setselect(F, COMM_SELECT_WRITE | COMM_SELECT_READ, NULL, NULL, 0);
 
+  /* Cancel pending timers */
+  comm_settimeout(F, 0, NULL, NULL);
+  comm_setflush(F, 0, NULL, NULL);
+
   delete_resolver_queries(F);
 
   if (tls_isusing(&F->ssl))
     tls_free(&F->ssl);
 
-  if (fd_hash[hashv] == F)
-    fd_hash[hashv] = F->hnext;
-  else
-  {
-    fde_t *prev;
+  fd_table[F->fd] = NULL;
 
-    /* let it core if not found */
-    for (prev = fd_hash[hashv]; prev->hnext != F; prev = prev->hnext)
-      ;
-    prev->hnext = F->hnext;
-  }
+  if (F->flags.is_socket)
+    netio_close(F);
 
   /* Unlike squid, we're actually closing the FD here! -- adrian */
   close(F->fd);
@@ -157,10 +157,10 @@ fd_close(fde_t *F)
 void
 fd_dump(struct Client *source_p, int parc, char *parv[])
 {
-  for (unsigned int i = 0; i < FD_HASH_SIZE; ++i)
-    for (fde_t *F = fd_hash[i]; F; F = F->hnext)
+  for (int i = 0; i < fd_table_size; ++i)
+    if (fd_table[i])
       sendto_one_numeric(source_p, &me, RPL_STATSDEBUG | SND_EXPLICIT,
-                         "F :fd %-5d desc '%s'", F->fd, F->desc);
+                         "F :fd %-5d desc '%s'", fd_table[i]->fd, fd_table[i]->desc);
 }
 
 /*
@@ -202,8 +202,7 @@ close_standard_fds(void)
 void
 close_fds(fde_t *one)
 {
-  for (unsigned int i = 0; i < FD_HASH_SIZE; ++i)
-    for (fde_t *F = fd_hash[i]; F; F = F->hnext)
-      if (F != one)
-        close(F->fd);
+  for (int i = 0; i < fd_table_size; ++i)
+    if (fd_table[i] && fd_table[i] != one)
+      close(i);
 }
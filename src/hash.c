@@ -54,6 +54,30 @@ static struct Client *clientTable[HASHSIZE];
 static struct Channel *channelTable[HASHSIZE];
 static struct UserHost *userhostTable[HASHSIZE];
 
+/*
+ * Secondary channel indexes for LIST.  Each one keeps the channels in
+ * buckets by a coarse key -- the bit length of the member count, or a
+ * timestamp in units of CHANNEL_INDEX_TIME_SHIFT bits -- and the buckets
+ * in an array sorted by key, so a LIST filter can skip straight to the
+ * channels that might qualify.
+ */
+enum { CHANNEL_INDEX_TIME_SHIFT = 12 };  /* ~68 minutes */
+
+struct ChannelBucket
+{
+  uintmax_t key;
+  dlink_list channels;
+};
+
+struct ChannelIndex
+{
+  struct ChannelBucket **bucket;  /* Sorted by key */
+  unsigned int count;
+  unsigned int size;
+};
+
+static struct ChannelIndex channel_index[CHANNEL_INDEX_COUNT];
+
 
 /* hash_init()
  *
@@ -141,6 +165,9 @@ hash_add_channel(struct Channel *chptr)
 
   chptr->hnextch = channelTable[hashv];
   channelTable[hashv] = chptr;
+
+  for (unsigned int type = 0; type < CHANNEL_INDEX_COUNT; ++type)
+    hash_update_channel_index(chptr, type);
 }
 
 void
@@ -254,12 +281,125 @@ hash_del_userhost(struct UserHost *userhost)
   }
 }
 
+static uintmax_t
+channel_index_key(unsigned int type, uintmax_t value)
+{
+  uintmax_t key = 0;
+
+  if (type != CHANNEL_INDEX_USERS)
+    return value >> CHANNEL_INDEX_TIME_SHIFT;
+
+  for (; value; value >>= 1)
+    ++key;
+  return key;
+}
+
+static uintmax_t
+channel_index_value(const struct Channel *chptr, unsigned int type)
+{
+  switch (type)
+  {
+    case CHANNEL_INDEX_USERS:
+      return dlink_list_length(&chptr->members);
+    case CHANNEL_INDEX_CREATED:
+      return chptr->creationtime;
+    default:
+      return chptr->topic_time;
+  }
+}
+
+/* Position of the first bucket with a key of at least key */
+static unsigned int
+channel_index_find(const struct ChannelIndex *ci, uintmax_t key)
+{
+  unsigned int lo = 0, hi = ci->count;
+
+  while (lo < hi)
+  {
+    const unsigned int mid = lo + (hi - lo) / 2;
+
+    if (ci->bucket[mid]->key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+static void
+channel_index_del(struct Channel *chptr, unsigned int type)
+{
+  struct ChannelIndex *const ci = &channel_index[type];
+  struct ChannelBucket *const bucket = chptr->index_bucket[type];
+
+  if (bucket == NULL)
+    return;
+
+  chptr->index_bucket[type] = NULL;
+  dlinkDelete(&chptr->index_node[type], &bucket->channels);
+
+  if (bucket->channels.head == NULL)
+  {
+    const unsigned int pos = channel_index_find(ci, bucket->key);
+
+    assert(ci->bucket[pos] == bucket);
+    memmove(&ci->bucket[pos], &ci->bucket[pos + 1], (ci->count - pos - 1) * sizeof(*ci->bucket));
+    --ci->count;
+    xfree(bucket);
+  }
+}
+
+/* hash_update_channel_index()
+ *
+ * inputs       - pointer to channel
+ *              - CHANNEL_INDEX_* whose value has changed
+ * output       - NONE
+ * side effects - Moves the channel to the bucket for its current
+ *                member count, creationtime or topic_time.
+ */
+void
+hash_update_channel_index(struct Channel *chptr, unsigned int type)
+{
+  struct ChannelIndex *const ci = &channel_index[type];
+  const uintmax_t key = channel_index_key(type, channel_index_value(chptr, type));
+
+  if (chptr->index_bucket[type] && chptr->index_bucket[type]->key == key)
+    return;
+
+  channel_index_del(chptr, type);
+
+  const unsigned int pos = channel_index_find(ci, key);
+  struct ChannelBucket *bucket;
+
+  if (pos < ci->count && ci->bucket[pos]->key == key)
+    bucket = ci->bucket[pos];
+  else
+  {
+    if (ci->count == ci->size)
+    {
+      ci->size = ci->size ? ci->size * 2 : 32;
+      ci->bucket = xrealloc(ci->bucket, ci->size * sizeof(*ci->bucket));
+    }
+
+    bucket = xcalloc(sizeof(*bucket));
+    bucket->key = key;
+    memmove(&ci->bucket[pos + 1], &ci->bucket[pos], (ci->count - pos) * sizeof(*ci->bucket));
+    ci->bucket[pos] = bucket;
+    ++ci->count;
+  }
+
+  /* Appended, so a paused LIST can resume at an offset into the bucket */
+  chptr->index_bucket[type] = bucket;
+  dlinkAddTail(chptr, &chptr->index_node[type], &bucket->channels);
+}
+
 /* hash_del_channel()
  *
  * inputs       - pointer to client
  * output       - NONE
  * side effects - Removes the channel's name from the corresponding
- *                hash linked list
+ *                hash linked list, and the channel from the LIST indexes
  */
 void
 hash_del_channel(struct Channel *chptr)
@@ -267,6 +407,9 @@ hash_del_channel(struct Channel *chptr)
   const unsigned int hashv = strhash(chptr->name);
   struct Channel *tmp = channelTable[hashv];
 
+  for (unsigned int type = 0; type < CHANNEL_INDEX_COUNT; ++type)
+    channel_index_del(chptr, type);
+
   if (tmp)
   {
     if (tmp == chptr)
@@ -527,13 +670,19 @@ free_list_task(struct Client *source_p)
 
   DLINK_FOREACH_SAFE(node, node_next, lt->show_mask.head)
   {
-    xfree(node->data);
+    struct ListMask *lm = node->data;
+
+    xfree(lm->mask);
+    xfree(lm);
     free_dlink_node(node);
   }
 
   DLINK_FOREACH_SAFE(node, node_next, lt->hide_mask.head)
   {
-    xfree(node->data);
+    struct ListMask *lm = node->data;
+
+    xfree(lm->mask);
+    xfree(lm);
     free_dlink_node(node);
   }
 
@@ -555,29 +704,118 @@ list_allow_channel(const char *name, const struct ListTask *lt)
   dlink_node *node;
 
   DLINK_FOREACH(node, lt->show_mask.head)
-    if (match(node->data, name) != 0)
+    if (match_mask(&((const struct ListMask *)node->data)->match, name) != 0)
       return 0;
 
   DLINK_FOREACH(node, lt->hide_mask.head)
-    if (match(node->data, name) == 0)
+    if (match_mask(&((const struct ListMask *)node->data)->match, name) == 0)
       return 0;
 
   return 1;
 }
 
+/* list_task_pick_index()
+ *
+ * inputs       - pointer to a list task with its filters set
+ * output       - NONE
+ * side effects - Picks the channel index whose buckets hold the fewest
+ *                channels the filters might accept, or leaves
+ *                lt->index at CHANNEL_INDEX_COUNT if walking the hash
+ *                table is no worse.
+ */
+void
+list_task_pick_index(struct ListTask *lt)
+{
+  unsigned int best = dlink_list_length(&channel_list);
+
+  lt->index = CHANNEL_INDEX_COUNT;
+
+  for (unsigned int type = 0; type < CHANNEL_INDEX_COUNT; ++type)
+  {
+    const struct ChannelIndex *const ci = &channel_index[type];
+    uintmax_t min, max;
+    unsigned int count = 0;
+
+    switch (type)
+    {
+      case CHANNEL_INDEX_USERS:
+        if (lt->users_min == 0 && lt->users_max == UINT_MAX)
+          continue;
+        min = lt->users_min;
+        max = lt->users_max;
+        break;
+      case CHANNEL_INDEX_CREATED:
+        if (lt->created_min == 0 && lt->created_max == UINT_MAX)
+          continue;
+        min = lt->created_min;
+        max = lt->created_max;
+        break;
+      default:
+        if (lt->topicts_min == 0 && lt->topicts_max == UINT_MAX)
+          continue;
+        min = lt->topicts_min;
+        max = lt->topicts_max;
+        break;
+    }
+
+    min = channel_index_key(type, min);
+    max = channel_index_key(type, max);
+
+    /* Channels with a creationtime of 0 pass any created filter */
+    if (type == CHANNEL_INDEX_CREATED && ci->count && ci->bucket[0]->key == 0)
+      count += dlink_list_length(&ci->bucket[0]->channels);
+
+    for (unsigned int i = channel_index_find(ci, min); i < ci->count && ci->bucket[i]->key <= max; ++i)
+      count += dlink_list_length(&ci->bucket[i]->channels);
+
+    if (count < best)
+    {
+      best = count;
+      lt->index = type;
+      lt->index_key = type == CHANNEL_INDEX_CREATED ? 0 : min;
+      lt->index_min = min;
+      lt->index_max = max;
+    }
+  }
+}
+
+/* list_reply_mode()
+ *
+ * inputs       - pointer to channel
+ * output       - the channel's modes as far as they show in RPL_LIST:
+ *                the simple modes, and whether +l and +k are set
+ * side effects -
+ */
+static unsigned int
+list_reply_mode(const struct Channel *chptr)
+{
+  unsigned int mode = chptr->mode.mode;
+
+  assert(!(mode & (MODE_LIST_LIMIT | MODE_LIST_KEY)));
+
+  if (chptr->mode.limit)
+    mode |= MODE_LIST_LIMIT;
+  if (chptr->mode.key[0])
+    mode |= MODE_LIST_KEY;
+
+  return mode;
+}
+
 /* list_one_channel()
  *
  * inputs       - client pointer to return result to
  *              - pointer to channel to list
  *              - pointer to ListTask structure
  * output	- none
- * side effects -
+ * side effects - The RPL_LIST parameters are rendered once and kept in
+ *                the channel until its member count, modes or topic
+ *                change, so listing a channel to many clients only
+ *                formats each client's prefix.
  */
 static void
 list_one_channel(struct Client *source_p, struct Channel *chptr)
 {
   const struct ListTask *const lt = source_p->connection->list_task;
-  char listbuf[MODEBUFLEN] = "";
   char modebuf[MODEBUFLEN] = "";
   char parabuf[MODEBUFLEN] = "";
 
@@ -595,22 +833,34 @@ list_one_channel(struct Client *source_p, struct Channel *chptr)
       lt->topicts_max)
     return;
 
-  if (lt->topic[0] && match(lt->topic, chptr->topic))
+  if (lt->topic[0] && match_mask(&lt->topic_match, chptr->topic))
     return;
 
   if (!list_allow_channel(chptr->name, lt))
     return;
 
-  channel_modes(chptr, source_p, modebuf, parabuf);
+  /* The topic is dropped by channel_set_topic() when it changes */
+  if (chptr->list_reply &&
+      (chptr->list_reply_mode != list_reply_mode(chptr) ||
+       chptr->list_reply_users != dlink_list_length(&chptr->members)))
+  {
+    dbuf_ref_free(chptr->list_reply);
+    chptr->list_reply = NULL;
+  }
 
-  if (chptr->topic[0])
-    snprintf(listbuf, sizeof(listbuf), "[%s] ", modebuf);
-  else
-    snprintf(listbuf, sizeof(listbuf), "[%s]",  modebuf);
+  if (chptr->list_reply == NULL)
+  {
+    /* Only the mode letters are shown, so this is the same for everyone */
+    channel_modes(chptr, source_p, modebuf, parabuf);
+
+    chptr->list_reply_mode = list_reply_mode(chptr);
+    chptr->list_reply_users = dlink_list_length(&chptr->members);
+    chptr->list_reply = send_prepare("%s %u :[%s]%s%s", chptr->name,
+                                     chptr->list_reply_users, modebuf,
+                                     chptr->topic[0] ? " " : "", chptr->topic);
+  }
 
-  sendto_one_numeric(source_p, &me, RPL_LIST, chptr->name,
-                     dlink_list_length(&chptr->members),
-                     listbuf, chptr->topic);
+  sendto_one_numeric_prepared(source_p, &me, RPL_LIST, chptr->list_reply);
 }
 
 /* safe_list_channels()
@@ -630,7 +880,51 @@ safe_list_channels(struct Client *source_p, int only_unmasked_channels)
   struct ListTask *const lt = source_p->connection->list_task;
   struct Channel *chptr = NULL;
 
-  if (!only_unmasked_channels)
+  if (!only_unmasked_channels && lt->index < CHANNEL_INDEX_COUNT)
+  {
+    const struct ChannelIndex *const ci = &channel_index[lt->index];
+
+    /*
+     * Resume by bucket key and offset rather than by pointer; channels
+     * that change buckets or leave while the list is paused may be
+     * missed or listed twice, just as channels created meanwhile may be.
+     */
+    for (unsigned int i = channel_index_find(ci, lt->index_key);
+         i < ci->count && ci->bucket[i]->key <= lt->index_max; ++i)
+    {
+      const struct ChannelBucket *const bucket = ci->bucket[i];
+      unsigned int pos = 0;
+      dlink_node *node;
+
+      if (bucket->key && bucket->key < lt->index_min)
+      {
+        /* Past the creationtime 0 bucket, skip ahead to the range */
+        i = channel_index_find(ci, lt->index_min) - 1;
+        continue;
+      }
+
+      if (bucket->key != lt->index_key)
+      {
+        lt->index_key = bucket->key;
+        lt->index_skip = 0;
+      }
+
+      DLINK_FOREACH(node, bucket->channels.head)
+      {
+        if (pos++ < lt->index_skip)
+          continue;
+
+        if (exceeding_sendq(source_p))
+        {
+          lt->index_skip = pos - 1;
+          return;  /* Still more to do */
+        }
+
+        list_one_channel(source_p, node->data);
+      }
+    }
+  }
+  else if (!only_unmasked_channels)
   {
     for (unsigned int i = lt->hash_index; i < HASHSIZE; ++i)
     {
@@ -649,7 +943,7 @@ safe_list_channels(struct Client *source_p, int only_unmasked_channels)
     dlink_node *node;
 
     DLINK_FOREACH(node, lt->show_mask.head)
-      if ((chptr = hash_find_channel(node->data)))
+      if ((chptr = hash_find_channel(((const struct ListMask *)node->data)->mask)))
         list_one_channel(source_p, chptr);
   }
 
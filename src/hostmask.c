@@ -33,6 +33,7 @@
 #include "send.h"
 #include "irc_string.h"
 #include "ircd.h"
+#include "patricia.h"
 
 
 #define DigitParse(ch) do { \
@@ -47,6 +48,54 @@
 /* Hashtable stuff...now external as it's used in m_stats.c */
 dlink_list atable[ATABLE_SIZE];
 
+/*
+ * Lookup index. atable[] keeps every record for listing and removal;
+ * find_conf_by_address() instead walks one patricia tree per type and
+ * address family for IP masks, and one trie per type for host masks.
+ * The host trie is keyed on the literal labels of a mask read from the
+ * right, so "*.example.com" hangs off com -> example and is only ever
+ * looked at for names ending in ".example.com". All trie nodes share
+ * a single hash table keyed on parent node and label.
+ *
+ * The same trie, under a root of its own, holds the hosts of local
+ * clients keyed on all of their labels, so that the clients a new host
+ * mask may cover are found under the node its literal labels end at.
+ */
+enum
+{
+  AINDEX_CLIENT,
+  AINDEX_KLINE,
+  AINDEX_DLINE,
+  AINDEX_EXEMPT,
+  AINDEX_MAX
+};
+
+enum { HOST_TRIE_SIZE = 0x8000 };
+
+struct AddressBucket
+{
+  dlink_list list;  /* Must be first; records with this exact prefix */
+  patricia_node_t *pnode;
+};
+
+struct HostNode
+{
+  dlink_list list;  /* Must be first; records whose literal labels end here */
+  struct HostNode *parent;
+  struct HostNode *hnext;
+  dlink_list children;
+  dlink_node cnode;  /* For the parent's list of children */
+  size_t len;
+  char label[];
+};
+
+static patricia_tree_t *ipv4_index[AINDEX_MAX];
+static patricia_tree_t *ipv6_index[AINDEX_MAX];
+static dlink_list ip_any_index[AINDEX_MAX][2];  /* /0 masks, which patricia can't tell from a host */
+static struct HostNode host_index[AINDEX_MAX];
+static struct HostNode host_name_index;  /* Hosts of local clients */
+static struct HostNode *host_trie[HOST_TRIE_SIZE];
+
 /* The mask parser/type determination code... */
 
 /* int try_parse_v6_netmask(const char *, struct irc_ssaddr *, int *);
@@ -435,6 +484,222 @@ get_mask_hash(const char *text)
   return hash_text(text);
 }
 
+static unsigned int
+address_index_type(unsigned int type)
+{
+  switch (type)
+  {
+    case CONF_CLIENT: return AINDEX_CLIENT;
+    case CONF_KLINE:  return AINDEX_KLINE;
+    case CONF_DLINE:  return AINDEX_DLINE;
+    case CONF_EXEMPT: return AINDEX_EXEMPT;
+    default: assert(0);
+  }
+
+  return AINDEX_CLIENT;
+}
+
+static uint32_t
+host_trie_hash(const struct HostNode *parent, const char *label, size_t len)
+{
+  uint32_t h = (uint32_t)((uintptr_t)parent >> 4);
+
+  for (size_t i = 0; i < len; ++i)
+    h = (h << 4) - (h + ToLower(label[i]));
+
+  return (h ^ (h >> 15)) & (HOST_TRIE_SIZE - 1);
+}
+
+static struct HostNode *
+host_trie_find(const struct HostNode *parent, const char *label, size_t len)
+{
+  for (struct HostNode *node = host_trie[host_trie_hash(parent, label, len)]; node; node = node->hnext)
+  {
+    if (node->parent != parent || node->len != len)
+      continue;
+
+    size_t i = 0;
+    while (i < len && ToLower(label[i]) == node->label[i])
+      ++i;
+
+    if (i == len)
+      return node;
+  }
+
+  return NULL;
+}
+
+static struct HostNode *
+host_trie_add(struct HostNode *parent, const char *label, size_t len)
+{
+  struct HostNode *node = host_trie_find(parent, label, len);
+
+  if (node)
+    return node;
+
+  const uint32_t hashv = host_trie_hash(parent, label, len);
+
+  node = xcalloc(sizeof(*node) + len + 1);
+  node->parent = parent;
+  node->len = len;
+  for (size_t i = 0; i < len; ++i)
+    node->label[i] = ToLower(label[i]);
+
+  node->hnext = host_trie[hashv];
+  host_trie[hashv] = node;
+  dlinkAdd(node, &node->cnode, &parent->children);
+
+  return node;
+}
+
+static void
+host_trie_prune(struct HostNode *node)
+{
+  while (node->parent && dlink_list_length(&node->children) == 0 && dlink_list_length(&node->list) == 0)
+  {
+    struct HostNode *parent = node->parent;
+    struct HostNode **prev = &host_trie[host_trie_hash(parent, node->label, node->len)];
+
+    while (*prev != node)
+      prev = &(*prev)->hnext;
+    *prev = node->hnext;
+
+    dlinkDelete(&node->cnode, &parent->children);
+    xfree(node);
+    node = parent;
+  }
+}
+
+/* Returns the start of the label ending at end, or NULL once past the first label */
+static const char *
+host_label_prev(const char *name, const char *end)
+{
+  if (end == NULL)
+    return NULL;
+
+  const char *p = end;
+  while (p > name && *(p - 1) != '.')
+    --p;
+
+  return p;
+}
+
+/* Returns the node the literal labels of mask end at, creating it if add is set */
+static struct HostNode *
+host_trie_descend(struct HostNode *node, const char *mask, int add)
+{
+  const char *end = mask + strlen(mask);
+
+  /* Descend along the literal labels, stopping at the first one with a wildcard */
+  for (const char *label; node && (label = host_label_prev(mask, end));
+       end = label > mask ? label - 1 : NULL)
+  {
+    const char *p = label;
+
+    while (p < end && !IsMWildChar(*p) && *p != '\\')
+      ++p;
+    if (p < end)
+      break;
+
+    node = add ? host_trie_add(node, label, end - label) : host_trie_find(node, label, end - label);
+  }
+
+  return node;
+}
+
+static void
+host_trie_walk(const struct HostNode *node, void (*func)(void *))
+{
+  dlink_node *ptr, *ptr_next;
+
+  DLINK_FOREACH_SAFE(ptr, ptr_next, node->list.head)
+    func(ptr->data);
+
+  DLINK_FOREACH(ptr, node->children.head)
+    host_trie_walk(ptr->data, func);
+}
+
+static void
+address_index_add(struct AddressRec *arec)
+{
+  const unsigned int idx = address_index_type(arec->type);
+
+  switch (arec->masktype)
+  {
+    case HM_IPV4:
+    case HM_IPV6:
+    {
+      const int v6 = arec->masktype == HM_IPV6;
+      patricia_tree_t **tree = v6 ? &ipv6_index[idx] : &ipv4_index[idx];
+
+      if (arec->Mask.ipa.bits == 0)
+      {
+        arec->ilist = &ip_any_index[idx][v6];
+        break;
+      }
+
+      if (*tree == NULL)
+        *tree = patricia_new(v6 ? 128 : 32);
+
+      patricia_node_t *pnode = patricia_make_and_lookup_addr(*tree, (struct sockaddr *)&arec->Mask.ipa.addr,
+                                                             arec->Mask.ipa.bits);
+      if (pnode->data == NULL)
+      {
+        struct AddressBucket *bucket = xcalloc(sizeof(*bucket));
+        bucket->pnode = pnode;
+        pnode->data = bucket;
+      }
+
+      arec->ilist = &((struct AddressBucket *)pnode->data)->list;
+      break;
+    }
+    default: /* HM_HOST */
+      arec->ilist = &host_trie_descend(&host_index[idx], arec->Mask.hostname, 1)->list;
+      break;
+  }
+
+  dlinkAdd(arec, &arec->inode, arec->ilist);
+}
+
+static void
+address_index_del(struct AddressRec *arec)
+{
+  dlinkDelete(&arec->inode, arec->ilist);
+
+  if (dlink_list_length(arec->ilist))
+    return;
+
+  switch (arec->masktype)
+  {
+    case HM_IPV4:
+    case HM_IPV6:
+      if (arec->Mask.ipa.bits)
+      {
+        const unsigned int idx = address_index_type(arec->type);
+        struct AddressBucket *bucket = (struct AddressBucket *)arec->ilist;
+
+        bucket->pnode->data = NULL;
+        patricia_remove(arec->masktype == HM_IPV6 ? ipv6_index[idx] : ipv4_index[idx], bucket->pnode);
+        xfree(bucket);
+      }
+      break;
+    default: /* HM_HOST */
+      host_trie_prune((struct HostNode *)arec->ilist);
+      break;
+  }
+}
+
+static int
+address_rec_match(const struct AddressRec *arec, unsigned int hprecv, const char *username,
+                  const char *password, int do_match)
+{
+  return arec->precedence > hprecv &&
+         (!username || !(do_match ? match_mask(&arec->user_mask, username) :
+                                    irccmp(arec->username, username))) &&
+         (IsNeedPassword(arec->conf) || arec->conf->passwd == NULL ||
+          match_conf_password(password, arec->conf));
+}
+
 /* struct MaskItem *find_conf_by_address(const char *, struct irc_ssaddr *,
  *                                         int type, int fam, const char *username)
  * Input: The hostname, the address, the type of mask to find, the address
@@ -453,50 +718,40 @@ find_conf_by_address(const char *name, const struct irc_ssaddr *addr, unsigned i
   dlink_node *node;
   struct MaskItem *hprec = NULL;
   struct AddressRec *arec = NULL;
-  int (*cmpfunc)(const char *, const char *) = do_match ? match : irccmp;
+  const unsigned int idx = address_index_type(type);
 
-  if (addr)
+  if (addr && (fam == AF_INET || fam == AF_INET6))
   {
-    /* Check for IPV6 matches... */
-    if (fam == AF_INET6)
+    patricia_tree_t *tree = fam == AF_INET6 ? ipv6_index[idx] : ipv4_index[idx];
+
+    DLINK_FOREACH(node, ip_any_index[idx][fam == AF_INET6].head)
     {
-      for (int b = 128; b >= 0; b -= 16)
-      {
-        DLINK_FOREACH(node, atable[hash_ipv6(addr, b)].head)
-        {
-          arec = node->data;
+      arec = node->data;
 
-          if ((arec->type == type) &&
-              arec->precedence > hprecv &&
-              arec->masktype == HM_IPV6 &&
-              match_ipv6(addr, &arec->Mask.ipa.addr,
-                         arec->Mask.ipa.bits) &&
-              (!username || !cmpfunc(arec->username, username)) &&
-              (IsNeedPassword(arec->conf) || arec->conf->passwd == NULL ||
-               match_conf_password(password, arec->conf)))
-          {
-            hprecv = arec->precedence;
-            hprec = arec->conf;
-          }
-        }
+      if (address_rec_match(arec, hprecv, username, password, do_match))
+      {
+        hprecv = arec->precedence;
+        hprec = arec->conf;
       }
     }
-    else if (fam == AF_INET)
+
+    /*
+     * The best match and every prefix above it in the tree all cover
+     * addr, so walking up from there visits each candidate exactly once.
+     */
+    if (tree)
     {
-      for (int b = 32; b >= 0; b -= 8)
+      for (patricia_node_t *pnode = patricia_try_search_best_addr(tree, (struct sockaddr *)addr, 0);
+           pnode; pnode = pnode->parent)
       {
-        DLINK_FOREACH(node, atable[hash_ipv4(addr, b)].head)
+        if (pnode->prefix == NULL || pnode->data == NULL)
+          continue;
+
+        DLINK_FOREACH(node, ((struct AddressBucket *)pnode->data)->list.head)
         {
           arec = node->data;
 
-          if ((arec->type == type) &&
-              arec->precedence > hprecv &&
-              arec->masktype == HM_IPV4 &&
-              match_ipv4(addr, &arec->Mask.ipa.addr,
-                         arec->Mask.ipa.bits) &&
-              (!username || !cmpfunc(arec->username, username)) &&
-              (IsNeedPassword(arec->conf) || arec->conf->passwd == NULL ||
-               match_conf_password(password, arec->conf)))
+          if (address_rec_match(arec, hprecv, username, password, do_match))
           {
             hprecv = arec->precedence;
             hprec = arec->conf;
@@ -508,46 +763,30 @@ find_conf_by_address(const char *name, const struct irc_ssaddr *addr, unsigned i
 
   if (name)
   {
-    const char *p = name;
+    const struct HostNode *hnode = &host_index[idx];
+    const char *end = name + strlen(name);
 
-    while (1)
+    while (hnode)
     {
-        DLINK_FOREACH(node, atable[hash_text(p)].head)
-        {
-          arec = node->data;
-          if ((arec->type == type) &&
-            arec->precedence > hprecv &&
-            (arec->masktype == HM_HOST) &&
-            !cmpfunc(arec->Mask.hostname, name) &&
-            (!username || !cmpfunc(arec->username, username)) &&
-            (IsNeedPassword(arec->conf) || arec->conf->passwd == NULL ||
-             match_conf_password(password, arec->conf)))
+      DLINK_FOREACH(node, hnode->list.head)
+      {
+        arec = node->data;
+
+        if (address_rec_match(arec, hprecv, username, password, do_match) &&
+            !(do_match ? match_mask(&arec->host_mask, name) :
+                         irccmp(arec->Mask.hostname, name)))
         {
           hprecv = arec->precedence;
           hprec = arec->conf;
         }
       }
 
-      if ((p = strchr(p, '.')) == NULL)
+      const char *label = host_label_prev(name, end);
+      if (label == NULL)
         break;
-      ++p;
-    }
-
-    DLINK_FOREACH(node, atable[0].head)
-    {
-      arec = node->data;
 
-      if (arec->type == type &&
-          arec->precedence > hprecv &&
-          arec->masktype == HM_HOST &&
-          !cmpfunc(arec->Mask.hostname, name) &&
-          (!username || !cmpfunc(arec->username, username)) &&
-          (IsNeedPassword(arec->conf) || arec->conf->passwd == NULL ||
-           match_conf_password(password, arec->conf)))
-      {
-        hprecv = arec->precedence;
-        hprec = arec->conf;
-      }
+      hnode = host_trie_find(hnode, label, end - label);
+      end = label > name ? label - 1 : NULL;
     }
   }
 
@@ -625,6 +864,7 @@ add_conf_by_address(const unsigned int type, struct MaskItem *conf)
   arec->Mask.ipa.bits = bits;
   arec->username = username;
   arec->conf = conf;
+  match_mask_compile(&arec->user_mask, username);
   arec->precedence = prec_value--;
   arec->type = type;
 
@@ -642,10 +882,12 @@ add_conf_by_address(const unsigned int type, struct MaskItem *conf)
       break;
     default: /* HM_HOST */
       arec->Mask.hostname = hostname;
+      match_mask_compile(&arec->host_mask, hostname);
       dlinkAdd(arec, &arec->node, &atable[get_mask_hash(hostname)]);
       break;
   }
 
+  address_index_add(arec);
   return arec;
 }
 
@@ -687,6 +929,7 @@ delete_one_address_conf(const char *address, struct MaskItem *conf)
     if (arec->conf == conf)
     {
       dlinkDelete(&arec->node, &atable[hv]);
+      address_index_del(arec);
 
       if (!conf->ref_count)
         conf_free(conf);
@@ -722,6 +965,7 @@ clear_out_address_conf(void)
         continue;
 
       dlinkDelete(&arec->node, &atable[i]);
+      address_index_del(arec);
       arec->conf->active = 0;
 
       if (!arec->conf->ref_count)
@@ -777,6 +1021,7 @@ hostmask_expire_temporary(void)
           hostmask_send_expiration(arec);
 
           dlinkDelete(&arec->node, &atable[i]);
+          address_index_del(arec);
           conf_free(arec->conf);
           xfree(arec);
           break;
@@ -785,3 +1030,43 @@ hostmask_expire_temporary(void)
     }
   }
 }
+
+/*! \brief Add an entry to the host index of local clients
+ * \param name Host name or address as text
+ * \param data What host_name_index_walk() is to hand back
+ * \param node List node to link into the index
+ * \return Index bucket to pass to host_name_index_del()
+ */
+dlink_list *
+host_name_index_add(const char *name, void *data, dlink_node *node)
+{
+  dlink_list *list = &host_trie_descend(&host_name_index, name, 1)->list;
+
+  dlinkAdd(data, node, list);
+  return list;
+}
+
+/*! \brief Remove an entry added by host_name_index_add()
+ * \param list Index bucket it was added to
+ * \param node Its list node
+ */
+void
+host_name_index_del(dlink_list *list, dlink_node *node)
+{
+  dlinkDelete(node, list);
+  host_trie_prune((struct HostNode *)list);
+}
+
+/*! \brief Call a function for every entry of the host index of local
+ *         clients a host mask may match, and maybe a few more
+ * \param mask Host mask
+ * \param func Function to call with the data of each entry
+ */
+void
+host_name_index_walk(const char *mask, void (*func)(void *))
+{
+  const struct HostNode *node = host_trie_descend(&host_name_index, mask, 0);
+
+  if (node)
+    host_trie_walk(node, func);
+}
@@ -49,6 +49,7 @@
 #include "log.h"
 #include "server.h"
 #include "server_capab.h"
+#include "snapshot.h"
 #include "send.h"
 #include "whowas.h"
 #include "modules.h"
@@ -123,13 +124,6 @@ static struct event event_try_connections =
   .when = STARTUP_CONNECTIONS_TIME
 };
 
-static struct event event_comm_checktimeouts =
-{
-  .name = "comm_checktimeouts",
-  .handler = comm_checktimeouts,
-  .when = 1
-};
-
 static struct event event_save_all_databases =
 {
   .name = "save_all_databases",
@@ -187,7 +181,14 @@ io_loop(void)
     /* Run pending events */
     event_run();
 
+    /* Enforce bans that have been added since the last pass */
+    client_ban_check_run();
+
+    /* Write out what has been queued so far before we might block */
+    send_queued_flush();
+
     comm_select();
+    send_queued_flush();
     exit_aborted_clients();
     free_exited_clients();
 
@@ -430,6 +431,7 @@ main(int argc, char *argv[])
   initialize_global_set_options();  /* Has to be called after read_conf_files() */
   channel_init();
   channel_mode_init();
+  snapshot_init();
   read_links_file();
   motd_init();
   user_modes_init();
@@ -492,9 +494,6 @@ main(int argc, char *argv[])
   /* No, 'cause after a restart it would cause all sorts of nick collides */
   event_addish(&event_try_connections, NULL);
 
-  /* Setup the timeout check. I'll shift it later :)  -- adrian */
-  event_add(&event_comm_checktimeouts, NULL);
-
   event_addish(&event_save_all_databases, NULL);
 
   if (ConfigServerHide.flatten_links_delay && event_write_links_file.active == 0)
@@ -157,8 +157,8 @@ listener_accept_connection(fde_t *pfd, void *data)
   }
 
   /* Re-register a new IO request for the next accept .. */
-  comm_setselect(&listener->fd, COMM_SELECT_READ, listener_accept_connection,
-                 listener, 0);
+  comm_setselect(&listener->fd, COMM_SELECT_READ | COMM_SELECT_ACCEPT,
+                 listener_accept_connection, listener, 0);
 }
 
 
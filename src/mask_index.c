@@ -0,0 +1,180 @@
+/*
+ *  ircd-hybrid: an advanced, lightweight Internet Relay Chat Daemon (ircd)
+ *
+ *  Copyright (c) 2017 ircd-hybrid development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ *  USA
+ */
+
+/*! \file mask_index.c
+ * \brief Index of wildcard masks for match() and irccmp() lookups.
+ * \version $Id$
+ */
+
+#include "stdinc.h"
+#include "list.h"
+#include "irc_string.h"
+#include "mask_index.h"
+
+/* Number of literal characters a wildcard mask is hashed by */
+#define MASK_INDEX_GRAM 3
+
+
+static unsigned int
+mask_index_hash(const char *p, size_t len)
+{
+  uint32_t h = 2166136261U;
+
+  while (len--)
+  {
+    h ^= ToLower(*p++);
+    h *= 16777619U;
+  }
+
+  return (h ^ (h >> 16)) & (MASK_INDEX_SIZE - 1);
+}
+
+/*! \brief Add a mask to an index
+ * \param index Pointer to index
+ * \param entry Pointer to the entry embedded in the item
+ * \param mask  Mask; must stay valid until mask_index_del()
+ * \param data  Item to return from mask_index_find()
+ */
+void
+mask_index_add(struct MaskIndex *index, struct MaskIndexEntry *entry, const char *mask, void *data)
+{
+  const char *run = NULL, *p = mask;
+  size_t run_len = 0;
+
+  entry->mask = mask;
+  entry->data = data;
+  match_mask_compile(&entry->match, mask);
+  entry->serial = ++index->serial;
+  entry->seen = index->seen;
+  dlinkAdd(entry, &entry->exact_node, &index->exact[mask_index_hash(mask, strlen(mask))]);
+
+  if (entry->match.flags & MATCH_MASK_LITERAL)
+  {
+    entry->wild_list = NULL;
+    return;
+  }
+
+  /* Find the longest run of characters match() compares literally */
+  while (*p)
+  {
+    if (*p == '*' || *p == '?' || *p == '\\')
+    {
+      if (*p++ == '\\' && *p)
+        ++p;
+      continue;
+    }
+
+    const char *start = p;
+    while (*p && *p != '*' && *p != '?' && *p != '\\')
+      ++p;
+
+    if ((size_t)(p - start) > run_len)
+    {
+      run = start;
+      run_len = p - start;
+    }
+  }
+
+  if (run_len >= MASK_INDEX_GRAM)
+    entry->wild_list = &index->wild[mask_index_hash(run, MASK_INDEX_GRAM)];
+  else
+    entry->wild_list = &index->other;
+
+  dlinkAdd(entry, &entry->wild_node, entry->wild_list);
+}
+
+/*! \brief Remove a mask from an index
+ * \param index Pointer to index
+ * \param entry Pointer to the entry given to mask_index_add()
+ */
+void
+mask_index_del(struct MaskIndex *index, struct MaskIndexEntry *entry)
+{
+  dlinkDelete(&entry->exact_node, &index->exact[mask_index_hash(entry->mask, strlen(entry->mask))]);
+
+  if (entry->wild_list)
+    dlinkDelete(&entry->wild_node, entry->wild_list);
+}
+
+static void
+mask_index_scan(struct MaskIndex *index, const dlink_list *list, const char *name,
+                struct MaskIndexEntry **best)
+{
+  dlink_node *node;
+
+  DLINK_FOREACH(node, list->head)
+  {
+    struct MaskIndexEntry *entry = node->data;
+
+    if (entry->seen == index->seen)
+      continue;
+    entry->seen = index->seen;
+
+    if (*best && (*best)->serial > entry->serial)
+      continue;
+
+    if (!match_mask(&entry->match, name))
+      *best = entry;
+  }
+}
+
+/*! \brief Find the most recently added mask matching a string
+ * \param index   Pointer to index
+ * \param name    String to look up
+ * \param compare match() to find wildcard matches; any other function
+ *                is taken to compare case-insensitively like irccmp()
+ * \return data of the entry found, or NULL
+ */
+void *
+mask_index_find(struct MaskIndex *index, const char *name, int (*compare)(const char *, const char *))
+{
+  const size_t len = strlen(name);
+  struct MaskIndexEntry *best = NULL;
+  dlink_node *node;
+
+  DLINK_FOREACH(node, index->exact[mask_index_hash(name, len)].head)
+  {
+    struct MaskIndexEntry *entry = node->data;
+
+    /* Wildcard masks are looked at below when matching */
+    if (compare == match && entry->wild_list)
+      continue;
+
+    if (best && best->serial > entry->serial)
+      continue;
+
+    if (!compare(entry->mask, name))
+      best = entry;
+  }
+
+  if (compare == match)
+  {
+    ++index->seen;
+
+    /* A matching mask's literal characters all occur in name as well */
+    for (size_t i = 0; i + MASK_INDEX_GRAM <= len; ++i)
+      mask_index_scan(index, &index->wild[mask_index_hash(name + i, MASK_INDEX_GRAM)], name, &best);
+
+    mask_index_scan(index, &index->other, name, &best);
+  }
+
+  return best ? best->data : NULL;
+}
@@ -27,18 +27,142 @@
 #include "stdinc.h"
 #include "irc_string.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <emmintrin.h>
 
-/*! \brief Check a string against a mask.
- * This test checks using traditional IRC wildcards only: '*' means
- * match zero or more characters of any type; '?' means match exactly
- * one character of any type.  A backslash escapes the next character
- * so that a wildcard may be matched exactly.
- * param mask Wildcard-containing mask.
- * param name String to check against \a mask.
- * return Zero if \a mask matches \a name, non-zero if no match.
+/*
+ * match(), irccmp() and ircncmp() look at 16 bytes at a time where
+ * that is safe.  Strings aren't padded, so a load is only done where
+ * it can't run into the next page past the terminating NUL.
+ *
+ * SSE2 is part of x86-64; 32-bit builds that don't assume it ask the
+ * CPU at run time and otherwise keep to the byte loops.
  */
-int
-match(const char *mask, const char *name)
+#define MATCH_SIMD 16
+#define MATCH_SIMD_SAFE(p) ((((uintptr_t)(p)) & 4095) <= 4096 - MATCH_SIMD)
+#define MATCH_SIMD_TARGET __attribute__((target("sse2")))
+
+#ifdef __SSE2__
+#define match_simd_usable() 1
+#else
+#define match_simd_usable() __builtin_cpu_supports("sse2")
+#endif
+
+/* Same as ToLower() on each byte: only 'A'..'Z' are folded */
+static inline MATCH_SIMD_TARGET __m128i
+match_simd_lower(__m128i v)
+{
+  const __m128i upper = _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8(0x80 - 'A')),
+                                       _mm_set1_epi8(-0x80 + 26));
+  return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+/* Bitmask of the bytes in which a and b differ after case folding */
+static inline MATCH_SIMD_TARGET unsigned int
+match_simd_diff(__m128i a, __m128i b)
+{
+  return ~_mm_movemask_epi8(_mm_cmpeq_epi8(match_simd_lower(a), match_simd_lower(b))) & 0xFFFF;
+}
+
+/* Bitmask of the NUL bytes in v */
+static inline MATCH_SIMD_TARGET unsigned int
+match_simd_nul(__m128i v)
+{
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+}
+
+/*
+ * match_skip_literal - advance m and n past the characters they have
+ * in common up to the next wildcard, escape or NUL in m.
+ */
+static inline MATCH_SIMD_TARGET void
+match_skip_literal(const char **m, const char **n)
+{
+  while (MATCH_SIMD_SAFE(*m) && MATCH_SIMD_SAFE(*n))
+  {
+    const __m128i vm = _mm_loadu_si128((const __m128i *)*m);
+    const __m128i vn = _mm_loadu_si128((const __m128i *)*n);
+    const __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(vm, _mm_set1_epi8('*')),
+                                                      _mm_cmpeq_epi8(vm, _mm_set1_epi8('?'))),
+                                         _mm_or_si128(_mm_cmpeq_epi8(vm, _mm_set1_epi8('\\')),
+                                                      _mm_cmpeq_epi8(vm, _mm_setzero_si128())));
+    const unsigned int stop = _mm_movemask_epi8(special) | match_simd_diff(vm, vn);
+
+    if (stop)
+    {
+      *m += __builtin_ctz(stop);
+      *n += __builtin_ctz(stop);
+      return;
+    }
+
+    *m += MATCH_SIMD;
+    *n += MATCH_SIMD;
+  }
+}
+
+/*
+ * match_simd_find - find the first character in n that is c, or the
+ * terminating NUL.  Case is ignored if fold is non-zero.
+ */
+static inline MATCH_SIMD_TARGET const char *
+match_simd_find(const char *n, char c, int fold)
+{
+  const __m128i want = _mm_set1_epi8(fold ? ToLower(c) : c);
+
+  while (MATCH_SIMD_SAFE(n))
+  {
+    const __m128i vn = _mm_loadu_si128((const __m128i *)n);
+    const unsigned int hit = match_simd_nul(vn) |
+      _mm_movemask_epi8(_mm_cmpeq_epi8(fold ? match_simd_lower(vn) : vn, want));
+
+    if (hit)
+      return n + __builtin_ctz(hit);
+
+    n += MATCH_SIMD;
+  }
+
+  return n;
+}
+
+/* Bitmask of the bytes up to the first difference or NUL, 0 if there is none in 16 bytes */
+static inline MATCH_SIMD_TARGET unsigned int
+match_simd_cmp(const unsigned char *s1, const unsigned char *s2, unsigned int *diff)
+{
+  const __m128i v1 = _mm_loadu_si128((const __m128i *)s1);
+  const __m128i v2 = _mm_loadu_si128((const __m128i *)s2);
+
+  *diff = match_simd_diff(v1, v2);
+  return *diff | match_simd_nul(v1);
+}
+#else
+#define match_simd_usable() 0
+#endif
+
+/*
+ * match_find - find the first character in n that is c, or the
+ * terminating NUL.  Case is ignored if fold is non-zero.
+ */
+static inline __attribute__((always_inline)) const char *
+match_find(const char *n, char c, int fold, int simd)
+{
+#ifdef MATCH_SIMD
+  if (simd)
+    n = match_simd_find(n, c, fold);
+#endif
+
+  if (fold)
+    for (; *n && ToLower(*n) != ToLower(c); ++n)
+      ;
+  else
+    for (; *n && *n != c; ++n)
+      ;
+
+  return n;
+}
+
+/* match() as the byte loops, or with 16 byte steps if simd is set */
+static inline __attribute__((always_inline)) int
+match_body(const char *mask, const char *name, int simd)
 {
   const char *m = mask, *n = name;
   const char *m_tmp = mask, *n_tmp = name;
@@ -93,14 +217,12 @@ match(const char *mask, const char *name)
 
             if (*m == '\0')
               return 1;
-            for (n_tmp = n; *n && *n != *m; ++n)
-              ;
+            n = match_find(n_tmp = n, *m, 0, simd);
           }
           else
           {
             m_tmp = m;
-            for (n_tmp = n; *n && (ToLower(*n) != ToLower(*m)); ++n)
-              ;
+            n = match_find(n_tmp = n, *m, 1, simd);
           }
         }
         /* and fall through */
@@ -111,6 +233,10 @@ match(const char *mask, const char *name)
           goto backtrack;
         ++m;
         ++n;
+#ifdef MATCH_SIMD
+        if (simd)
+          match_skip_literal(&m, &n);
+#endif
         break;
     }
   }
@@ -118,6 +244,132 @@ match(const char *mask, const char *name)
   return 1;
 }
 
+#ifdef MATCH_SIMD
+static MATCH_SIMD_TARGET int
+match_simd(const char *mask, const char *name)
+{
+  return match_body(mask, name, 1);
+}
+#endif
+
+/*! \brief Check a string against a mask.
+ * This test checks using traditional IRC wildcards only: '*' means
+ * match zero or more characters of any type; '?' means match exactly
+ * one character of any type.  A backslash escapes the next character
+ * so that a wildcard may be matched exactly.
+ * param mask Wildcard-containing mask.
+ * param name String to check against \a mask.
+ * return Zero if \a mask matches \a name, non-zero if no match.
+ */
+int
+match(const char *mask, const char *name)
+{
+#ifdef MATCH_SIMD
+  if (match_simd_usable())
+    return match_simd(mask, name);
+#endif
+  return match_body(mask, name, 0);
+}
+
+/*! \brief Prepare a mask for match_mask().
+ * \param mm   MatchMask to fill in
+ * \param mask Wildcard-containing mask; it is not copied and must
+ *             remain unchanged while \a mm is in use
+ */
+void
+match_mask_compile(struct MatchMask *mm, const char *mask)
+{
+  const char *p = mask;
+  unsigned int run = 0, stars = 0, wild = 0, escape = 0;
+
+  memset(mm, 0, sizeof(*mm));
+  mm->mask = mask;
+
+  if (mask == NULL)
+    return;
+
+  for (; *p; ++p)
+  {
+    switch (*p)
+    {
+      case '*':
+        ++stars;
+        /* fall through */
+      case '?':
+        if (!wild)
+          mm->prefix = run;
+        wild = 1;
+        run = 0;
+
+        if (*p == '?')
+          ++mm->minlen;
+        break;
+      case '\\':
+        /* Escaped characters are compared exactly; leave them to match() */
+        escape = 1;
+        if (!wild)
+          mm->prefix = run;
+        wild = 1;
+        run = 0;
+        break;
+      default:
+        ++run;
+        ++mm->minlen;
+        break;
+    }
+  }
+
+  if (!wild)
+  {
+    mm->flags = MATCH_MASK_LITERAL;
+    mm->prefix = run;
+    mm->minlen = run;
+    return;
+  }
+
+  mm->suffix = run;
+
+  if (escape)
+  {
+    /* minlen and suffix would need to know how match() treats escapes */
+    mm->suffix = 0;
+    mm->minlen = mm->prefix;
+  }
+  else if (stars == 0)
+    mm->flags |= MATCH_MASK_FIXED;
+  else if (stars == 1 && mm->prefix + 1 + mm->suffix == (size_t)(p - mask))
+    mm->flags |= MATCH_MASK_SIMPLE;
+}
+
+/*! \brief Check a string against a mask prepared by match_mask_compile().
+ * \param mm   Compiled mask
+ * \param name String to check against \a mm
+ * \return Same as match(mm->mask, name)
+ */
+int
+match_mask(const struct MatchMask *mm, const char *name)
+{
+  if (mm->flags & MATCH_MASK_LITERAL)
+    return irccmp(mm->mask, name);
+
+  const size_t len = strlen(name);
+
+  if (len < mm->minlen)
+    return 1;
+  if ((mm->flags & MATCH_MASK_FIXED) && len != mm->minlen)
+    return 1;
+
+  if (mm->prefix && ircncmp(mm->mask, name, mm->prefix))
+    return 1;
+  if (mm->suffix && irccmp(mm->mask + strlen(mm->mask) - mm->suffix, name + len - mm->suffix))
+    return 1;
+
+  if (mm->flags & MATCH_MASK_SIMPLE)
+    return 0;
+
+  return match(mm->mask, name);
+}
+
 /*
  * collapse()
  * Collapse a pattern string into minimal components.
@@ -183,6 +435,43 @@ collapse(char *mask)
   return mask;
 }
 
+/* irccmp() and ircncmp() as the byte loops, or with 16 byte steps if simd is set */
+static inline __attribute__((always_inline)) int
+ircncmp_body(const unsigned char *str1, const unsigned char *str2, size_t n, int simd)
+{
+#ifdef MATCH_SIMD
+  while (simd && n >= MATCH_SIMD && MATCH_SIMD_SAFE(str1) && MATCH_SIMD_SAFE(str2))
+  {
+    unsigned int diff;
+    const unsigned int stop = match_simd_cmp(str1, str2, &diff);
+
+    /* Equal up to and including the NUL, or differing at the first stop */
+    if (stop)
+      return (diff >> __builtin_ctz(stop)) & 1;
+
+    str1 += MATCH_SIMD;
+    str2 += MATCH_SIMD;
+
+    if ((n -= MATCH_SIMD) == 0)
+      return 0;
+  }
+#endif
+
+  for (; ToUpper(*str1) == ToUpper(*str2); ++str1, ++str2)
+    if (--n == 0 || *str1 == '\0')
+      return 0;
+
+  return 1;
+}
+
+#ifdef MATCH_SIMD
+static MATCH_SIMD_TARGET int
+ircncmp_simd(const unsigned char *str1, const unsigned char *str2, size_t n)
+{
+  return ircncmp_body(str1, str2, n, 1);
+}
+#endif
+
 /*
  * irccmp - case insensitive comparison of two 0 terminated strings.
  *
@@ -192,25 +481,20 @@ collapse(char *mask)
 int
 irccmp(const char *s1, const char *s2)
 {
-  const unsigned char *str1 = (const unsigned char *)s1;
-  const unsigned char *str2 = (const unsigned char *)s2;
-
   assert(s1);
   assert(s2);
 
-  for (; ToUpper(*str1) == ToUpper(*str2); ++str1, ++str2)
-    if (*str1 == '\0')
-      return 0;
-
-  return 1;
+  /* Stops at the NUL well before n runs out */
+#ifdef MATCH_SIMD
+  if (match_simd_usable())
+    return ircncmp_simd((const unsigned char *)s1, (const unsigned char *)s2, SIZE_MAX);
+#endif
+  return ircncmp_body((const unsigned char *)s1, (const unsigned char *)s2, SIZE_MAX, 0);
 }
 
 int
 ircncmp(const char *s1, const char *s2, size_t n)
 {
-  const unsigned char *str1 = (const unsigned char *)s1;
-  const unsigned char *str2 = (const unsigned char *)s2;
-
   assert(s1);
   assert(s2);
   assert(n > 0);
@@ -218,11 +502,11 @@ ircncmp(const char *s1, const char *s2, size_t n)
   if (n == 0)
     return 0;
 
-  for (; ToUpper(*str1) == ToUpper(*str2); ++str1, ++str2)
-    if (--n == 0 || *str1 == '\0')
-      return 0;
-
-  return 1;
+#ifdef MATCH_SIMD
+  if (match_simd_usable())
+    return ircncmp_simd((const unsigned char *)s1, (const unsigned char *)s2, n);
+#endif
+  return ircncmp_body((const unsigned char *)s1, (const unsigned char *)s2, n, 0);
 }
 
 const unsigned char ToLowerTab[] =
@@ -32,17 +32,19 @@
 #include "client.h"
 #include "ircd.h"
 #include "parse.h"
+#include "channel_mode.h"
 #include "fdlist.h"
 #include "packet.h"
 #include "irc_string.h"
 #include "memory.h"
 #include "send.h"
 #include "misc.h"
+#include "server_zip.h"
+#include "snapshot.h"
 
 
-enum { READBUF_SIZE = 16384 };
-
-static char readBuf[READBUF_SIZE];
+/* Lines which cross a receive queue block boundary are copied here */
+static char linebuf[IRCD_BUFSIZE];
 
 
 /*
@@ -74,26 +76,25 @@ client_dopacket(struct Client *client_p, char *buffer, unsigned int length)
 /* extract_one_line()
  *
  * inputs       - pointer to a dbuf queue
- *              - pointer to buffer to copy data to
- * output       - length of <buffer>
- * side effects - one line is copied and removed from the dbuf
+ *              - pointer to set to the start of the line
+ *              - pointer to set to a block to release after parsing
+ * output       - length of the line
+ * side effects - one line is removed from the dbuf.  A line contained
+ *                in a single block is terminated in place and *hold is
+ *                set to that block with a reference taken, so it stays
+ *                valid while the line is parsed; only lines which cross
+ *                a block boundary are copied to linebuf.
  */
 static unsigned int
-extract_one_line(struct dbuf_queue *qptr, char *buffer)
+extract_one_line(struct dbuf_queue *qptr, char **line, struct dbuf_block **hold)
 {
   unsigned int line_bytes = 0, eol_bytes = 0;
-  dlink_node *node;
+  unsigned int idx = qptr->pos;
+  struct dbuf_iter iter;
 
-  DLINK_FOREACH(node, qptr->blocks.head)
+  for (const struct dbuf_block *block = dbuf_first(qptr, &iter); block;
+       block = dbuf_next(&iter), idx = 0)
   {
-    const struct dbuf_block *block = node->data;
-    unsigned int idx;
-
-    if (node == qptr->blocks.head)
-      idx = qptr->pos;
-    else
-      idx = 0;
-
     for (; idx < block->size; ++idx)
     {
       char c = block->data[idx];
@@ -108,26 +109,91 @@ extract_one_line(struct dbuf_queue *qptr, char *buffer)
       }
       else if (eol_bytes)
         goto out;
-      else if (line_bytes++ < IRCD_BUFSIZE - 2)
-        *buffer++ = c;
+      else
+        ++line_bytes;
     }
   }
 
 out:
 
   /*
-   * Now, if we haven't found an EOL, ignore all line bytes
-   * that we have read, since this is a partial line case.
+   * Now, if we haven't found an EOL, leave everything in place,
+   * since this is a partial line case.
    */
-  if (eol_bytes)
-    *buffer = '\0';
-  else
-    line_bytes = 0;
+  if (eol_bytes == 0)
+    return 0;
+
+  const unsigned int len = IRCD_MIN(line_bytes, IRCD_BUFSIZE - 2);
+
+  if (len)
+  {
+    struct dbuf_block *block = dbuf_head(qptr);
+
+    if (line_bytes + eol_bytes <= block->size - qptr->pos)
+    {
+      *line = block->data + qptr->pos;
+      *hold = block;
+      ++block->refs;
+    }
+    else
+    {
+      unsigned int copied = 0;
+
+      idx = qptr->pos;
+
+      for (block = dbuf_first(qptr, &iter); block; block = dbuf_next(&iter), idx = 0)
+      {
+        const unsigned int n = IRCD_MIN(block->size - idx, len - copied);
+
+        memcpy(linebuf + copied, block->data + idx, n);
+        copied += n;
+
+        if (copied == len)
+          break;
+      }
+
+      *line = linebuf;
+    }
+
+    (*line)[len] = '\0';
+  }
 
   /* Remove what is now unnecessary */
   dbuf_delete(qptr, line_bytes + eol_bytes);
 
-  return IRCD_MIN(line_bytes, IRCD_BUFSIZE - 2);
+  return len;
+}
+
+/*
+ * parse_one_line - parse the next complete line of the receive queue
+ * output - 0 if there was none
+ *
+ * Lines a server told us to replay from our snapshot of it (SNAPUSE)
+ * come before anything received after that.
+ */
+static int
+parse_one_line(struct Client *client_p)
+{
+  struct dbuf_queue *queue = &client_p->connection->buf_recvq;
+  struct dbuf_block *hold = NULL;
+  char *line = NULL;
+
+  if (client_p->connection->snapshot && dbuf_length(&client_p->connection->snapshot->replay))
+    queue = &client_p->connection->snapshot->replay;
+
+  const unsigned int dolen = extract_one_line(queue, &line, &hold);
+
+  if (dolen == 0)
+    return 0;
+
+  if (queue == &client_p->connection->buf_recvq)
+    client_dopacket(client_p, line, dolen);
+  else
+    parse(client_p, line, line + dolen);  /* Not received, so not counted */
+
+  if (hold)
+    dbuf_ref_free(hold);
+  return 1;
 }
 
 /*
@@ -136,8 +202,6 @@ out:
 static void
 parse_client_queued(struct Client *client_p)
 {
-  unsigned int dolen = 0;
-
   if (IsUnknown(client_p))
   {
     unsigned int i = 0;
@@ -151,12 +215,9 @@ parse_client_queued(struct Client *client_p)
       if (i >= MAX_FLOOD)
         break;
 
-      dolen = extract_one_line(&client_p->connection->buf_recvq, readBuf);
-
-      if (dolen == 0)
+      if (parse_one_line(client_p) == 0)
         break;
 
-      client_dopacket(client_p, readBuf, dolen);
       ++i;
 
       /*
@@ -175,10 +236,8 @@ parse_client_queued(struct Client *client_p)
       if (IsDefunct(client_p))
         return;
 
-      if ((dolen = extract_one_line(&client_p->connection->buf_recvq, readBuf)) == 0)
+      if (parse_one_line(client_p) == 0)
         break;
-
-      client_dopacket(client_p, readBuf, dolen);
     }
   }
   else if (IsClient(client_p))
@@ -218,12 +277,9 @@ parse_client_queued(struct Client *client_p)
         if (client_p->connection->sent_parsed >= client_p->connection->allow_read)
           break;
 
-      dolen = extract_one_line(&client_p->connection->buf_recvq, readBuf);
-
-      if (dolen == 0)
+      if (parse_one_line(client_p) == 0)
         break;
 
-      client_dopacket(client_p, readBuf, dolen);
       ++client_p->connection->sent_parsed;
     }
   }
@@ -282,17 +338,15 @@ flood_recalc(fde_t *fd, void *data)
 }
 
 /*
- * read_packet - Read a 'packet' of data from a connection and process it.
+ * read_packet_pass - Read what there is from a connection and process it.
  */
-void
-read_packet(fde_t *fd, void *data)
+static void
+read_packet_pass(fde_t *fd, struct Client *client_p)
 {
-  struct Client *const client_p = data;
+  static char zipbuf[DBUF_BLOCK_SIZE_MAX];
   int length = 0;
   int want_write = 0;
-
-  if (IsDefunct(client_p))
-    return;
+  size_t avail = 0;
 
   /*
    * Read some data. We *used to* do anti-flood protection here, but
@@ -301,15 +355,29 @@ read_packet(fde_t *fd, void *data)
    */
   do
   {
+    /*
+     * Receive straight into the tail of the receive queue, unless the
+     * data has to be inflated into it first
+     */
+    char *buf = zipbuf;
+
+    if (client_p->connection->zip && client_p->connection->zip->reading)
+      avail = sizeof(zipbuf);
+    else
+      buf = dbuf_reserve(&client_p->connection->buf_recvq, &avail);
+
     if (tls_isusing(&fd->ssl))
     {
-      length = tls_read(&fd->ssl, readBuf, sizeof(readBuf), &want_write);
+      length = tls_read(&fd->ssl, buf, avail, &want_write);
 
       if (want_write)
         comm_setselect(fd, COMM_SELECT_WRITE, sendq_unblocked, client_p, 0);
     }
     else
-      length = recv(fd->fd, readBuf, sizeof(readBuf), 0);
+      length = netio_recv(fd, buf, avail);
+
+    if (buf != zipbuf)
+      dbuf_commit(&client_p->connection->buf_recvq, IRCD_MAX(length, 0));
 
     if (length <= 0)
     {
@@ -324,8 +392,6 @@ read_packet(fde_t *fd, void *data)
       return;
     }
 
-    dbuf_put(&client_p->connection->buf_recvq, readBuf, length);
-
     if (client_p->connection->lasttime < CurrentTime)
       client_p->connection->lasttime = CurrentTime;
 
@@ -334,6 +400,12 @@ read_packet(fde_t *fd, void *data)
 
     DelFlag(client_p, FLAGS_PINGSENT);
 
+    if (buf == zipbuf && zip_read(client_p, buf, length) == 0)
+    {
+      exit_client(client_p, "Decompression error");
+      return;
+    }
+
     /* Attempt to parse what we have */
     parse_client_queued(client_p);
 
@@ -348,8 +420,29 @@ read_packet(fde_t *fd, void *data)
       exit_client(client_p, "Excess Flood");
       return;
     }
-  } while (length == sizeof(readBuf) || tls_isusing(&fd->ssl));
+  } while ((size_t)length == avail || tls_isusing(&fd->ssl));
+
+  /*
+   * If we get here, we need to register for another COMM_SELECT_READ.
+   * TLS reads the socket itself, everything else goes through netio_recv().
+   */
+  comm_setselect(fd, COMM_SELECT_READ | (tls_isusing(&fd->ssl) ? 0 : COMM_SELECT_RECV),
+                 read_packet, client_p, 0);
+}
+
+/*
+ * read_packet - Read a 'packet' of data from a connection and process it.
+ */
+void
+read_packet(fde_t *fd, void *data)
+{
+  struct Client *const client_p = data;
+
+  if (IsDefunct(client_p))
+    return;
+
+  read_packet_pass(fd, client_p);
 
-  /* If we get here, we need to register for another COMM_SELECT_READ */
-  comm_setselect(fd, COMM_SELECT_READ, read_packet, client_p, 0);
+  /* The +o/+h/+v of the members SJOIN added share MODE lines up to here */
+  channel_member_mode_flush();
 }
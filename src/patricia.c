@@ -65,7 +65,7 @@ comp_with_mask(void *addr, void *dest, unsigned int mask)
   if ( /* mask/8 == 0 || */ memcmp(addr, dest, mask / 8) == 0)
   {
     int n = mask / 8;
-    int m = ((-1) << (8 - (mask % 8)));
+    int m = (int)(~0U << (8 - (mask % 8)));
 
     if (mask % 8 == 0 || (((unsigned char *)addr)[n] & m) == (((unsigned char *)dest)[n] & m))
       return 1;
@@ -484,6 +484,46 @@ patricia_search_best2(patricia_tree_t *patricia, prefix_t *prefix, int inclusive
   return NULL;
 }
 
+/*
+ * Returns the topmost node of the subtree that holds every prefix
+ * covered by the given one, or NULL if the tree has none of them.
+ */
+patricia_node_t *
+patricia_search_covered(patricia_tree_t *patricia, prefix_t *prefix)
+{
+  patricia_node_t *node, *leaf;
+  unsigned char *addr;
+  unsigned int bitlen;
+
+  assert(patricia);
+  assert(prefix);
+  assert(prefix->bitlen <= patricia->maxbits);
+
+  node = patricia->head;
+  addr = prefix_touchar(prefix);
+  bitlen = prefix->bitlen;
+
+  while (node && node->bit < bitlen)
+  {
+    if (BIT_TEST(addr[node->bit >> 3], 0x80 >> (node->bit & 0x07)))
+      node = node->r;
+    else
+      node = node->l;
+  }
+
+  if (node == NULL)
+    return NULL;
+
+  /* Everything below node shares its leading bits, so one prefix tells */
+  for (leaf = node; leaf->prefix == NULL; leaf = leaf->l ? leaf->l : leaf->r)
+    ;
+
+  if (comp_with_mask(prefix_tochar(leaf->prefix), addr, bitlen))
+    return node;
+
+  return NULL;
+}
+
 patricia_node_t *
 patricia_search_best(patricia_tree_t *patricia, prefix_t *prefix)
 {
@@ -873,6 +913,38 @@ patricia_make_and_lookup(patricia_tree_t *tree, const char *string)
   return NULL;
 }
 
+patricia_node_t *
+patricia_make_and_lookup_addr(patricia_tree_t *tree, struct sockaddr *addr, int bitlen)
+{
+  int family;
+  void *dest;
+
+  if (addr->sa_family == AF_INET6)
+  {
+    if (bitlen == 0 || bitlen > 128)
+      bitlen = 128;
+    family = AF_INET6;
+    dest = &((struct sockaddr_in6 *)addr)->sin6_addr;
+  }
+  else
+  {
+    if (bitlen == 0 || bitlen > 32)
+      bitlen = 32;
+    family = AF_INET;
+    dest = &((struct sockaddr_in *)addr)->sin_addr;
+  }
+
+  prefix_t *prefix = New_Prefix(family, dest, bitlen);
+  if (prefix)
+  {
+    patricia_node_t *node = patricia_lookup(tree, prefix);
+    Deref_Prefix(prefix);
+    return node;
+  }
+
+  return NULL;
+}
+
 void
 patricia_lookup_then_remove(patricia_tree_t *tree, const char *string)
 {
@@ -974,4 +1046,36 @@ patricia_try_search_best_addr(patricia_tree_t *tree, struct sockaddr *addr, int
 
   return NULL;
 }
+
+patricia_node_t *
+patricia_try_search_covered_addr(patricia_tree_t *tree, struct sockaddr *addr, int bitlen)
+{
+  int family;
+  void *dest;
+
+  if (addr->sa_family == AF_INET6)
+  {
+    if (bitlen == 0 || bitlen > 128)
+      bitlen = 128;
+    family = AF_INET6;
+    dest = &((struct sockaddr_in6 *)addr)->sin6_addr;
+  }
+  else
+  {
+    if (bitlen == 0 || bitlen > 32)
+      bitlen = 32;
+    family = AF_INET;
+    dest = &((struct sockaddr_in *)addr)->sin_addr;
+  }
+
+  prefix_t *prefix = New_Prefix(family, dest, bitlen);
+  if (prefix)
+  {
+    patricia_node_t *node = patricia_search_covered(tree, prefix);
+    Deref_Prefix(prefix);
+    return node;
+  }
+
+  return NULL;
+}
 /* } */
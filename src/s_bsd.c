@@ -48,6 +48,7 @@
 #include "send.h"
 #include "memory.h"
 #include "user.h"
+#include "server_zip.h"
 
 
 static const char *const comm_err_str[] =
@@ -157,9 +158,12 @@ close_connection(struct Client *client_p)
      * before COMM_SELECT_WRITE). Let's try, nothing to lose.. -adx
      */
     DelFlag(client_p, FLAGS_BLOCKED);
-    send_queued_write(client_p);
   }
 
+  /* This also takes the client off the list of sendqs to flush */
+  send_queued_write(client_p);
+  client_ban_index_del(client_p);
+
   if (IsClient(client_p))
   {
     ++ServerStats.is_cl;
@@ -201,6 +205,7 @@ close_connection(struct Client *client_p)
 
   dbuf_clear(&client_p->connection->buf_sendq);
   dbuf_clear(&client_p->connection->buf_recvq);
+  zip_free(client_p);
 
   xfree(client_p->connection->password);
   client_p->connection->password = NULL;
@@ -230,11 +235,11 @@ ssl_handshake(fde_t *fd, void *data)
     {
       case TLS_HANDSHAKE_WANT_WRITE:
         comm_setselect(&client_p->connection->fd, COMM_SELECT_WRITE,
-                       ssl_handshake, client_p, CONNECTTIMEOUT);
+                       ssl_handshake, client_p, CONNECTTIMEOUT * 1000);
         return;
       case TLS_HANDSHAKE_WANT_READ:
         comm_setselect(&client_p->connection->fd, COMM_SELECT_READ,
-                       ssl_handshake, client_p, CONNECTTIMEOUT);
+                       ssl_handshake, client_p, CONNECTTIMEOUT * 1000);
         return;
       default:
         exit_client(client_p, "Error during TLS handshake");
@@ -277,6 +282,7 @@ add_connection(struct Listener *listener, struct irc_ssaddr *irn, int fd)
               client_p->connection->ip.ss_len, client_p->sockhost,
               sizeof(client_p->sockhost), NULL, 0, NI_NUMERICHOST);
   client_p->connection->aftype = client_p->connection->ip.ss.ss_family;
+  client_ban_index_add(client_p);
 
 #ifdef HAVE_LIBGEOIP
   if (irn->ss.ss_family == AF_INET && GeoIPv4_ctx)
@@ -347,26 +353,67 @@ ignoreErrno(int ierrno)
   }
 }
 
+/*
+ * comm_timeout_expire() / comm_flush_expire() - fire a descriptor's
+ * timeout or flush handler.  Both are one-shot: the handler is cleared
+ * before it runs and has to rearm itself if needed.
+ */
+static void
+comm_timeout_expire(void *data)
+{
+  fde_t *F = data;
+  void (*hdl)(fde_t *, void *) = F->timeout_handler;
+  void *hdl_data = F->timeout_data;
+
+  assert(F->flags.open);
+
+  F->timeout_handler = NULL;
+  F->timeout_data = NULL;
+  hdl(F, hdl_data);
+}
+
+static void
+comm_flush_expire(void *data)
+{
+  fde_t *F = data;
+  void (*hdl)(fde_t *, void *) = F->flush_handler;
+  void *hdl_data = F->flush_data;
+
+  assert(F->flags.open);
+
+  F->flush_handler = NULL;
+  F->flush_data = NULL;
+  hdl(F, hdl_data);
+}
+
 /*
  * comm_settimeout() - set the socket timeout
  *
- * Set the timeout for the fd
+ * Set the timeout for the fd, in milliseconds
  */
 void
 comm_settimeout(fde_t *fd, uintmax_t timeout, void (*callback)(fde_t *, void *), void *cbdata)
 {
   assert(fd->flags.open);
 
-  fd->timeout = CurrentTime + (timeout / 1000);
   fd->timeout_handler = callback;
   fd->timeout_data = cbdata;
+
+  if (callback)
+  {
+    fd->timeout_ev.handler = comm_timeout_expire;
+    fd->timeout_ev.oneshot = 1;
+    event_add_ms(&fd->timeout_ev, timeout, fd);
+  }
+  else
+    event_delete(&fd->timeout_ev);
 }
 
 /*
  * comm_setflush() - set a flush function
  *
- * A flush function is simply a function called if found during
- * comm_timeouts(). Its basically a second timeout, except in this case
+ * A flush function is simply a function called once its timeout
+ * expires. Its basically a second timeout, except in this case
  * I'm too lazy to implement multiple timeout functions! :-)
  * its kinda nice to have it separate, since this is designed for
  * flush functions, and when comm_close() is implemented correctly
@@ -379,54 +426,17 @@ comm_setflush(fde_t *fd, uintmax_t timeout, void (*callback)(fde_t *, void *), v
 {
   assert(fd->flags.open);
 
-  fd->flush_timeout = CurrentTime + (timeout / 1000);
   fd->flush_handler = callback;
   fd->flush_data = cbdata;
-}
 
-/*
- * comm_checktimeouts() - check the socket timeouts
- *
- * All this routine does is call the given callback/cbdata, without closing
- * down the file descriptor. When close handlers have been implemented,
- * this will happen.
- */
-void
-comm_checktimeouts(void *unused)
-{
-  fde_t *F;
-  void (*hdl)(fde_t *, void *);
-  void *data;
-
-  for (unsigned int i = 0; i < FD_HASH_SIZE; i++)
+  if (callback)
   {
-    for (F = fd_hash[i]; F != NULL; F = fd_next_in_loop)
-    {
-      assert(F->flags.open);
-      fd_next_in_loop = F->hnext;
-
-      /* check flush functions */
-      if (F->flush_handler && F->flush_timeout > 0 &&
-          F->flush_timeout < CurrentTime)
-      {
-        hdl = F->flush_handler;
-        data = F->flush_data;
-        comm_setflush(F, 0, NULL, NULL);
-        hdl(F, data);
-      }
-
-      /* check timeouts */
-      if (F->timeout_handler && F->timeout > 0 &&
-          F->timeout < CurrentTime)
-      {
-        /* Call timeout handler */
-        hdl = F->timeout_handler;
-        data = F->timeout_data;
-        comm_settimeout(F, 0, NULL, NULL);
-        hdl(F, data);
-      }
-    }
+    fd->flush_ev.handler = comm_flush_expire;
+    fd->flush_ev.oneshot = 1;
+    event_add_ms(&fd->flush_ev, timeout, fd);
   }
+  else
+    event_delete(&fd->flush_ev);
 }
 
 /*
@@ -688,7 +698,7 @@ comm_accept(fde_t *F, struct irc_ssaddr *addr)
    * reserved fd limit, but we can deal with that when comm_open()
    * also does it. XXX -- adrian
    */
-  int fd = accept(F->fd, (struct sockaddr *)addr, &addrlen);
+  int fd = netio_accept(F, addr, &addrlen);
   if (fd < 0)
     return -1;
 
@@ -700,6 +710,32 @@ comm_accept(fde_t *F, struct irc_ssaddr *addr)
   return fd;
 }
 
+/* comm_fill_iovec()
+ *
+ * inputs	- pointer to dbuf queue
+ *		- iovec array to fill
+ *		- number of elements in iovec array
+ * output	- number of iovec elements filled in
+ * side effects	- none; the queue is left untouched
+ */
+int
+comm_fill_iovec(const struct dbuf_queue *queue, struct iovec *iov, int iovmax)
+{
+  struct dbuf_iter iter;
+  size_t pos = queue->pos;
+  int count = 0;
+
+  for (struct dbuf_block *block = dbuf_first(queue, &iter); block && count < iovmax;
+       block = dbuf_next(&iter), pos = 0)
+  {
+    iov[count].iov_base = block->data + pos;
+    iov[count].iov_len = block->size - pos;
+    ++count;
+  }
+
+  return count;
+}
+
 /*
  * remove_ipv6_mapping() - Removes IPv4-In-IPv6 mapping from an address
  * OSes with IPv6 mapping listening on both
@@ -729,3 +765,40 @@ remove_ipv6_mapping(struct irc_ssaddr *addr)
   else
     addr->ss_len = sizeof(struct sockaddr_in);
 }
+
+#if USE_IOPOLL_MECHANISM != __IOPOLL_MECHANISM_IO_URING
+/*
+ * Unless the network IO loop code does the socket IO itself, as
+ * s_bsd_uring.c does, these are the plain system calls.
+ */
+int
+netio_accept(fde_t *F, struct irc_ssaddr *addr, socklen_t *addrlen)
+{
+  return accept(F->fd, (struct sockaddr *)addr, addrlen);
+}
+
+ssize_t
+netio_recv(fde_t *F, char *buf, size_t len)
+{
+  return recv(F->fd, buf, len, 0);
+}
+
+/*
+ * netio_writev
+ *
+ * Writes from the head of the queue, which is left untouched. Returns
+ * the number of bytes taken, for the caller to dbuf_delete().
+ */
+ssize_t
+netio_writev(fde_t *F, const struct dbuf_queue *queue)
+{
+  struct iovec iov[COMM_IOV_MAX];
+
+  return writev(F->fd, iov, comm_fill_iovec(queue, iov, COMM_IOV_MAX));
+}
+
+void
+netio_close(fde_t *F)
+{
+}
+#endif
@@ -40,6 +40,7 @@
 #include "fdlist.h"
 #include "ircd.h"
 #include "s_bsd.h"
+#include "event.h"
 #include "log.h"
 
 static fde_t dpfd;
@@ -115,11 +116,7 @@ comm_setselect(fde_t *F, unsigned int type, void (*handler)(fde_t *, void *),
     (F->write_handler ? POLLOUT : 0);
 
   if (timeout != 0)
-  {
-    F->timeout = CurrentTime + (timeout / 1000);
-    F->timeout_handler = handler;
-    F->timeout_data = client_data;
-  }
+    comm_settimeout(F, timeout, handler, client_data);
 
   if (new_events != F->evcache)
   {
@@ -146,7 +143,7 @@ comm_select(void)
   void (*hdl)(fde_t *, void *);
   fde_t *F;
 
-  dopoll.dp_timeout = SELECT_DELAY;
+  dopoll.dp_timeout = event_next_delay(SELECT_DELAY);
   dopoll.dp_nfds = 128;
   dopoll.dp_fds = &pollfds[0];
   num = ioctl(dpfd.fd, DP_POLL, &dopoll);
@@ -25,15 +25,40 @@
  */
 
 #include "stdinc.h"
-#if USE_IOPOLL_MECHANISM == __IOPOLL_MECHANISM_EPOLL
+#if USE_IOPOLL_MECHANISM == __IOPOLL_MECHANISM_EPOLL || \
+    USE_IOPOLL_MECHANISM == __IOPOLL_MECHANISM_IO_URING
 #include "fdlist.h"
 #include "ircd.h"
 #include "s_bsd.h"
+#include "event.h"
 #include "log.h"
+#include "memory.h"
 #include <sys/epoll.h>
 #include <sys/syscall.h>
 
+#if USE_IOPOLL_MECHANISM == __IOPOLL_MECHANISM_IO_URING
+/* Built as the runtime fallback of s_bsd_uring.c */
+#define netio_init epoll_netio_init
+#define comm_setselect epoll_comm_setselect
+#define comm_select epoll_comm_select
+#endif
+
 static fde_t efd;
+static struct epoll_event *ep_fdlist;
+
+#ifdef USE_EPOLL_ET
+/* fde_t::evready flag: descriptor is already queued on ep_pending */
+enum { COMM_SELECT_PENDING = 4 };
+
+/*
+ * Descriptors that had an edge reported while no handler was armed for it.
+ * The edge won't be reported again, so they are dispatched by comm_select()
+ * as soon as a handler for the ready direction has been set.
+ */
+static int *ep_pending;
+static unsigned int ep_pending_count;
+static unsigned int ep_pending_size;
+#endif
 
 
 /*
@@ -55,7 +80,44 @@ netio_init(void)
   }
 
   fd_open(&efd, fd, 0, "epoll file descriptor");
+
+  ep_fdlist = xcalloc(sizeof(*ep_fdlist) * EPOLL_MAX_EVENTS);
+#ifdef USE_EPOLL_ET
+  ep_pending_size = hard_fdlimit;
+  ep_pending = xcalloc(sizeof(*ep_pending) * ep_pending_size);
+#endif
+}
+
+#ifdef USE_EPOLL_ET
+/*
+ * comm_select_dispatch
+ *
+ * Calls the read and/or write handler of a descriptor for the directions
+ * which have been reported ready. A ready direction without an armed
+ * handler stays ready until a handler is set via comm_setselect().
+ */
+static void
+comm_select_dispatch(fde_t *F)
+{
+  void (*hdl)(fde_t *, void *);
+
+  if ((F->evready & COMM_SELECT_READ) && (hdl = F->read_handler))
+  {
+    F->evready &= ~COMM_SELECT_READ;
+    F->read_handler = NULL;
+    hdl(F, F->read_data);
+    if (!F->flags.open)
+      return;
+  }
+
+  if ((F->evready & COMM_SELECT_WRITE) && (hdl = F->write_handler))
+  {
+    F->evready &= ~COMM_SELECT_WRITE;
+    F->write_handler = NULL;
+    hdl(F, F->write_data);
+  }
 }
+#endif
 
 /*
  * comm_setselect
@@ -67,7 +129,6 @@ void
 comm_setselect(fde_t *F, unsigned int type, void (*handler)(fde_t *, void *),
                void *client_data, uintmax_t timeout)
 {
-  int new_events, op;
   struct epoll_event ep_event = { 0, { 0 } };
 
   if ((type & COMM_SELECT_READ))
@@ -82,16 +143,60 @@ comm_setselect(fde_t *F, unsigned int type, void (*handler)(fde_t *, void *),
     F->write_data = client_data;
   }
 
-  new_events = (F->read_handler ? EPOLLIN : 0) |
-    (F->write_handler ? EPOLLOUT : 0);
-
   if (timeout != 0)
+    comm_settimeout(F, timeout, handler, client_data);
+
+#ifdef USE_EPOLL_ET
+  /*
+   * In edge-triggered mode a descriptor is registered for both read and
+   * write events once, when the first handler is set. It stays registered
+   * until close() drops it from the epoll set, so arming and disarming
+   * handlers never needs an epoll_ctl() call.
+   *
+   * Listeners are the exception. listener_accept_connection() stops
+   * short of EAGAIN at the descriptor limit, and the rest of the
+   * backlog wouldn't be reported again until another connection
+   * arrives, so they are watched for input level-triggered.
+   */
+  if (F->evcache == 0)
   {
-    F->timeout = CurrentTime + (timeout / 1000);
-    F->timeout_handler = handler;
-    F->timeout_data = client_data;
+    if (F->read_handler == NULL && F->write_handler == NULL)
+      return;
+
+    if ((type & COMM_SELECT_ACCEPT))
+      ep_event.events = F->evcache = EPOLLIN;
+    else
+      ep_event.events = F->evcache = EPOLLIN | EPOLLOUT | EPOLLET;
+    ep_event.data.fd = F->fd;
+
+    if (epoll_ctl(efd.fd, EPOLL_CTL_ADD, F->fd, &ep_event) != 0 &&
+        (errno != EEXIST || epoll_ctl(efd.fd, EPOLL_CTL_MOD, F->fd, &ep_event) != 0))
+    {
+      ilog(LOG_TYPE_IRCD, "comm_setselect: epoll_ctl() failed: %s", strerror(errno));
+      abort();
+    }
   }
 
+  if (F->evready & COMM_SELECT_PENDING)
+    return;
+
+  if (((F->evready & COMM_SELECT_READ) && F->read_handler) ||
+      ((F->evready & COMM_SELECT_WRITE) && F->write_handler))
+  {
+    if (ep_pending_count == ep_pending_size)
+    {
+      ep_pending_size *= 2;
+      ep_pending = xrealloc(ep_pending, sizeof(*ep_pending) * ep_pending_size);
+    }
+
+    F->evready |= COMM_SELECT_PENDING;
+    ep_pending[ep_pending_count++] = F->fd;
+  }
+#else
+  int op;
+  int new_events = (F->read_handler ? EPOLLIN : 0) |
+    (F->write_handler ? EPOLLOUT : 0);
+
   if (new_events != F->evcache)
   {
     if (new_events == 0)
@@ -110,6 +215,7 @@ comm_setselect(fde_t *F, unsigned int type, void (*handler)(fde_t *, void *),
       abort();
     }
   }
+#endif
 }
 
 /*
@@ -123,12 +229,17 @@ comm_setselect(fde_t *F, unsigned int type, void (*handler)(fde_t *, void *),
 void
 comm_select(void)
 {
-  struct epoll_event ep_fdlist[128];
   int num, i;
-  void (*hdl)(fde_t *, void *);
   fde_t *F;
+#ifndef USE_EPOLL_ET
+  void (*hdl)(fde_t *, void *);
+#endif
 
-  num = epoll_wait(efd.fd, ep_fdlist, 128, SELECT_DELAY);
+#ifdef USE_EPOLL_ET
+  num = epoll_wait(efd.fd, ep_fdlist, EPOLL_MAX_EVENTS, ep_pending_count ? 0 : event_next_delay(SELECT_DELAY));
+#else
+  num = epoll_wait(efd.fd, ep_fdlist, EPOLL_MAX_EVENTS, event_next_delay(SELECT_DELAY));
+#endif
 
   set_time();
 
@@ -145,6 +256,14 @@ comm_select(void)
     if (F == NULL || !F->flags.open)
       continue;
 
+#ifdef USE_EPOLL_ET
+    if ((ep_fdlist[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+      F->evready |= COMM_SELECT_READ;
+    if ((ep_fdlist[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)))
+      F->evready |= COMM_SELECT_WRITE;
+
+    comm_select_dispatch(F);
+#else
     if ((ep_fdlist[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
     {
       if ((hdl = F->read_handler))
@@ -168,6 +287,22 @@ comm_select(void)
     }
 
     comm_setselect(F, 0, NULL, NULL, 0);
+#endif
   }
+
+#ifdef USE_EPOLL_ET
+  /* Handlers may queue further descriptors while this list is walked */
+  for (unsigned int j = 0; j < ep_pending_count; ++j)
+  {
+    F = lookup_fd(ep_pending[j]);
+    if (F == NULL || !F->flags.open || !(F->evready & COMM_SELECT_PENDING))
+      continue;
+
+    F->evready &= ~COMM_SELECT_PENDING;
+    comm_select_dispatch(F);
+  }
+
+  ep_pending_count = 0;
+#endif
 }
 #endif
@@ -30,6 +30,7 @@
 #include "fdlist.h"
 #include "ircd.h"
 #include "s_bsd.h"
+#include "event.h"
 #include "log.h"
 
 enum { KE_LENGTH = 128 };
@@ -108,11 +109,7 @@ comm_setselect(fde_t *F, unsigned int type, void (*handler)(fde_t *, void *),
                (F->write_handler ? COMM_SELECT_WRITE : 0);
 
   if (timeout != 0)
-  {
-    F->timeout = CurrentTime + (timeout / 1000);
-    F->timeout_handler = handler;
-    F->timeout_data = client_data;
-  }
+    comm_settimeout(F, timeout, handler, client_data);
 
   diff = new_events ^ F->evcache;
 
@@ -149,7 +146,7 @@ comm_select(void)
    *   -- Adrian
    */
   poll_time.tv_sec = 0;
-  poll_time.tv_nsec = SELECT_DELAY * 1000000;
+  poll_time.tv_nsec = event_next_delay(SELECT_DELAY) * 1000000;
   num = kevent(kqfd.fd, kq_fdlist, kqoff, ke, KE_LENGTH, &poll_time);
   kqoff = 0;
 
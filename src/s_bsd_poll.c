@@ -32,6 +32,7 @@
 #include "memory.h"
 #include "ircd.h"
 #include "s_bsd.h"
+#include "event.h"
 #include "log.h"
 
 /* I hate linux -- adrian */
@@ -88,11 +89,7 @@ comm_setselect(fde_t *F, unsigned int type, void (*handler)(fde_t *, void *),
                (F->write_handler ? POLLWRNORM : 0);
 
   if (timeout != 0)
-  {
-    F->timeout = CurrentTime + (timeout / 1000);
-    F->timeout_handler = handler;
-    F->timeout_data = client_data;
-  }
+    comm_settimeout(F, timeout, handler, client_data);
 
   if (new_events != F->evcache)
   {
@@ -150,7 +147,7 @@ comm_select(void)
   void (*hdl)(fde_t *, void *);
   fde_t *F;
 
-  num = poll(pollfds, pollnum, SELECT_DELAY);
+  num = poll(pollfds, pollnum, event_next_delay(SELECT_DELAY));
 
   set_time();
 
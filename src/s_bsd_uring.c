@@ -0,0 +1,1066 @@
+/*
+ *  ircd-hybrid: an advanced, lightweight Internet Relay Chat Daemon (ircd)
+ *
+ *  Copyright (c) 2017 ircd-hybrid development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ *  USA
+ */
+
+/*! \file s_bsd_uring.c
+ * \brief Linux io_uring compatible network routines.
+ * \version $Id$
+ */
+
+#include "stdinc.h"
+#if USE_IOPOLL_MECHANISM == __IOPOLL_MECHANISM_IO_URING
+#include "list.h"
+#include "fdlist.h"
+#include "ircd.h"
+#include "s_bsd.h"
+#include "dbuf.h"
+#include "event.h"
+#include "log.h"
+#include "memory.h"
+#include "mempool.h"
+#include "misc.h"
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * Descriptors registered with COMM_SELECT_ACCEPT or COMM_SELECT_RECV
+ * don't wait for readiness; the kernel does the I/O for them:
+ *
+ *  - a listener keeps a multishot IORING_OP_ACCEPT armed, and accepted
+ *    descriptors are queued until comm_accept() takes them
+ *  - a connection keeps a multishot IORING_OP_RECV armed, which picks a
+ *    buffer from a ring registered with the kernel. netio_recv() copies
+ *    the data straight out of the buffer and hands it back. A descriptor
+ *    holds on to at most URING_HELD_MAX buffers; should its handler not
+ *    take the data right away, the rest is queued on the side so the
+ *    ring doesn't run dry.
+ *  - netio_writev() submits up to COMM_IOV_MAX sendq blocks as a chain
+ *    of linked IORING_OP_SEND requests. All but the last skip their
+ *    completion on success, so a chain posts a single completion unless
+ *    it breaks; one request stands for the chain and holds a reference
+ *    to its blocks. There is one chain in flight per descriptor; write
+ *    interest then waits for it to complete rather than for POLLOUT.
+ *
+ * Anything else is watched with one-shot IORING_OP_POLL_ADD requests,
+ * with fde_t::evcache holding the armed poll mask.
+ *
+ * Requests are only queued; everything queued during a loop iteration
+ * is handed to the kernel by the single io_uring_enter() call that also
+ * waits for and harvests completions. The user_data of a request is its
+ * struct uring_req. Requests a descriptor no longer wants are cancelled
+ * and their completions ignored.
+ */
+
+enum
+{
+  URING_BUF_GROUP = 0,
+  URING_BUF_COUNT = 256,  /* Provided receive buffers; a power of two */
+  URING_BUF_SIZE = 16384,
+  URING_HELD_MAX = 4,  /* Provided buffers a descriptor may hold on to */
+  URING_POOL_CHUNK_SIZE = 16 * 1024
+};
+
+enum uring_op
+{
+  URING_POLL,
+  URING_ACCEPT,
+  URING_RECV,
+  URING_SEND
+};
+
+struct uring_req
+{
+  dlink_node node;  /* Link in netio_fd::reqs, or in uring_released */
+  struct netio_fd *io;  /* NULL once dropped by the descriptor */
+  enum uring_op op;
+  int cancelled;  /* A cancellation referring to the request was queued */
+  struct dbuf_queue sent;  /* Blocks of a send chain */
+  unsigned int len;  /* Length of the last send of a chain */
+};
+
+/* Received data waiting in a provided buffer */
+struct uring_held
+{
+  unsigned int bid;
+  unsigned int len;
+};
+
+struct netio_fd
+{
+  fde_t *F;
+  dlink_node node;  /* Link in uring_pending */
+  dlink_list reqs;  /* Requests in flight */
+  struct uring_req *poll;  /* Poll armed for fde_t::evcache */
+  struct uring_req *multishot;  /* Multishot accept or receive armed */
+  unsigned int mode;  /* COMM_SELECT_ACCEPT or COMM_SELECT_RECV, once asked for */
+  int sending;  /* A send chain is in flight */
+  int send_error;  /* errno of the first send that failed */
+  int recv_error;  /* errno the multishot receive ended with, -1 on EOF */
+  int pending;  /* On uring_pending */
+  struct uring_held held[URING_HELD_MAX];  /* Data waiting for netio_recv(), oldest first */
+  unsigned int held_count;
+  unsigned int held_pos;  /* Bytes of the first buffer already taken */
+  struct dbuf_queue received;  /* Data waiting for netio_recv() after the held buffers */
+  int *accepted;  /* Descriptors waiting for comm_accept() */
+  unsigned int accepted_count;
+  unsigned int accepted_size;
+};
+
+static int uring_fd = -1;
+
+static unsigned int *sq_head;
+static unsigned int *sq_tail;
+static unsigned int *sq_array;
+static unsigned int sq_mask;
+static unsigned int sq_entries;
+static unsigned int sq_local_tail;
+static struct io_uring_sqe *sqes;
+
+static unsigned int *cq_head;
+static unsigned int *cq_tail;
+static unsigned int cq_mask;
+static struct io_uring_cqe *cqes;
+
+static struct io_uring_buf_ring *buf_ring;
+static char *buf_data;
+static unsigned short buf_tail;
+
+static mp_pool_t *uring_req_pool;
+static mp_pool_t *uring_io_pool;
+static dlink_list uring_released;  /* Cancelled requests, freed after the next submission */
+static dlink_list uring_pending;  /* Descriptors with input no completion is going to report */
+
+
+static int
+uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+uring_enter(unsigned int to_submit, unsigned int min_complete, unsigned int flags,
+            const void *arg, size_t argsz)
+{
+  return syscall(__NR_io_uring_enter, uring_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/*
+ * uring_submit
+ *
+ * Publishes queued submission entries and hands them to the kernel,
+ * optionally waiting up to 'timeout' milliseconds for a completion.
+ */
+static int
+uring_submit(unsigned int wait, unsigned int timeout)
+{
+  struct __kernel_timespec ts = { .tv_sec = timeout / 1000, .tv_nsec = (timeout % 1000) * 1000000 };
+  struct io_uring_getevents_arg arg = { .ts = (uint64_t)(uintptr_t)&ts };
+
+  __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+
+  unsigned int to_submit = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  if (to_submit == 0 && wait == 0)
+    return 0;
+
+  return uring_enter(to_submit, wait, wait ? IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG : 0,
+                     wait ? &arg : NULL, wait ? sizeof(arg) : 0);
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(void)
+{
+  if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+  {
+    uring_submit(0, 0);
+
+    if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+    {
+      ilog(LOG_TYPE_IRCD, "comm_setselect: io_uring submission queue overrun: %s",
+           strerror(errno));
+      abort();
+    }
+  }
+
+  unsigned int idx = sq_local_tail & sq_mask;
+  struct io_uring_sqe *sqe = &sqes[idx];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array[idx] = idx;
+  ++sq_local_tail;
+
+  return sqe;
+}
+
+static void
+uring_buf_recycle(unsigned int bid)
+{
+  struct io_uring_buf *buf = &buf_ring->bufs[buf_tail & (URING_BUF_COUNT - 1)];
+
+  buf->addr = (uintptr_t)(buf_data + (size_t)bid * URING_BUF_SIZE);
+  buf->len = URING_BUF_SIZE;
+  buf->bid = bid;
+
+  __atomic_store_n(&buf_ring->tail, ++buf_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * uring_init_buffers
+ *
+ * Registers the ring multishot receives pick their buffers from.
+ */
+static int
+uring_init_buffers(void)
+{
+  struct io_uring_buf_reg reg;
+
+  buf_ring = mmap(NULL, URING_BUF_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf_ring == MAP_FAILED)
+    return 0;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uintptr_t)buf_ring;
+  reg.ring_entries = URING_BUF_COUNT;
+  reg.bgid = URING_BUF_GROUP;
+
+  if (syscall(__NR_io_uring_register, uring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+  {
+    munmap(buf_ring, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+    return 0;
+  }
+
+  buf_data = xcalloc(URING_BUF_COUNT * URING_BUF_SIZE);
+
+  for (unsigned int bid = 0; bid < URING_BUF_COUNT; ++bid)
+    uring_buf_recycle(bid);
+
+  return 1;
+}
+
+/*
+ * uring_probe_recv
+ *
+ * There is no feature flag for multishot receives (Linux 6.0), so one is
+ * tried on a socket pair.
+ */
+static int
+uring_probe_recv(void)
+{
+  int sv[2], ret = 0;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    return 0;
+
+  struct io_uring_sqe *sqe = uring_get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = sv[0];
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUF_GROUP;
+
+  if (send(sv[1], "x", 1, 0) == 1 && uring_submit(1, 1000) >= 0)
+  {
+    const unsigned int head = *cq_head;
+
+    if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+      const struct io_uring_cqe *cqe = &cqes[head & cq_mask];
+
+      ret = cqe->res == 1 && (cqe->flags & IORING_CQE_F_MORE);
+
+      if ((cqe->flags & IORING_CQE_F_BUFFER))
+        uring_buf_recycle(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+      __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    }
+  }
+
+  /* Ends the receive, if still armed; its user_data is 0, so comm_select() ignores it */
+  shutdown(sv[0], SHUT_RDWR);
+  close(sv[0]);
+  close(sv[1]);
+  return ret;
+}
+
+/*
+ * uring_init
+ *
+ * Sets up the rings. Returns 0 if io_uring is unavailable or lacks one of
+ * the features this backend relies on, in which case the caller falls
+ * back to epoll.
+ */
+static int
+uring_init(void)
+{
+  struct io_uring_params p;
+  unsigned int entries = 1;
+
+  /*
+   * Entries are only batched up; should a loop iteration queue more than
+   * that, uring_get_sqe() submits them early
+   */
+  while (entries < (unsigned int)hard_fdlimit && entries < 32768)
+    entries <<= 1;
+
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = entries * 2;
+
+  if ((uring_fd = uring_setup(entries, &p)) < 0)
+  {
+    ilog(LOG_TYPE_IRCD, "netio_init: io_uring_setup() failed: %s", strerror(errno));
+    return 0;
+  }
+
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(p.features & IORING_FEAT_NODROP) ||
+      !(p.features & IORING_FEAT_EXT_ARG) ||
+      !(p.features & IORING_FEAT_CQE_SKIP))
+  {
+    ilog(LOG_TYPE_IRCD, "netio_init: kernel io_uring lacks required features");
+    close(uring_fd);
+    return 0;
+  }
+
+  size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  size_t ring_size = IRCD_MAX(sq_size, cq_size);
+
+  char *ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    uring_fd, IORING_OFF_SQ_RING);
+  if (ring == MAP_FAILED)
+  {
+    ilog(LOG_TYPE_IRCD, "netio_init: couldn't map io_uring rings: %s", strerror(errno));
+    close(uring_fd);
+    return 0;
+  }
+
+  sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, uring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+  {
+    ilog(LOG_TYPE_IRCD, "netio_init: couldn't map io_uring sqes: %s", strerror(errno));
+    munmap(ring, ring_size);
+    close(uring_fd);
+    return 0;
+  }
+
+  sq_head = (unsigned int *)(ring + p.sq_off.head);
+  sq_tail = (unsigned int *)(ring + p.sq_off.tail);
+  sq_array = (unsigned int *)(ring + p.sq_off.array);
+  sq_mask = *(unsigned int *)(ring + p.sq_off.ring_mask);
+  sq_entries = p.sq_entries;
+  sq_local_tail = *sq_tail;
+
+  cq_head = (unsigned int *)(ring + p.cq_off.head);
+  cq_tail = (unsigned int *)(ring + p.cq_off.tail);
+  cq_mask = *(unsigned int *)(ring + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+  if (!uring_init_buffers() || !uring_probe_recv())
+  {
+    ilog(LOG_TYPE_IRCD, "netio_init: kernel io_uring lacks multishot receives");
+    munmap(sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+    munmap(ring, ring_size);
+    close(uring_fd);
+    return 0;
+  }
+
+  uring_req_pool = mp_pool_new(sizeof(struct uring_req), URING_POOL_CHUNK_SIZE);
+  uring_io_pool = mp_pool_new(sizeof(struct netio_fd), URING_POOL_CHUNK_SIZE);
+  return 1;
+}
+
+static struct netio_fd *
+uring_io(fde_t *F)
+{
+  if (F->netio == NULL)
+  {
+    F->netio = mp_pool_get(uring_io_pool);
+    F->netio->F = F;
+  }
+
+  return F->netio;
+}
+
+static struct uring_req *
+uring_req_new(struct netio_fd *io, enum uring_op op, struct io_uring_sqe *sqe)
+{
+  struct uring_req *req = mp_pool_get(uring_req_pool);
+
+  req->io = io;
+  req->op = op;
+  dlinkAdd(req, &req->node, &io->reqs);
+
+  sqe->user_data = (uintptr_t)req;
+  return req;
+}
+
+/*
+ * uring_req_drop
+ *
+ * Detaches a request from its descriptor and queues its cancellation.
+ */
+static void
+uring_req_drop(struct uring_req *req)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe();
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = (uintptr_t)req;
+
+  dlinkDelete(&req->node, &req->io->reqs);
+  req->io = NULL;
+  req->cancelled = 1;
+}
+
+/*
+ * uring_req_free
+ *
+ * Frees a request that won't complete again.
+ */
+static void
+uring_req_free(struct uring_req *req)
+{
+  if (req->io)
+    dlinkDelete(&req->node, &req->io->reqs);
+
+  dbuf_clear(&req->sent);
+
+  /* Don't hand out the address again while a queued cancellation refers to it */
+  if (req->cancelled)
+    dlinkAdd(req, &req->node, &uring_released);
+  else
+    mp_pool_release(req);
+}
+
+static void
+uring_poll_add(struct netio_fd *io, int events)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe();
+
+  io->F->evcache = events;
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = io->F->fd;
+#ifdef WORDS_BIGENDIAN
+  sqe->poll32_events = ((unsigned int)events << 16) | ((unsigned int)events >> 16);
+#else
+  sqe->poll32_events = events;
+#endif
+  io->poll = uring_req_new(io, URING_POLL, sqe);
+}
+
+static void
+uring_multishot_add(struct netio_fd *io)
+{
+  struct io_uring_sqe *sqe = uring_get_sqe();
+
+  sqe->fd = io->F->fd;
+
+  if ((io->mode & COMM_SELECT_ACCEPT))
+  {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    io->multishot = uring_req_new(io, URING_ACCEPT, sqe);
+  }
+  else
+  {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    io->multishot = uring_req_new(io, URING_RECV, sqe);
+  }
+}
+
+/* Whether there is input for the read handler that was already reported */
+static int
+uring_has_input(const struct netio_fd *io)
+{
+  return io->accepted_count || io->held_count || dbuf_length(&io->received) || io->recv_error;
+}
+
+/*
+ * uring_hold
+ *
+ * Leaves received data in its provided buffer for netio_recv(), or
+ * queues a copy if the descriptor holds enough buffers already.
+ */
+static void
+uring_hold(struct netio_fd *io, unsigned int bid, unsigned int len)
+{
+  if (io->held_count < URING_HELD_MAX && dbuf_length(&io->received) == 0)
+  {
+    io->held[io->held_count].bid = bid;
+    io->held[io->held_count].len = len;
+    ++io->held_count;
+    return;
+  }
+
+  dbuf_put(&io->received, buf_data + (size_t)bid * URING_BUF_SIZE, len);
+  uring_buf_recycle(bid);
+}
+
+/*
+ * uring_arm
+ *
+ * Makes the requests in flight for a descriptor match its handlers.
+ */
+static void
+uring_arm(fde_t *F)
+{
+  struct netio_fd *const io = F->netio;
+  int events = 0;
+
+  if (F->read_handler)
+  {
+    if (io->mode == 0)
+      events |= POLLIN;
+    else
+    {
+      if (io->multishot == NULL && io->recv_error == 0)
+        uring_multishot_add(io);
+
+      /*
+       * Input the handler left alone is reported again on the next loop
+       * iteration, as a level-triggered poll would
+       */
+      if (!io->pending && uring_has_input(io))
+      {
+        io->pending = 1;
+        dlinkAddTail(io, &io->node, &uring_pending);
+      }
+    }
+  }
+
+  if (F->write_handler && io->sending == 0)
+    events |= POLLOUT;
+
+  /*
+   * A poll that watches more than we currently need is left in place;
+   * a completion for a direction without a handler is simply re-armed.
+   * It must be cancelled when all interest is dropped though, as the
+   * pending request holds a reference to the socket.
+   */
+  if (events && (events & ~F->evcache) == 0)
+    return;
+
+  if (io->poll)
+  {
+    uring_req_drop(io->poll);
+    io->poll = NULL;
+    F->evcache = 0;
+  }
+
+  if (events)
+    uring_poll_add(io, events);
+}
+
+/*
+ * netio_init
+ *
+ * This is a needed exported function which will be called to initialise
+ * the network loop code.
+ */
+void
+netio_init(void)
+{
+  if (uring_init())
+    return;
+
+  ilog(LOG_TYPE_IRCD, "netio_init: io_uring unavailable, falling back to epoll");
+  uring_fd = -1;
+  epoll_netio_init();
+}
+
+int
+netio_accept(fde_t *F, struct irc_ssaddr *addr, socklen_t *addrlen)
+{
+  struct netio_fd *const io = F->netio;
+
+  if (io == NULL)
+    return accept(F->fd, (struct sockaddr *)addr, addrlen);
+
+  while (io->accepted_count)
+  {
+    const int fd = io->accepted[0];
+    socklen_t len = *addrlen;
+
+    --io->accepted_count;
+    memmove(io->accepted, io->accepted + 1, io->accepted_count * sizeof(int));
+
+    /* The peer may have given up already */
+    if (getpeername(fd, (struct sockaddr *)addr, &len) == 0)
+    {
+      *addrlen = len;
+      return fd;
+    }
+
+    close(fd);
+  }
+
+  if (io->multishot)
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  return accept(F->fd, (struct sockaddr *)addr, addrlen);
+}
+
+ssize_t
+netio_recv(fde_t *F, char *buf, size_t len)
+{
+  struct netio_fd *const io = F->netio;
+
+  if (io == NULL)
+    return recv(F->fd, buf, len, 0);
+
+  size_t count = 0;
+
+  while (count < len && io->held_count)
+  {
+    const struct uring_held *held = &io->held[0];
+    size_t avail = held->len - io->held_pos;
+
+    if (avail > len - count)
+      avail = len - count;
+
+    memcpy(buf + count, buf_data + (size_t)held->bid * URING_BUF_SIZE + io->held_pos, avail);
+    count += avail;
+    io->held_pos += avail;
+
+    if (io->held_pos == held->len)
+    {
+      uring_buf_recycle(held->bid);
+
+      --io->held_count;
+      memmove(io->held, io->held + 1, io->held_count * sizeof(*io->held));
+      io->held_pos = 0;
+    }
+  }
+
+  while (count < len && dbuf_length(&io->received))
+  {
+    const struct dbuf_block *block = dbuf_head(&io->received);
+    size_t avail = block->size - io->received.pos;
+
+    if (avail > len - count)
+      avail = len - count;
+
+    memcpy(buf + count, block->data + io->received.pos, avail);
+    dbuf_delete(&io->received, avail);
+    count += avail;
+  }
+
+  if (count)
+    return count;
+
+  if (io->recv_error)
+  {
+    if (io->recv_error < 0)
+      return 0;
+
+    errno = io->recv_error;
+    return -1;
+  }
+
+  if (io->multishot)
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  return recv(F->fd, buf, len, 0);
+}
+
+/*
+ * netio_writev
+ *
+ * Submits the head of the queue as a chain of linked sends. Returns the
+ * number of bytes taken, for the caller to dbuf_delete(), or -1 with
+ * errno EAGAIN while the previous chain is still in flight.
+ */
+ssize_t
+netio_writev(fde_t *F, const struct dbuf_queue *queue)
+{
+  if (uring_fd < 0)
+  {
+    struct iovec iov[COMM_IOV_MAX];
+    return writev(F->fd, iov, comm_fill_iovec(queue, iov, COMM_IOV_MAX));
+  }
+
+  struct netio_fd *const io = uring_io(F);
+
+  if (io->send_error)
+  {
+    errno = io->send_error;
+    return -1;
+  }
+
+  if (io->sending)
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  struct dbuf_queue sent = { .total_size = 0 };
+  struct dbuf_iter iter;
+  struct dbuf_block *block;
+  unsigned int count = 0;
+  size_t pos = queue->pos;
+  ssize_t total = 0;
+
+  for (block = dbuf_first(queue, &iter); block && count < COMM_IOV_MAX; block = dbuf_next(&iter))
+    ++count;
+
+  /* A chain must not be split over two submissions */
+  if (sq_entries - (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE)) < count)
+    uring_submit(0, 0);
+
+  block = dbuf_first(queue, &iter);
+
+  for (unsigned int i = 0; i < count; ++i, block = dbuf_next(&iter), pos = 0)
+  {
+    struct io_uring_sqe *sqe = uring_get_sqe();
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = F->fd;
+    sqe->addr = (uintptr_t)(block->data + pos);
+    sqe->len = block->size - pos;
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+
+    dbuf_add(&sent, block);
+    total += sqe->len;
+
+    /*
+     * A send that fails breaks the chain, and the rest complete with
+     * -ECANCELED; the last one thus always completes, and does so last
+     */
+    if (i + 1 < count)
+      sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+    else
+    {
+      struct uring_req *req = uring_req_new(io, URING_SEND, sqe);
+
+      dbuf_move(&req->sent, &sent);
+      req->len = sqe->len;
+    }
+  }
+
+  io->sending = 1;
+  return total;
+}
+
+/*
+ * netio_close
+ *
+ * Called by fd_close() right before the socket is closed.
+ */
+void
+netio_close(fde_t *F)
+{
+  struct netio_fd *const io = F->netio;
+  dlink_node *node, *node_next;
+
+  if (io == NULL)
+    return;
+
+  /*
+   * Requests queued for the socket, such as the sends of a final flush,
+   * have to reach the kernel while its number still refers to it
+   */
+  if (sq_local_tail != __atomic_load_n(sq_head, __ATOMIC_ACQUIRE))
+    uring_submit(0, 0);
+
+  DLINK_FOREACH_SAFE(node, node_next, io->reqs.head)
+    uring_req_drop(node->data);
+
+  while (io->accepted_count)
+    close(io->accepted[--io->accepted_count]);
+
+  xfree(io->accepted);
+
+  while (io->held_count)
+    uring_buf_recycle(io->held[--io->held_count].bid);
+
+  dbuf_clear(&io->received);
+
+  if (io->pending)
+    dlinkDelete(&io->node, &uring_pending);
+
+  F->netio = NULL;
+  mp_pool_release(io);
+}
+
+/*
+ * comm_setselect
+ *
+ * This is a needed exported function which will be called to register
+ * and deregister interest in a pending IO state for a given FD.
+ */
+void
+comm_setselect(fde_t *F, unsigned int type, void (*handler)(fde_t *, void *),
+               void *client_data, uintmax_t timeout)
+{
+  if (uring_fd < 0)
+  {
+    epoll_comm_setselect(F, type, handler, client_data, timeout);
+    return;
+  }
+
+  if ((type & COMM_SELECT_READ))
+  {
+    F->read_handler = handler;
+    F->read_data = client_data;
+  }
+
+  if ((type & COMM_SELECT_WRITE))
+  {
+    F->write_handler = handler;
+    F->write_data = client_data;
+  }
+
+  if (timeout != 0)
+    comm_settimeout(F, timeout, handler, client_data);
+
+  if (F->netio == NULL && F->read_handler == NULL && F->write_handler == NULL)
+    return;
+
+  struct netio_fd *const io = uring_io(F);
+
+  /* Once a descriptor has the kernel do its reads, it keeps doing so */
+  if ((type & COMM_SELECT_READ) && handler)
+    io->mode |= type & (COMM_SELECT_ACCEPT | COMM_SELECT_RECV);
+
+  uring_arm(F);
+}
+
+/*
+ * uring_complete
+ *
+ * Handles the completion of a request. Returns the poll events to
+ * dispatch to the handlers of its descriptor.
+ */
+static int
+uring_complete(struct uring_req *req, int res, unsigned int flags)
+{
+  struct netio_fd *const io = req->io;
+  int revents = 0;
+
+  switch (req->op)
+  {
+    case URING_POLL:
+      if (io)
+      {
+        io->poll = NULL;
+        io->F->evcache = 0;
+
+        revents = res < 0 ? POLLERR : res;
+
+        /* Reads of a descriptor in the kernel's hands are reported by their own requests */
+        if (io->mode)
+          revents &= ~POLLIN;
+      }
+
+      break;
+    case URING_ACCEPT:
+      if (io == NULL)
+      {
+        if (res >= 0)
+          close(res);
+        break;
+      }
+
+      if (res >= 0)
+      {
+        if (io->accepted_count == io->accepted_size)
+        {
+          io->accepted_size = io->accepted_size ? io->accepted_size * 2 : 16;
+          io->accepted = xrealloc(io->accepted, io->accepted_size * sizeof(int));
+        }
+
+        io->accepted[io->accepted_count++] = res;
+      }
+
+      revents = POLLIN;
+      break;
+    case URING_RECV:
+      if (io == NULL)
+        break;
+
+      if (res == 0)
+        io->recv_error = -1;
+      else if (res < 0 && res != -ENOBUFS)  /* Out of buffers; just re-armed */
+        io->recv_error = -res;
+
+      revents = POLLIN;
+      break;
+    case URING_SEND:
+      if (io == NULL)
+        break;
+
+      /*
+       * Only the last send of a chain completes, unless one before it
+       * failed; that one's completion isn't ours to see, and this one
+       * was cancelled. Anything short of the whole block is an error.
+       */
+      if (res < 0 || (unsigned int)res < req->len)
+        io->send_error = (res < 0 && res != -ECANCELED) ? -res : EPIPE;
+
+      io->sending = 0;
+      revents = POLLOUT;
+
+      break;
+  }
+
+  if (!(flags & IORING_CQE_F_MORE))
+  {
+    if (io && io->multishot == req)
+      io->multishot = NULL;
+
+    uring_req_free(req);
+  }
+
+  return revents;
+}
+
+static void
+uring_dispatch(fde_t *F, int revents)
+{
+  struct netio_fd *const io = F->netio;
+  void (*hdl)(fde_t *, void *);
+
+  if ((revents & (POLLIN | POLLHUP | POLLERR)))
+  {
+    if ((hdl = F->read_handler))
+    {
+      F->read_handler = NULL;
+      hdl(F, F->read_data);
+      if (!F->flags.open || F->netio != io)
+        return;
+    }
+  }
+
+  if ((revents & (POLLOUT | POLLHUP | POLLERR)))
+  {
+    if ((hdl = F->write_handler))
+    {
+      F->write_handler = NULL;
+      hdl(F, F->write_data);
+      if (!F->flags.open || F->netio != io)
+        return;
+    }
+  }
+
+  uring_arm(F);
+}
+
+/*
+ * comm_select()
+ *
+ * Called to do the new-style IO, courtesy of of squid (like most of this
+ * new IO code). This routine handles the stuff we've hidden in
+ * comm_setselect and fd_table[] and calls callbacks for IO ready
+ * events.
+ */
+void
+comm_select(void)
+{
+  dlink_node *node, *node_next;
+
+  if (uring_fd < 0)
+  {
+    epoll_comm_select();
+    return;
+  }
+
+  unsigned int head = *cq_head;
+  unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+  int num = uring_submit(head == tail && uring_pending.head == NULL,
+                         event_next_delay(SELECT_DELAY));
+
+  set_time();
+
+  /* Cancellations referring to these have been submitted now */
+  DLINK_FOREACH_SAFE(node, node_next, uring_released.head)
+  {
+    dlinkDelete(node, &uring_released);
+    mp_pool_release(node->data);
+  }
+
+  if (num < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+  {
+    const struct timespec req = { .tv_sec = 0, .tv_nsec = 50000000 };
+    nanosleep(&req, NULL);  /* Avoid 99% CPU in comm_select */
+    return;
+  }
+
+  /* Only harvest what is there now; handlers may cause new completions */
+  tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+  while (head != tail)
+  {
+    const struct io_uring_cqe *cqe = &cqes[head & cq_mask];
+    struct uring_req *const req = (struct uring_req *)(uintptr_t)cqe->user_data;
+    const int res = cqe->res;
+    const unsigned int flags = cqe->flags;
+
+    __atomic_store_n(cq_head, ++head, __ATOMIC_RELEASE);
+
+    if ((flags & IORING_CQE_F_BUFFER))
+    {
+      const unsigned int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+      if (req && req->io && res > 0)
+        uring_hold(req->io, bid, res);
+      else
+        uring_buf_recycle(bid);
+    }
+
+    /* Cancellations, sends that broke a chain and the like */
+    if (req == NULL)
+      continue;
+
+    fde_t *const F = req->io ? req->io->F : NULL;
+    const int revents = uring_complete(req, res, flags);
+
+    if (F)
+      uring_dispatch(F, revents);
+  }
+
+  /* Bounded, as handlers leaving input alone put their descriptor back */
+  for (unsigned int count = dlink_list_length(&uring_pending); count && uring_pending.head; --count)
+  {
+    struct netio_fd *io = uring_pending.head->data;
+
+    dlinkDelete(&io->node, &uring_pending);
+    io->pending = 0;
+
+    if (uring_has_input(io))
+      uring_dispatch(io->F, POLLIN);
+  }
+}
+#endif
@@ -28,17 +28,31 @@
 #include "list.h"
 #include "send.h"
 #include "channel.h"
+#include "channel_mode.h"
 #include "client.h"
 #include "dbuf.h"
+#include "server.h"
 #include "irc_string.h"
 #include "ircd.h"
 #include "s_bsd.h"
 #include "server_capab.h"
+#include "server_zip.h"
 #include "conf_class.h"
 #include "log.h"
+#include "memory.h"
 
 
+/* Largest amount of sendq data handed to tls_write() at once; one TLS record */
+enum { SENDQ_COALESCE_SIZE = 16384 };
+
+/*
+ * A sendq holding at least this much is written out right away instead
+ * of waiting for send_queued_flush()
+ */
+enum { SENDQ_FLUSH_SIZE = 16384 };
+
 static uintmax_t current_serial;
+static dlink_list flush_list;  /* Clients with data queued since the last flush */
 
 
 /* send_format()
@@ -47,10 +61,11 @@ static uintmax_t current_serial;
  *		- buffer
  *		- format pattern to use
  *		- var args
- * output	- number of bytes formatted output
- * side effects	- modifies sendbuf
+ * output	- buffer holding the message; this may be a smaller
+ *		  block than the one passed in
+ * side effects	- the passed buffer is released if it was replaced
  */
-static void
+static struct dbuf_block *
 send_format(struct dbuf_block *buffer, const char *pattern, va_list args)
 {
   /*
@@ -72,27 +87,38 @@ send_format(struct dbuf_block *buffer, const char *pattern, va_list args)
 
   buffer->data[buffer->size++] = '\r';
   buffer->data[buffer->size++] = '\n';
+
+  /* Queued messages shouldn't pin a full-sized block */
+  return dbuf_shrink(buffer);
 }
 
 /*
- ** send_message
- **      Internal utility which appends given buffer to the sockets
+ ** send_message_parts
+ **      Internal utility which appends given buffer, and the shared
+ **      remainder of the same message if there is one, to the sockets
  **      sendq.
  */
 static void
-send_message(struct Client *to, struct dbuf_block *buf)
+send_message_parts(struct Client *to, struct dbuf_block *buf, struct dbuf_block *tail)
 {
+  struct BurstTask *const burst = to->connection->burst_task;
+  size_t size = buf->size + (tail ? tail->size : 0);
+
   assert(!IsMe(to));
   assert(to != &me);
   assert(MyConnect(to));
 
-  if (dbuf_length(&to->connection->buf_sendq) + buf->size > get_sendq(&to->connection->confs))
+  /* Messages held back during a burst count towards the limit as well */
+  if (burst)
+    size += dbuf_length(&burst->deferred);
+
+  if (dbuf_length(&to->connection->buf_sendq) + size > get_sendq(&to->connection->confs))
   {
     if (IsServer(to))
       sendto_realops_flags(UMODE_SERVNOTICE, L_ALL, SEND_NOTICE,
                            "Max SendQ limit exceeded for %s: %zu > %u",
                            client_get_name(to, HIDE_IP),
-                           (dbuf_length(&to->connection->buf_sendq) + buf->size),
+                           (dbuf_length(&to->connection->buf_sendq) + size),
                            get_sendq(&to->connection->confs));
 
     if (IsClient(to))
@@ -102,7 +128,24 @@ send_message(struct Client *to, struct dbuf_block *buf)
     return;
   }
 
+  /*
+   * While a server is being sent our burst, everything else for it
+   * waits until the burst is done; see server_burst()
+   */
+  if (burst && !burst->generating)
+  {
+    dbuf_add(&burst->deferred, buf);
+    if (tail)
+      dbuf_add(&burst->deferred, tail);
+
+    ++to->connection->send.messages;
+    ++me.connection->send.messages;
+    return;
+  }
+
   dbuf_add(&to->connection->buf_sendq, buf);
+  if (tail)
+    dbuf_add(&to->connection->buf_sendq, tail);
 
   /*
    * Update statistics. The following is slightly incorrect because
@@ -112,7 +155,28 @@ send_message(struct Client *to, struct dbuf_block *buf)
   ++to->connection->send.messages;
   ++me.connection->send.messages;
 
-  send_queued_write(to);
+  /*
+   * Rather than a write per message, the sendq is written once per
+   * I/O loop pass by send_queued_flush()
+   */
+  if (dbuf_length(&to->connection->buf_sendq) >= SENDQ_FLUSH_SIZE)
+    send_queued_write(to);
+  else if (!HasFlag(to, FLAGS_FLUSH))
+  {
+    AddFlag(to, FLAGS_FLUSH);
+    dlinkAddTail(to, &to->connection->flush_node, &flush_list);
+  }
+}
+
+/*
+ ** send_message
+ **      Internal utility which appends given buffer to the sockets
+ **      sendq.
+ */
+static void
+send_message(struct Client *to, struct dbuf_block *buf)
+{
+  send_message_parts(to, buf, NULL);
 }
 
 /* send_message_remote()
@@ -158,11 +222,47 @@ sendq_unblocked(fde_t *fd, void *data)
   send_queued_write(client_p);
 }
 
+/* send_coalesce()
+ *
+ * inputs	- pointer to dbuf queue
+ *		- buffer to copy to
+ *		- size of buffer
+ * output	- number of bytes copied
+ * side effects	- none; the queue is left untouched
+ */
+static size_t
+send_coalesce(const struct dbuf_queue *queue, char *buf, size_t bufsize)
+{
+  struct dbuf_iter iter;
+  size_t len = 0, pos = queue->pos;
+
+  for (const struct dbuf_block *block = dbuf_first(queue, &iter); block;
+       block = dbuf_next(&iter), pos = 0)
+  {
+    size_t avail = block->size - pos;
+
+    if (avail > bufsize - len)
+      avail = bufsize - len;
+
+    memcpy(buf + len, block->data + pos, avail);
+    len += avail;
+
+    if (len == bufsize)
+      break;
+  }
+
+  return len;
+}
+
 /*
  ** send_queued_write
  **      This is called when there is a chance that some output would
  **      be possible. This attempts to empty the send queue as far as
  **      possible, and then if any data is left, a write is rescheduled.
+ **      Plain sockets are flushed with netio_writev() over up to
+ **      COMM_IOV_MAX blocks at a time; for TLS connections queued blocks are coalesced
+ **      into records of up to SENDQ_COALESCE_SIZE bytes.  Compressed
+ **      links write the output of zip_fill() the same way.
  */
 void
 send_queued_write(struct Client *to)
@@ -170,6 +270,13 @@ send_queued_write(struct Client *to)
   int retlen = 0;
   int want_read = 0;
 
+  /* Whatever happens below, there's nothing left to do for a flush */
+  if (HasFlag(to, FLAGS_FLUSH))
+  {
+    DelFlag(to, FLAGS_FLUSH);
+    dlinkDelete(&to->connection->flush_node, &flush_list);
+  }
+
   /*
    ** Once socket is marked dead, we cannot start writing to it,
    ** even if the error is removed...
@@ -178,33 +285,53 @@ send_queued_write(struct Client *to)
     return;  /* no use calling send() now */
 
   /* Next, lets try to write some data */
-  if (dbuf_length(&to->connection->buf_sendq))
+  if (dbuf_length(&to->connection->buf_sendq) ||
+      (to->connection->zip && dbuf_length(&to->connection->zip->sendq)))
   {
+    struct dbuf_queue *queue = &to->connection->buf_sendq;
+
     do
     {
-      const struct dbuf_block *first = to->connection->buf_sendq.blocks.head->data;
+      /* Compressed links are written from the compressor's output */
+      if (to->connection->zip)
+      {
+        if (zip_fill(to) == 0)
+        {
+          dead_link_on_write(to, 0);
+          return;
+        }
+
+        queue = &to->connection->zip->sendq;
+      }
 
       if (tls_isusing(&to->connection->fd.ssl))
       {
-        retlen = tls_write(&to->connection->fd.ssl, first->data + to->connection->buf_sendq.pos,
-                                                    first->size - to->connection->buf_sendq.pos, &want_read);
+        /*
+         * Copy as many queued blocks as fit into one TLS record, instead
+         * of producing a record (and usually a TCP segment) per block.
+         * The buffer address stays the same and its contents only grow
+         * until the write succeeds, as required when a write is retried.
+         */
+        static char buf[SENDQ_COALESCE_SIZE];
+        const size_t len = send_coalesce(queue, buf, sizeof(buf));
+
+        retlen = tls_write(&to->connection->fd.ssl, buf, len, &want_read);
 
         if (want_read)
           return;  /* Retry later, don't register for write events */
       }
       else
-        retlen = send(to->connection->fd.fd, first->data + to->connection->buf_sendq.pos,
-                                             first->size - to->connection->buf_sendq.pos, 0);
+        retlen = netio_writev(&to->connection->fd, queue);
 
       if (retlen <= 0)
         break;
 
-      dbuf_delete(&to->connection->buf_sendq, retlen);
+      dbuf_delete(queue, retlen);
 
       /* We have some data written .. update counters */
       to->connection->send.bytes += retlen;
       me.connection->send.bytes += retlen;
-    } while (dbuf_length(&to->connection->buf_sendq));
+    } while (dbuf_length(queue) || dbuf_length(&to->connection->buf_sendq));
 
     if (retlen < 0 && ignoreErrno(errno))
     {
@@ -219,6 +346,25 @@ send_queued_write(struct Client *to)
       return;
     }
   }
+
+  /* Top up a burst in progress now that there may be room for more */
+  if (to->connection->burst_task && !HasFlag(to, FLAGS_BLOCKED))
+    server_burst_continue(to);
+}
+
+/* send_queued_flush()
+ *
+ * input        - NONE
+ * output       - NONE
+ * side effects - write the sendq of each client which got data queued
+ *                since the last call
+ */
+void
+send_queued_flush(void)
+{
+  /* Writing can queue notices to opers; they get flushed in this pass too */
+  while (flush_list.head)
+    send_queued_write(flush_list.head->data);
 }
 
 /* send_queued_all()
@@ -269,8 +415,8 @@ sendto_one(struct Client *to, const char *pattern, ...)
 
   va_start(args, pattern);
 
-  struct dbuf_block *buffer = dbuf_alloc();
-  send_format(buffer, pattern, args);
+  struct dbuf_block *buffer = dbuf_alloc(IRCD_BUFSIZE);
+  buffer = send_format(buffer, pattern, args);
 
   va_end(args);
 
@@ -279,6 +425,29 @@ sendto_one(struct Client *to, const char *pattern, ...)
   dbuf_ref_free(buffer);
 }
 
+/* sendto_one_queue()
+ *
+ * inputs	- pointer to destination client
+ *		- queue of messages from send_prepare_queue()
+ * output	- NONE
+ * side effects	- the messages are sent and the queue is emptied
+ */
+void
+sendto_one_queue(struct Client *to, struct dbuf_queue *queue)
+{
+  struct dbuf_iter iter;
+
+  for (struct dbuf_block *block = dbuf_first(queue, &iter); block; block = dbuf_next(&iter))
+  {
+    if (IsDead(to->from))
+      break;  /* This socket has already been marked as dead */
+
+    send_message(to->from, block);
+  }
+
+  dbuf_clear(queue);
+}
+
 void
 sendto_one_numeric(struct Client *to, const struct Client *from, enum irc_numerics numeric, ...)
 {
@@ -292,7 +461,7 @@ sendto_one_numeric(struct Client *to, const struct Client *from, enum irc_numeri
   if (EmptyString(dest))
     dest = "*";
 
-  struct dbuf_block *buffer = dbuf_alloc();
+  struct dbuf_block *buffer = dbuf_alloc(IRCD_BUFSIZE);
   dbuf_put_fmt(buffer, ":%s %03d %s ", ID_or_name(from, to), numeric & ~SND_EXPLICIT, dest);
 
   va_start(args, numeric);
@@ -302,7 +471,7 @@ sendto_one_numeric(struct Client *to, const struct Client *from, enum irc_numeri
   else
     numstr = numeric_form(numeric);
 
-  send_format(buffer, numstr, args);
+  buffer = send_format(buffer, numstr, args);
   va_end(args);
 
   send_message(to->from, buffer);
@@ -310,6 +479,49 @@ sendto_one_numeric(struct Client *to, const struct Client *from, enum irc_numeri
   dbuf_ref_free(buffer);
 }
 
+/*! \brief Send a numeric whose parameters were formatted once with
+ *         send_prepare() and are shared by reference among recipients.
+ *         Only the ":server numeric target " prefix is formatted per
+ *         recipient.
+ * \param to      Client to send to
+ * \param from    Client the numeric is from
+ * \param numeric Numeric to send
+ * \param params  Parameters of the numeric, including the trailing CR-LF
+ */
+void
+sendto_one_numeric_prepared(struct Client *to, const struct Client *from,
+                            enum irc_numerics numeric, struct dbuf_block *params)
+{
+  if (IsDead(to->from))
+    return;
+
+  const char *dest = ID_or_name(to, to);
+  if (EmptyString(dest))
+    dest = "*";
+
+  struct dbuf_block *buffer = dbuf_alloc(IRCD_BUFSIZE);
+  dbuf_put_fmt(buffer, ":%s %03d %s ", ID_or_name(from, to), numeric, dest);
+
+  if (buffer->size + params->size > IRCD_BUFSIZE)
+  {
+    /* Too long to send as is; truncate a copy like send_format() would */
+    size_t len = IRCD_BUFSIZE - 2 - buffer->size;
+
+    memcpy(buffer->data + buffer->size, params->data, len);
+    buffer->size += len;
+    buffer->data[buffer->size++] = '\r';
+    buffer->data[buffer->size++] = '\n';
+    send_message(to->from, buffer);
+  }
+  else
+  {
+    buffer = dbuf_shrink(buffer);
+    send_message_parts(to->from, buffer, params);
+  }
+
+  dbuf_ref_free(buffer);
+}
+
 void
 sendto_one_notice(struct Client *to, const struct Client *from, const char *pattern, ...)
 {
@@ -322,11 +534,11 @@ sendto_one_notice(struct Client *to, const struct Client *from, const char *patt
   if (EmptyString(dest))
     dest = "*";
 
-  struct dbuf_block *buffer = dbuf_alloc();
+  struct dbuf_block *buffer = dbuf_alloc(IRCD_BUFSIZE);
   dbuf_put_fmt(buffer, ":%s NOTICE %s ", ID_or_name(from, to), dest);
 
   va_start(args, pattern);
-  send_format(buffer, pattern, args);
+  buffer = send_format(buffer, pattern, args);
   va_end(args);
 
   send_message(to->from, buffer);
@@ -334,6 +546,84 @@ sendto_one_notice(struct Client *to, const struct Client *from, const char *patt
   dbuf_ref_free(buffer);
 }
 
+/*
+ * Versions of a message for the recipients of a fan-out.  A version is
+ * formatted when the first recipient that gets it comes up, so versions
+ * nobody gets are never formatted.  They are either given by 'variants',
+ * or share 'pattern' and 'args' and only differ by 'prefix'.
+ */
+struct send_builder
+{
+  const struct SendVariant *variants;
+  const char *prefix[SEND_VARIANTS_MAX];
+  const char *pattern;
+  va_list args;
+  struct dbuf_block *block[SEND_VARIANTS_MAX];
+};
+
+static struct dbuf_block *
+send_format_strings(struct dbuf_block *buffer, const char *pattern, ...)
+{
+  va_list args;
+
+  va_start(args, pattern);
+  buffer = send_format(buffer, pattern, args);
+  va_end(args);
+
+  return buffer;
+}
+
+/* send_builder_get()
+ *
+ * inputs	- message being sent
+ *		- index of the version
+ * output	- the version, formatted on first use; NULL if nothing is
+ *		  to be sent
+ */
+static struct dbuf_block *
+send_builder_get(struct send_builder *builder, unsigned int i)
+{
+  if (builder->block[i])
+    return builder->block[i];
+
+  if (builder->variants)
+  {
+    const struct SendVariant *const variant = &builder->variants[i];
+
+    if (variant->pattern == NULL)
+      return NULL;
+
+    /* Conversions beyond those of the pattern ignore the rest */
+    builder->block[i] = send_format_strings(dbuf_alloc(IRCD_BUFSIZE), variant->pattern,
+                                            variant->args[0], variant->args[1],
+                                            variant->args[2], variant->args[3],
+                                            variant->args[4], variant->args[5],
+                                            variant->args[6], variant->args[7]);
+  }
+  else
+  {
+    struct dbuf_block *buffer = dbuf_alloc(IRCD_BUFSIZE);
+    va_list args;
+
+    if (builder->prefix[i])
+      dbuf_put_fmt(buffer, "%s", builder->prefix[i]);
+
+    va_copy(args, builder->args);
+    builder->block[i] = send_format(buffer, builder->pattern, args);
+    va_end(args);
+  }
+
+  return builder->block[i];
+}
+
+static void
+send_builder_free(struct send_builder *builder)
+{
+  for (unsigned int i = 0; i < SEND_VARIANTS_MAX; ++i)
+    if (builder->block[i])
+      dbuf_ref_free(builder->block[i]);
+}
+
 /* sendto_channel_butone()
  *
  * inputs	- pointer to client(server) to NOT send message to
@@ -350,26 +640,21 @@ sendto_channel_butone(struct Client *one, const struct Client *from,
                       struct Channel *chptr, unsigned int type,
                       const char *pattern, ...)
 {
-  va_list alocal, aremote;
-  struct dbuf_block *local_buf, *remote_buf;
+  /* Client::name is sized for the name of a server */
+  char local[HOSTLEN + USERLEN + HOSTLEN + 6], remote[IDLEN + 3];
+  struct send_builder builder = { .prefix = { local, remote }, .pattern = pattern };
   dlink_node *node = NULL;
 
-  local_buf = dbuf_alloc(), remote_buf = dbuf_alloc();
-
   if (IsClient(from))
-    dbuf_put_fmt(local_buf, ":%s!%s@%s ", from->name, from->username, from->host);
+    snprintf(local, sizeof(local), ":%s!%s@%s ", from->name, from->username, from->host);
   else
-    dbuf_put_fmt(local_buf, ":%s ", from->name);
+    snprintf(local, sizeof(local), ":%s ", from->name);
 
-  dbuf_put_fmt(remote_buf, ":%s ", from->id);
+  snprintf(remote, sizeof(remote), ":%s ", from->id);
 
-  va_start(alocal, pattern);
-  va_start(aremote, pattern);
-  send_format(local_buf, pattern, alocal);
-  send_format(remote_buf, pattern, aremote);
+  channel_member_mode_sync(chptr);
 
-  va_end(aremote);
-  va_end(alocal);
+  va_start(builder.args, pattern);
 
   ++current_serial;
 
@@ -393,15 +678,15 @@ sendto_channel_butone(struct Client *one, const struct Client *from,
       continue;
 
     if (MyConnect(target_p))
-      send_message(target_p, local_buf);
+      send_message(target_p, send_builder_get(&builder, 0));
     else if (target_p->from->connection->serial != current_serial)
-      send_message_remote(target_p->from, from, remote_buf);
+      send_message_remote(target_p->from, from, send_builder_get(&builder, 1));
 
     target_p->from->connection->serial = current_serial;
   }
 
-  dbuf_ref_free(local_buf);
-  dbuf_ref_free(remote_buf);
+  va_end(builder.args);
+  send_builder_free(&builder);
 }
 
 /* sendto_server()
@@ -433,8 +718,8 @@ sendto_server(const struct Client *one,
 
   va_start(args, format);
 
-  struct dbuf_block *buffer = dbuf_alloc();
-  send_format(buffer, format, args);
+  struct dbuf_block *buffer = dbuf_alloc(IRCD_BUFSIZE);
+  buffer = send_format(buffer, format, args);
 
   va_end(args);
 
@@ -483,11 +768,10 @@ sendto_common_channels_local(struct Client *user, int touser, unsigned int posca
   struct Channel *chptr;
   struct Membership *member;
   struct Client *target_p;
-  struct dbuf_block *buffer = dbuf_alloc();
+  struct dbuf_block *buffer = NULL;
 
+  /* The message is only formatted once there is someone to send it to */
   va_start(args, pattern);
-  send_format(buffer, pattern, args);
-  va_end(args);
 
   ++current_serial;
 
@@ -510,6 +794,9 @@ sendto_common_channels_local(struct Client *user, int touser, unsigned int posca
       if (negcap && HasCap(target_p, negcap))
         continue;
 
+      if (buffer == NULL)
+        buffer = send_format(dbuf_alloc(IRCD_BUFSIZE), pattern, args);
+
       target_p->connection->serial = current_serial;
       send_message(target_p, buffer);
     }
@@ -518,30 +805,158 @@ sendto_common_channels_local(struct Client *user, int touser, unsigned int posca
   if (touser && MyConnect(user) && !IsDead(user) &&
       user->connection->serial != current_serial)
     if (HasCap(user, poscap) == poscap)
+    {
+      if (buffer == NULL)
+        buffer = send_format(dbuf_alloc(IRCD_BUFSIZE), pattern, args);
+
       send_message(user, buffer);
+    }
 
-  dbuf_ref_free(buffer);
+  va_end(args);
+
+  if (buffer)
+    dbuf_ref_free(buffer);
 }
 
-/*! \brief Send a message to members of a channel that are locally connected to this server.
- * \param one      Client to skip; can be NULL
- * \param chptr    Destination channel
- * \param status   Channel member status flags clients must have
- * \param poscap   Positive client capabilities flags (CAP)
- * \param negcap   Negative client capabilities flags (CAP)
- * \param pattern  Format string for command arguments
+/* A channel or local client, and the index of a user or of a run of channels */
+struct split_pair
+{
+  const void *key;
+  unsigned int index;
+};
+
+static int
+split_pair_cmp(const void *a, const void *b)
+{
+  const struct split_pair *const x = a, *const y = b;
+
+  if (x->key != y->key)
+    return (uintptr_t)x->key < (uintptr_t)y->key ? -1 : 1;
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static void
+split_pair_add(struct split_pair **pairs, unsigned int *count, unsigned int *size,
+               const void *key, unsigned int index)
+{
+  if (*count == *size)
+  {
+    *size = *size ? *size * 2 : 64;
+    *pairs = xrealloc(*pairs, *size * sizeof(**pairs));
+  }
+
+  (*pairs)[*count].key = key;
+  (*pairs)[(*count)++].index = index;
+}
+
+/*! \brief Send the QUITs of a number of users, such as those behind a
+ *         netsplit, to the local clients that share a channel with them.
+ *         The local members of each channel concerned are walked once,
+ *         and each client has all of its QUITs queued together, each
+ *         one once.  A QUIT is formatted when it is first sent.
+ * \param users   Users that quit; none of them locally connected
+ * \param count   Number of users
+ * \param comment Quit message
  */
 void
-sendto_channel_local(const struct Client *one, struct Channel *chptr, unsigned int status,
-                     unsigned int poscap, unsigned int negcap, const char *pattern, ...)
+sendto_common_channels_local_quits(struct Client *const *users, unsigned int count, const char *comment)
+{
+  struct split_pair *chans = NULL, *targets = NULL;
+  unsigned int nchans = 0, chans_size = 0, ntargets = 0, targets_size = 0;
+  unsigned int stamp = 0;
+  dlink_node *node;
+
+  if (count == 0)
+    return;
+
+  struct dbuf_block **quit = xcalloc(count * sizeof(*quit));
+  unsigned int *sent = xcalloc(count * sizeof(*sent));
+
+  /* Every channel with local members, once for each of the users in it */
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    assert(!MyConnect(users[i]));
+
+    DLINK_FOREACH(node, users[i]->channel.head)
+    {
+      const struct Channel *const chptr = ((const struct Membership *)node->data)->chptr;
+
+      if (chptr->locmembers.head)
+        split_pair_add(&chans, &nchans, &chans_size, chptr, i);
+    }
+  }
+
+  qsort(chans, nchans, sizeof(*chans), split_pair_cmp);
+
+  /* Every local member of those, once for each channel, with the start of its run */
+  for (unsigned int first = 0, last; first < nchans; first = last)
+  {
+    const struct Channel *const chptr = chans[first].key;
+
+    for (last = first + 1; last < nchans && chans[last].key == chptr; ++last)
+      ;
+
+    DLINK_FOREACH(node, chptr->locmembers.head)
+    {
+      const struct Client *const target_p = ((const struct Membership *)node->data)->client_p;
+
+      if (!IsDefunct(target_p))
+        split_pair_add(&targets, &ntargets, &targets_size, target_p, first);
+    }
+  }
+
+  qsort(targets, ntargets, sizeof(*targets), split_pair_cmp);
+
+  for (unsigned int t = 0; t < ntargets; ++stamp)
+  {
+    struct Client *const target_p = (struct Client *)targets[t].key;
+
+    for (; t < ntargets && targets[t].key == target_p; ++t)
+    {
+      const unsigned int first = targets[t].index;
+
+      for (unsigned int c = first; c < nchans && chans[c].key == chans[first].key; ++c)
+      {
+        const unsigned int i = chans[c].index;
+
+        if (sent[i] == stamp + 1)
+          continue;
+
+        sent[i] = stamp + 1;
+
+        if (quit[i] == NULL)
+          quit[i] = send_prepare(":%s!%s@%s QUIT :%s", users[i]->name, users[i]->username,
+                                 users[i]->host, comment);
+
+        send_message(target_p, quit[i]);
+      }
+    }
+  }
+
+  for (unsigned int i = 0; i < count; ++i)
+    if (quit[i])
+      dbuf_ref_free(quit[i]);
+
+  xfree(quit);
+  xfree(sent);
+  xfree(chans);
+  xfree(targets);
+}
+
+/* send_channel_local()
+ *
+ * Common part of sendto_channel_local() and sendto_channel_local_variants().
+ * A member is sent version i of the message, where bit n of i is set if
+ * the member has the n-th lowest capability of 'capmask' active.
+ */
+static void
+send_channel_local(const struct Client *one, struct Channel *chptr, unsigned int status,
+                   unsigned int poscap, unsigned int negcap, unsigned int capmask,
+                   struct send_builder *builder)
 {
-  va_list args;
   dlink_node *node = NULL;
-  struct dbuf_block *buffer = dbuf_alloc();
 
-  va_start(args, pattern);
-  send_format(buffer, pattern, args);
-  va_end(args);
+  channel_member_mode_sync(chptr);
 
   DLINK_FOREACH(node, chptr->locmembers.head)
   {
@@ -563,9 +978,104 @@ sendto_channel_local(const struct Client *one, struct Channel *chptr, unsigned i
     if (negcap && HasCap(target_p, negcap))
       continue;
 
-    send_message(target_p, buffer);
+    unsigned int variant = 0;
+
+    if (capmask)
+    {
+      const unsigned int caps = HasCap(target_p, capmask);
+      unsigned int bit = 1;
+
+      for (unsigned int mask = capmask; mask; mask &= mask - 1, bit <<= 1)
+        if (caps & mask & -mask)
+          variant |= bit;
+    }
+
+    struct dbuf_block *const buffer = send_builder_get(builder, variant);
+    if (buffer)
+      send_message(target_p, buffer);
   }
+}
+
+/*! \brief Send a message to members of a channel that are locally connected to this server.
+ * \param one      Client to skip; can be NULL
+ * \param chptr    Destination channel
+ * \param status   Channel member status flags clients must have
+ * \param poscap   Positive client capabilities flags (CAP)
+ * \param negcap   Negative client capabilities flags (CAP)
+ * \param pattern  Format string for command arguments
+ */
+void
+sendto_channel_local(const struct Client *one, struct Channel *chptr, unsigned int status,
+                     unsigned int poscap, unsigned int negcap, const char *pattern, ...)
+{
+  struct send_builder builder = { .pattern = pattern };
+
+  va_start(builder.args, pattern);
+  send_channel_local(one, chptr, status, poscap, negcap, 0, &builder);
+  va_end(builder.args);
+
+  send_builder_free(&builder);
+}
+
+/*! \brief Send one of several versions of a message to members of a channel
+ *         that are locally connected to this server, picking the version
+ *         by the member's client capabilities.  A version is formatted
+ *         when the first member that gets it comes up, and shared by
+ *         reference among its recipients.
+ * \param one      Client to skip; can be NULL
+ * \param chptr    Destination channel
+ * \param status   Channel member status flags clients must have
+ * \param negcap   Negative client capabilities flags (CAP)
+ * \param capmask  Client capabilities (CAP) the versions differ by; at most
+ *                 two
+ * \param variants 1 << popcount(capmask) versions, indexed by the member's
+ *                 capabilities within capmask, lowest bit first
+ */
+void
+sendto_channel_local_variants(const struct Client *one, struct Channel *chptr, unsigned int status,
+                              unsigned int negcap, unsigned int capmask,
+                              const struct SendVariant *variants)
+{
+  struct send_builder builder = { .variants = variants };
+
+  assert((1U << __builtin_popcount(capmask)) <= SEND_VARIANTS_MAX);
+
+  send_channel_local(one, chptr, status, 0, negcap, capmask, &builder);
+  send_builder_free(&builder);
+}
+
+/*! \brief Format a message once, to be sent to several clients
+ * \param pattern Format string for the complete message
+ * \return Buffer holding one reference, to be released with dbuf_ref_free()
+ */
+struct dbuf_block *
+send_prepare(const char *pattern, ...)
+{
+  va_list args;
+  struct dbuf_block *buffer = dbuf_alloc(IRCD_BUFSIZE);
+
+  va_start(args, pattern);
+  buffer = send_format(buffer, pattern, args);
+  va_end(args);
+
+  return buffer;
+}
+
+/*! \brief Format a message as send_prepare() does and add it to a queue
+ * \param queue   Queue the message is added to, e.g. a burst being built
+ * \param pattern Format string for the complete message
+ */
+void
+send_prepare_queue(struct dbuf_queue *queue, const char *pattern, ...)
+{
+  va_list args;
+  struct dbuf_block *buffer = dbuf_alloc(IRCD_BUFSIZE);
+
+  va_start(args, pattern);
+  buffer = send_format(buffer, pattern, args);
+  va_end(args);
 
+  dbuf_add(queue, buffer);
   dbuf_ref_free(buffer);
 }
 
@@ -610,15 +1120,15 @@ sendto_match_butone(const struct Client *one, const struct Client *from,
   dlink_node *node = NULL;
   struct dbuf_block *local_buf, *remote_buf;
 
-  local_buf = dbuf_alloc(), remote_buf = dbuf_alloc();
+  local_buf = dbuf_alloc(IRCD_BUFSIZE), remote_buf = dbuf_alloc(IRCD_BUFSIZE);
 
   dbuf_put_fmt(local_buf, ":%s!%s@%s ", from->name, from->username, from->host);
   dbuf_put_fmt(remote_buf, ":%s ", from->id);
 
   va_start(alocal, pattern);
   va_start(aremote, pattern);
-  send_format(local_buf, pattern, alocal);
-  send_format(remote_buf, pattern, aremote);
+  local_buf = send_format(local_buf, pattern, alocal);
+  remote_buf = send_format(remote_buf, pattern, aremote);
   va_end(aremote);
   va_end(alocal);
 
@@ -684,11 +1194,11 @@ sendto_match_servs(const struct Client *source_p, const char *mask, unsigned int
 {
   va_list args;
   dlink_node *node = NULL;
-  struct dbuf_block *buffer = dbuf_alloc();
+  struct dbuf_block *buffer = dbuf_alloc(IRCD_BUFSIZE);
 
   dbuf_put_fmt(buffer, ":%s ", source_p->id);
   va_start(args, pattern);
-  send_format(buffer, pattern, args);
+  buffer = send_format(buffer, pattern, args);
   va_end(args);
 
   ++current_serial;
@@ -736,7 +1246,7 @@ sendto_anywhere(struct Client *to, const struct Client *from,
   if (IsDead(to->from))
     return;
 
-  struct dbuf_block *buffer = dbuf_alloc();
+  struct dbuf_block *buffer = dbuf_alloc(IRCD_BUFSIZE);
   if (MyClient(to) && IsClient(from))
     dbuf_put_fmt(buffer, ":%s!%s@%s %s %s ", from->name, from->username,
                  from->host, command, to->name);
@@ -745,7 +1255,7 @@ sendto_anywhere(struct Client *to, const struct Client *from,
                  command, ID_or_name(to, to));
 
   va_start(args, pattern);
-  send_format(buffer, pattern, args);
+  buffer = send_format(buffer, pattern, args);
   va_end(args);
 
   if (MyConnect(to))
@@ -786,11 +1296,11 @@ sendto_realops_flags(unsigned int flags, int level, int type, const char *patter
       assert(0);
   }
 
-  struct dbuf_block *buffer = dbuf_alloc();
+  struct dbuf_block *buffer = dbuf_alloc(IRCD_BUFSIZE);
   dbuf_put_fmt(buffer, ":%s NOTICE * :*** %s -- ", me.name, ntype); 
 
   va_start(args, pattern);
-  send_format(buffer, pattern, args);
+  buffer = send_format(buffer, pattern, args);
   va_end(args);
 
   DLINK_FOREACH(node, oper_list.head)
@@ -853,7 +1363,7 @@ sendto_wallops_flags(unsigned int flags, const struct Client *source_p,
 {
   dlink_node *node = NULL;
   va_list args;
-  struct dbuf_block *buffer = dbuf_alloc();
+  struct dbuf_block *buffer = dbuf_alloc(IRCD_BUFSIZE);
 
   if (IsClient(source_p))
     dbuf_put_fmt(buffer, ":%s!%s@%s WALLOPS :", source_p->name, source_p->username, source_p->host);
@@ -861,7 +1371,7 @@ sendto_wallops_flags(unsigned int flags, const struct Client *source_p,
     dbuf_put_fmt(buffer, ":%s WALLOPS :", source_p->name);
 
   va_start(args, pattern);
-  send_format(buffer, pattern, args);
+  buffer = send_format(buffer, pattern, args);
   va_end(args);
 
   DLINK_FOREACH(node, oper_list.head)
@@ -27,6 +27,9 @@
 #include "stdinc.h"
 #include "list.h"
 #include "client.h"
+#include "channel.h"
+#include "channel_mode.h"
+#include "dbuf.h"
 #include "event.h"
 #include "hash.h"
 #include "irc_string.h"
@@ -37,13 +40,17 @@
 #include "conf.h"
 #include "server.h"
 #include "server_capab.h"
+#include "snapshot.h"
 #include "log.h"
 #include "send.h"
 #include "memory.h"
 #include "parse.h"
+#include "user.h"
 
 
 dlink_list flatten_links;
+dlink_list bursting_server_list;
+
 static void serv_connect_callback(fde_t *, int, void *);
 
 
@@ -635,11 +642,11 @@ ssl_server_handshake(fde_t *fd, void *data)
     {
       case TLS_HANDSHAKE_WANT_WRITE:
         comm_setselect(&client_p->connection->fd, COMM_SELECT_WRITE,
-                       ssl_server_handshake, client_p, CONNECTTIMEOUT);
+                       ssl_server_handshake, client_p, CONNECTTIMEOUT * 1000);
         return;
       case TLS_HANDSHAKE_WANT_READ:
         comm_setselect(&client_p->connection->fd, COMM_SELECT_READ,
-                       ssl_server_handshake, client_p, CONNECTTIMEOUT);
+                       ssl_server_handshake, client_p, CONNECTTIMEOUT * 1000);
         return;
       default:
       {
@@ -781,3 +788,299 @@ find_servconn_in_progress(const char *name)
 
   return NULL;
 }
+
+/*
+ * server_burst_tburst
+ *
+ * inputs       - queue to add the message to
+ *              - ID of the server the message is from
+ *              - pointer to channel
+ * output       - NONE
+ * side effects - Called on a server burst when
+ *                server is CAPAB_TBURST capable
+ */
+static void
+server_burst_tburst(struct dbuf_queue *queue, const char *source, const struct Channel *chptr)
+{
+  /*
+   * We may also send an empty topic here, but only if topic_time isn't 0,
+   * i.e. if we had a topic that got unset.  This is required for syncing
+   * topics properly.
+   *
+   * Imagine the following scenario: Our downlink introduces a channel
+   * to us with a TS that is equal to ours, but the channel topic on
+   * their side got unset while the servers were in splitmode, which means
+   * their 'topic' is newer.  They simply wanted to unset it, so we have to
+   * deal with it in a more sophisticated fashion instead of just resetting
+   * it to their old topic they had before.  Read m_tburst.c:ms_tburst
+   * for further information   -Michael
+   */
+  if (chptr->topic_time)
+    send_prepare_queue(queue, ":%s TBURST %ju %s %ju %s :%s", source,
+                       chptr->creationtime, chptr->name,
+                       chptr->topic_time,
+                       chptr->topic_info,
+                       chptr->topic);
+}
+
+/* server_burst_client()
+ *
+ * inputs       - queue to add the messages to
+ *              - server the burst is meant for
+ *              - client to burst
+ * output       - NONE
+ * side effects - the UID line and whatever else describes target_p is
+ *                added to the queue.  Clients behind client_p come out
+ *                the way client_p bursts them to us.
+ */
+void
+server_burst_client(struct dbuf_queue *queue, struct Client *client_p, struct Client *target_p)
+{
+  dlink_node *node;
+  char buf[UMODE_MAX_STR] = "";
+  const unsigned int hopcount = target_p->hopcount + (target_p->from != client_p);
+
+  assert(IsClient(target_p));
+
+  send_umode(target_p, 0, 0, buf);
+
+  if (buf[0] == '\0')
+  {
+    buf[0] = '+';
+    buf[1] = '\0';
+  }
+
+    /* TBR: compatibility mode */
+  if (IsCapable(client_p, CAPAB_RHOST))
+    send_prepare_queue(queue, ":%s UID %s %u %ju %s %s %s %s %s %s %s :%s",
+                       target_p->servptr->id,
+                       target_p->name, hopcount,
+                       target_p->tsinfo,
+                       buf, target_p->username, target_p->host, target_p->realhost,
+                       target_p->sockhost, target_p->id,
+                       target_p->account, target_p->info);
+  else
+    send_prepare_queue(queue, ":%s UID %s %u %ju %s %s %s %s %s %s :%s",
+                       target_p->servptr->id,
+                       target_p->name, hopcount,
+                       target_p->tsinfo,
+                       buf, target_p->username, target_p->host,
+                       target_p->sockhost, target_p->id,
+                       target_p->account, target_p->info);
+
+  if (!EmptyString(target_p->certfp))
+    send_prepare_queue(queue, ":%s CERTFP %s", target_p->id, target_p->certfp);
+
+  if (target_p->away[0])
+    send_prepare_queue(queue, ":%s AWAY :%s", target_p->id, target_p->away);
+
+
+  DLINK_FOREACH(node, target_p->svstags.head)
+  {
+    const struct ServicesTag *svstag = node->data;
+    char *m = buf;
+
+    for (const struct user_modes *tab = umode_tab; tab->c; ++tab)
+      if (svstag->umodes & tab->flag)
+        *m++ = tab->c;
+    *m = '\0';
+
+    send_prepare_queue(queue, ":%s SVSTAG %s %ju %u +%s :%s",
+                       target_p->from == client_p ? client_p->id : me.id, target_p->id,
+                       target_p->tsinfo, svstag->numeric, buf, svstag->tag);
+  }
+}
+
+/* server_burst_channel()
+ *
+ * inputs       - queue to add the messages to
+ *              - server the burst is meant for
+ *              - channel to burst
+ *              - nonzero for the channel as client_p bursts it to us
+ * output       - NONE
+ * side effects - nothing is added for a channel without members on
+ *                the chosen side, see channel_burst_modes()
+ */
+void
+server_burst_channel(struct dbuf_queue *queue, struct Client *client_p, struct Channel *chptr, int behind)
+{
+  if (channel_burst_modes(queue, client_p, chptr, behind) == 0)
+    return;
+
+  if (IsCapable(client_p, CAPAB_TBURST))
+    server_burst_tburst(queue, behind ? client_p->id : me.id, chptr);
+}
+
+/* server_burst()
+ *
+ * inputs       - pointer to server to send burst to
+ * output       - NONE
+ * side effects - starts sending the burst of nicks and channels to
+ *                client_p.  The burst is produced only as fast as the
+ *                link drains, by server_burst_continue(); until it is
+ *                done, all other messages for client_p are held back
+ *                in the BurstTask, so the server learns about changes
+ *                made in the meantime only after the burst.  Clients
+ *                and channels are added to the head of their lists, so
+ *                those created after the burst started are not burst
+ *                but introduced by those held back messages.
+ */
+void
+server_burst(struct Client *client_p)
+{
+  dlink_node *node = NULL;
+  struct BurstTask *const task = xcalloc(sizeof(*task));
+
+  task->client = global_client_list.head;
+  task->channel = channel_list.head;
+
+  client_p->connection->burst_task = task;
+  dlinkAdd(client_p, &task->node, &bursting_server_list);
+
+  /* These are held back too, so they follow the burst */
+
+  /* Always send a PING after connect burst is done */
+  sendto_one(client_p, "PING :%s", me.id);
+
+  if (IsCapable(client_p, CAPAB_EOB))
+  {
+    DLINK_FOREACH_PREV(node, global_server_list.tail)
+    {
+      struct Client *target_p = node->data;
+
+      if (target_p->from == client_p)
+        continue;
+
+      if (IsMe(target_p) || HasFlag(target_p, FLAGS_EOB))
+        sendto_one(client_p, ":%s EOB", target_p->id);
+    }
+  }
+
+  /* Wait for the server's snapshot digests; see snapshot_delta_ready() */
+  if (IsCapable(client_p, CAPAB_SNAP))
+  {
+    task->delta = xcalloc(sizeof(*task->delta));
+    return;
+  }
+
+  server_burst_continue(client_p);
+}
+
+/* server_burst_continue()
+ *
+ * inputs       - pointer to server being sent a burst
+ * output       - NONE
+ * side effects - queues burst messages until SERVER_BURST_QUEUE bytes
+ *                are waiting to be written, and finishes the burst once
+ *                every client and channel has been sent.  Called again
+ *                by send_queued_write() whenever the sendq was written.
+ *                Ranges the server replays from its snapshot are left
+ *                out.
+ */
+void
+server_burst_continue(struct Client *client_p)
+{
+  struct BurstTask *const task = client_p->connection->burst_task;
+  struct dbuf_queue lines;
+
+  if (task->generating)
+    return;  /* Written while queueing the burst itself */
+
+  if (task->delta && !task->delta->ready)
+    return;  /* Not before the server's SNAPDIGEST END */
+
+  memset(&lines, 0, sizeof(lines));
+  task->generating = 1;
+
+  snapshot_delta_announce(client_p, task->delta, SNAPSHOT_USERS);
+
+  while (!IsDead(client_p) && (task->client || task->channel))
+  {
+    if (dbuf_length(&client_p->connection->buf_sendq) >= SERVER_BURST_QUEUE)
+    {
+      task->generating = 0;
+      return;  /* Still more to do */
+    }
+
+    if (task->client)
+    {
+      struct Client *target_p = task->client->data;
+
+      task->client = task->client->next;
+
+      if (target_p->from != client_p &&
+          !snapshot_delta_skip(task->delta, SNAPSHOT_USERS, target_p->id))
+      {
+        server_burst_client(&lines, client_p, target_p);
+        sendto_one_queue(client_p, &lines);
+      }
+    }
+    else
+    {
+      struct Channel *chptr = task->channel->data;
+
+      snapshot_delta_announce(client_p, task->delta, SNAPSHOT_CHANNELS);
+      task->channel = task->channel->next;
+
+      if (!snapshot_delta_skip(task->delta, SNAPSHOT_CHANNELS, chptr->name))
+      {
+        server_burst_channel(&lines, client_p, chptr, 0);
+        sendto_one_queue(client_p, &lines);
+      }
+    }
+  }
+
+  task->generating = 0;
+
+  if (IsDead(client_p))
+    return;  /* exit_client() frees the task */
+
+  /* Done; release everything held back behind the burst */
+  dbuf_move(&client_p->connection->buf_sendq, &task->deferred);
+  server_burst_free(client_p);
+
+  send_queued_write(client_p);
+}
+
+/* server_burst_free()
+ *
+ * inputs       - pointer to server being sent a burst
+ * output       - NONE
+ * side effects - the burst is dropped along with what was held back
+ */
+void
+server_burst_free(struct Client *client_p)
+{
+  struct BurstTask *const task = client_p->connection->burst_task;
+
+  dbuf_clear(&task->deferred);
+  dlinkDelete(&task->node, &bursting_server_list);
+
+  xfree(task->delta);
+  xfree(task);
+  client_p->connection->burst_task = NULL;
+}
+
+/* server_burst_unlink()
+ *
+ * inputs       - node about to be removed from global_client_list or
+ *                channel_list
+ * output       - NONE
+ * side effects - bursts about to continue at that node continue at the
+ *                next one instead
+ */
+void
+server_burst_unlink(const dlink_node *node)
+{
+  dlink_node *ptr;
+
+  DLINK_FOREACH(ptr, bursting_server_list.head)
+  {
+    struct BurstTask *const task = ((struct Client *)ptr->data)->connection->burst_task;
+
+    if (task->client == node)
+      task->client = node->next;
+    if (task->channel == node)
+      task->channel = node->next;
+  }
+}
@@ -51,6 +51,10 @@ capab_init(void)
   capab_add("CHW", CAPAB_CHW);
   capab_add("HOPS", CAPAB_HOPS);
   capab_add("RHOST", CAPAB_RHOST);
+  capab_add("SNAP", CAPAB_SNAP);
+#ifdef HAVE_LIBZ
+  capab_add("ZLIB", CAPAB_ZLIB);
+#endif
 }
 
 /* capab_add()
@@ -0,0 +1,258 @@
+/*
+ *  ircd-hybrid: an advanced, lightweight Internet Relay Chat Daemon (ircd)
+ *
+ *  Copyright (c) 2017 ircd-hybrid development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ *  USA
+ */
+
+/*! \file server_zip.c
+ * \brief Compressed server links.
+ * \version $Id$
+ */
+
+#include "stdinc.h"
+#include "list.h"
+#include "client.h"
+#include "dbuf.h"
+#include "memory.h"
+#include "server_zip.h"
+
+
+#ifdef HAVE_LIBZ
+/* zip_start()
+ *
+ * inputs	- pointer to server which negotiated CAPAB ZLIB
+ * output	- 1 if successful, 0 otherwise
+ * side effects	- everything written to the link after the data queued so
+ *		  far is compressed
+ */
+int
+zip_start(struct Client *client_p)
+{
+  struct Connection *const connection = client_p->connection;
+  struct ZipLink *zip = xcalloc(sizeof(*zip));
+
+  if (deflateInit(&zip->deflate, Z_DEFAULT_COMPRESSION) != Z_OK)
+  {
+    xfree(zip);
+    return 0;
+  }
+
+  if (inflateInit(&zip->inflate) != Z_OK)
+  {
+    deflateEnd(&zip->deflate);
+    xfree(zip);
+    return 0;
+  }
+
+  connection->zip = zip;
+
+  /* Our handshake, up to and including SVINFO, still goes out as is */
+  while (dbuf_length(&connection->buf_sendq))
+  {
+    const struct dbuf_block *block = dbuf_head(&connection->buf_sendq);
+    const size_t len = block->size - connection->buf_sendq.pos;
+
+    dbuf_put(&zip->sendq, block->data + connection->buf_sendq.pos, len);
+    dbuf_delete(&connection->buf_sendq, len);
+  }
+
+  return 1;
+}
+
+/* zip_start_read()
+ *
+ * inputs	- pointer to server with a compressed link
+ * output	- 1 if successful, 0 otherwise
+ * side effects	- the rest of the receive queue, and everything read
+ *		  later on, is taken as compressed data and inflated
+ */
+int
+zip_start_read(struct Client *client_p)
+{
+  struct Connection *const connection = client_p->connection;
+  struct dbuf_queue received = connection->buf_recvq;
+  struct dbuf_iter iter;
+  size_t pos = received.pos;
+  int ret = 1;
+
+  if (connection->zip->reading)
+    return 1;
+
+  connection->zip->reading = 1;
+  memset(&connection->buf_recvq, 0, sizeof(connection->buf_recvq));
+
+  for (const struct dbuf_block *block = dbuf_first(&received, &iter); block;
+       block = dbuf_next(&iter), pos = 0)
+  {
+    if (zip_read(client_p, block->data + pos, block->size - pos) == 0)
+    {
+      ret = 0;
+      break;
+    }
+  }
+
+  dbuf_clear(&received);
+  return ret;
+}
+
+/* zip_free()
+ *
+ * inputs	- pointer to server
+ * output	- none
+ * side effects	- compression state of the link, if any, is released
+ */
+void
+zip_free(struct Client *client_p)
+{
+  struct ZipLink *const zip = client_p->connection->zip;
+
+  if (zip == NULL)
+    return;
+
+  deflateEnd(&zip->deflate);
+  inflateEnd(&zip->inflate);
+  dbuf_clear(&zip->sendq);
+
+  xfree(zip);
+  client_p->connection->zip = NULL;
+}
+
+/* zip_fill()
+ *
+ * inputs	- pointer to server with a compressed link
+ * output	- 0 on compressor error, 1 otherwise
+ * side effects	- compresses data from the sendq until ZIP_SENDQ_SIZE
+ *		  bytes of output are waiting to be written.  The stream is
+ *		  flushed whenever the sendq runs empty, so the peer can
+ *		  always parse everything that has been written.
+ */
+int
+zip_fill(struct Client *client_p)
+{
+  struct dbuf_queue *const queue = &client_p->connection->buf_sendq;
+  struct ZipLink *const zip = client_p->connection->zip;
+
+  while (dbuf_length(&zip->sendq) < ZIP_SENDQ_SIZE && (dbuf_length(queue) || zip->flushing))
+  {
+    const char *data = NULL;
+    size_t len = 0, avail = 0;
+
+    if (dbuf_length(queue))
+    {
+      const struct dbuf_block *block = dbuf_head(queue);
+
+      data = block->data + queue->pos;
+      len = block->size - queue->pos;
+    }
+
+    const int flush = len == dbuf_length(queue) ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+    char *const out = dbuf_reserve(&zip->sendq, &avail);
+
+    zip->deflate.next_in = (Bytef *)data;
+    zip->deflate.avail_in = len;
+    zip->deflate.next_out = (Bytef *)out;
+    zip->deflate.avail_out = avail;
+
+    if (deflate(&zip->deflate, flush) == Z_STREAM_ERROR)
+    {
+      dbuf_commit(&zip->sendq, 0);
+      return 0;
+    }
+
+    len -= zip->deflate.avail_in;
+    avail -= zip->deflate.avail_out;
+
+    dbuf_commit(&zip->sendq, avail);
+    dbuf_delete(queue, len);
+
+    zip->out_data += len;
+    zip->out_wire += avail;
+    zip->flushing = flush == Z_SYNC_FLUSH && zip->deflate.avail_out == 0;
+  }
+
+  return 1;
+}
+
+/* zip_read()
+ *
+ * inputs	- pointer to server with a compressed link
+ *		- data as read from the socket
+ *		- its length
+ * output	- 0 if the data couldn't be inflated, 1 otherwise
+ * side effects	- inflated data is appended to the receive queue
+ */
+int
+zip_read(struct Client *client_p, const char *buf, size_t len)
+{
+  struct dbuf_queue *const queue = &client_p->connection->buf_recvq;
+  struct ZipLink *const zip = client_p->connection->zip;
+
+  zip->inflate.next_in = (Bytef *)buf;
+  zip->inflate.avail_in = len;
+  zip->in_wire += len;
+
+  do
+  {
+    size_t avail = 0;
+    char *const out = dbuf_reserve(queue, &avail);
+
+    zip->inflate.next_out = (Bytef *)out;
+    zip->inflate.avail_out = avail;
+
+    const int ret = inflate(&zip->inflate, Z_SYNC_FLUSH);
+
+    avail -= zip->inflate.avail_out;
+    dbuf_commit(queue, avail);
+    zip->in_data += avail;
+
+    if (ret != Z_OK && ret != Z_BUF_ERROR)
+      return 0;
+  } while (zip->inflate.avail_in || zip->inflate.avail_out == 0);
+
+  return 1;
+}
+#else
+int
+zip_start(struct Client *client_p)
+{
+  return 0;
+}
+
+int
+zip_start_read(struct Client *client_p)
+{
+  return 0;
+}
+
+void
+zip_free(struct Client *client_p)
+{
+}
+
+int
+zip_fill(struct Client *client_p)
+{
+  return 0;
+}
+
+int
+zip_read(struct Client *client_p, const char *buf, size_t len)
+{
+  return 0;
+}
+#endif
@@ -0,0 +1,655 @@
+/*
+ *  ircd-hybrid: an advanced, lightweight Internet Relay Chat Daemon (ircd)
+ *
+ *  Copyright (c) 2017 ircd-hybrid development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ *  USA
+ */
+
+/*! \file snapshot.c
+ * \brief Relinking servers from snapshots.
+ * \version $Id$
+ *
+ * When a link to a CAPAB SNAP server goes away, we keep the lines that
+ * server would burst us for the clients and channels behind it, split
+ * into ranges by a hash of their ID or name.  If it relinks while the
+ * snapshot is still around, we send it a digest per range (SNAPDIGEST).
+ * It computes the same digests over what it is about to burst, and
+ * instead of bursting ranges that match it tells us to use our copy
+ * (SNAPUSE), which we then parse as if it had been received.
+ *
+ * The digest of a range is the sum of the digests of its clients and
+ * channels, so the order of the lists doesn't matter.  Those of clients
+ * are taken over their burst lines, those of channels over their modes,
+ * topic, and the sums of the digests of their members and masks.
+ * Equal digests therefore mean that our copy says the same thing as the
+ * burst; anything else is just burst as usual.
+ */
+
+#include "stdinc.h"
+#include "list.h"
+#include "client.h"
+#include "channel.h"
+#include "channel_mode.h"
+#include "dbuf.h"
+#include "event.h"
+#include "irc_string.h"
+#include "ircd.h"
+#include "memory.h"
+#include "send.h"
+#include "server.h"
+#include "server_capab.h"
+#include "snapshot.h"
+
+
+static dlink_list snapshot_list;
+static const char snapshot_table_name[SNAPSHOT_TABLES] = { 'U', 'C' };
+
+/* FNV-1a; unlike strhash() it is the same on every server */
+static const uint64_t SNAPSHOT_HASH_INIT = UINT64_C(0xcbf29ce484222325);
+static const uint64_t SNAPSHOT_HASH_PRIME = UINT64_C(0x100000001b3);
+
+
+static uint64_t
+snapshot_hash(uint64_t hash, const char *data, size_t len)
+{
+  for (size_t i = 0; i < len; ++i)
+  {
+    hash ^= (unsigned char)data[i];
+    hash *= SNAPSHOT_HASH_PRIME;
+  }
+
+  return hash;
+}
+
+/* Hashes a string along with its terminator, so fields can't run into each other */
+static uint64_t
+snapshot_hash_str(uint64_t hash, const char *str)
+{
+  return snapshot_hash(hash, str, strlen(str) + 1);
+}
+
+static uint64_t
+snapshot_hash_queue(const struct dbuf_queue *queue)
+{
+  uint64_t hash = SNAPSHOT_HASH_INIT;
+  struct dbuf_iter iter;
+
+  for (const struct dbuf_block *block = dbuf_first(queue, &iter); block; block = dbuf_next(&iter))
+    hash = snapshot_hash(hash, block->data, block->size);
+
+  return hash;
+}
+
+/* snapshot_range()
+ *
+ * inputs       - client ID or channel name
+ * output       - range it belongs to
+ */
+static unsigned int
+snapshot_range(const char *key)
+{
+  uint64_t hash = SNAPSHOT_HASH_INIT;
+
+  for (; *key; ++key)
+  {
+    hash ^= ToLower(*key);
+    hash *= SNAPSHOT_HASH_PRIME;
+  }
+
+  /*
+   * The last characters hardly reach the top bits yet, and IDs differ
+   * mostly in those; mix them in as MurmurHash3 finishes its hashes
+   */
+  hash ^= hash >> 33;
+  hash *= UINT64_C(0xff51afd7ed558ccd);
+  hash ^= hash >> 33;
+
+  return hash >> (64 - SNAPSHOT_RANGE_BITS);
+}
+
+static uint64_t
+snapshot_mask_list_digest(const dlink_list *list, char flag)
+{
+  char buf[IRCD_BUFSIZE];
+  uint64_t digest = 0;
+  dlink_node *node;
+
+  DLINK_FOREACH(node, list->head)
+  {
+    const struct Ban *ban = node->data;
+
+    snprintf(buf, sizeof(buf), "%c%s!%s@%s", flag, ban->name, ban->user, ban->host);
+    digest += snapshot_hash_str(SNAPSHOT_HASH_INIT, buf);
+  }
+
+  return digest;
+}
+
+/* snapshot_channel_digest()
+ *
+ * inputs       - server the burst is meant for
+ *              - channel
+ *              - nonzero for the channel as client_p bursts it to us
+ * output       - digest of what server_burst_channel() would add for
+ *                the channel regardless of the order of its lists; 0
+ *                if it adds nothing
+ */
+static uint64_t
+snapshot_channel_digest(struct Client *client_p, struct Channel *chptr, int behind)
+{
+  char modebuf[MODEBUFLEN] = "";
+  char parabuf[MODEBUFLEN] = "";
+  char buf[IRCD_BUFSIZE];
+  uint64_t hash = SNAPSHOT_HASH_INIT, members = 0, masks = 0;
+  unsigned int count = 0;
+  dlink_node *node;
+
+  DLINK_FOREACH(node, chptr->members.head)
+  {
+    const struct Membership *member = node->data;
+
+    if ((member->client_p->from == client_p) != !!behind)
+      continue;
+
+    snprintf(buf, sizeof(buf), "%s%s%s%s",
+             (member->flags & CHFL_CHANOP) ? "@" : "",
+             (member->flags & CHFL_HALFOP) ? "%" : "",
+             (member->flags & CHFL_VOICE) ? "+" : "",
+             member->client_p->id);
+    members += snapshot_hash_str(SNAPSHOT_HASH_INIT, buf);
+    ++count;
+  }
+
+  if (count == 0)
+    return 0;
+
+  channel_modes(chptr, client_p, modebuf, parabuf);
+  snprintf(buf, sizeof(buf), "%s %ju %s %s", chptr->name, chptr->creationtime, modebuf, parabuf);
+  hash = snapshot_hash_str(hash, buf);
+
+  if (IsCapable(client_p, CAPAB_TBURST) && chptr->topic_time)
+  {
+    snprintf(buf, sizeof(buf), "%ju %s %s", chptr->topic_time, chptr->topic_info, chptr->topic);
+    hash = snapshot_hash_str(hash, buf);
+  }
+
+  masks += snapshot_mask_list_digest(&chptr->banlist, 'b');
+  masks += snapshot_mask_list_digest(&chptr->exceptlist, 'e');
+  masks += snapshot_mask_list_digest(&chptr->invexlist, 'I');
+
+  snprintf(buf, sizeof(buf), "%ju %ju", (uintmax_t)members, (uintmax_t)masks);
+  return snapshot_hash_str(hash, buf);
+}
+
+static void
+snapshot_free(struct Snapshot *snap)
+{
+  for (unsigned int table = 0; table < SNAPSHOT_TABLES; ++table)
+    for (unsigned int i = 0; i < SNAPSHOT_RANGES; ++i)
+      dbuf_clear(&snap->range[table][i].lines);
+
+  dbuf_clear(&snap->replay);
+  xfree(snap);
+}
+
+/* snapshot_find()
+ *
+ * inputs       - name and SID of a server
+ * output       - our snapshot of it, unlinked from snapshot_list, or
+ *                NULL if there is none
+ */
+static struct Snapshot *
+snapshot_find(const char *name, const char *id)
+{
+  dlink_node *node;
+
+  DLINK_FOREACH(node, snapshot_list.head)
+  {
+    struct Snapshot *snap = node->data;
+
+    if (!irccmp(snap->name, name) && !strcmp(snap->id, id))
+    {
+      dlinkDelete(&snap->node, &snapshot_list);
+      return snap;
+    }
+  }
+
+  return NULL;
+}
+
+static void
+snapshot_expire(void *unused)
+{
+  dlink_node *node, *node_next;
+
+  DLINK_FOREACH_SAFE(node, node_next, snapshot_list.head)
+  {
+    struct Snapshot *snap = node->data;
+
+    if (snap->created + SNAPSHOT_LIFETIME <= CurrentTime)
+    {
+      dlinkDelete(&snap->node, &snapshot_list);
+      snapshot_free(snap);
+    }
+  }
+}
+
+static int
+snapshot_channel_cmp(const void *a, const void *b)
+{
+  const struct Channel *const x = *(const struct Channel *const *)a;
+  const struct Channel *const y = *(const struct Channel *const *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* snapshot_take_users()
+ *
+ * inputs       - snapshot being taken of client_p
+ *              - directly connected server about to exit
+ *              - client_p or a server behind it
+ *              - array of channels, its length and its size
+ * output       - NONE
+ * side effects - the users of server_p and of the servers behind it
+ *                are added to the snapshot, and the channels they are
+ *                in to the array, once for each member
+ */
+static void
+snapshot_take_users(struct Snapshot *snap, struct Client *client_p, struct Client *server_p,
+                    struct Channel ***chans, unsigned int *count, unsigned int *size)
+{
+  struct dbuf_queue lines;
+  dlink_node *node, *node2;
+
+  memset(&lines, 0, sizeof(lines));
+
+  DLINK_FOREACH(node, server_p->serv->client_list.head)
+  {
+    struct Client *target_p = node->data;
+    struct SnapshotRange *range = &snap->range[SNAPSHOT_USERS][snapshot_range(target_p->id)];
+
+    server_burst_client(&lines, client_p, target_p);
+    range->digest += snapshot_hash_queue(&lines);
+    dbuf_move(&range->lines, &lines);
+
+    DLINK_FOREACH(node2, target_p->channel.head)
+    {
+      if (*count == *size)
+      {
+        *size = *size ? *size * 2 : 64;
+        *chans = xrealloc(*chans, *size * sizeof(**chans));
+      }
+
+      (*chans)[(*count)++] = ((struct Membership *)node2->data)->chptr;
+    }
+  }
+
+  DLINK_FOREACH(node, server_p->serv->server_list.head)
+    snapshot_take_users(snap, client_p, node->data, chans, count, size);
+}
+
+/* snapshot_take()
+ *
+ * inputs       - directly connected CAPAB SNAP server about to exit
+ * output       - NONE
+ * side effects - what client_p would burst us for the clients and
+ *                channels behind it is kept for SNAPSHOT_LIFETIME
+ *                seconds.  Must be called before they are removed.
+ *                Only the users behind client_p and their channels
+ *                are looked at.
+ */
+void
+snapshot_take(struct Client *client_p)
+{
+  struct Snapshot *snap = snapshot_find(client_p->name, client_p->id);
+  struct Channel **chans = NULL;
+  unsigned int count = 0, size = 0;
+
+  if (snap)
+    snapshot_free(snap);
+
+  snap = xcalloc(sizeof(*snap));
+  strlcpy(snap->name, client_p->name, sizeof(snap->name));
+  strlcpy(snap->id, client_p->id, sizeof(snap->id));
+  snap->created = CurrentTime;
+
+  snapshot_take_users(snap, client_p, client_p, &chans, &count, &size);
+
+  qsort(chans, count, sizeof(*chans), snapshot_channel_cmp);
+
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    struct Channel *chptr = chans[i];
+
+    if (i && chans[i - 1] == chptr)
+      continue;
+
+    const uint64_t digest = snapshot_channel_digest(client_p, chptr, 1);
+
+    if (digest == 0)
+      continue;
+
+    struct SnapshotRange *range = &snap->range[SNAPSHOT_CHANNELS][snapshot_range(chptr->name)];
+    range->digest += digest;
+    server_burst_channel(&range->lines, client_p, chptr, 1);
+  }
+
+  xfree(chans);
+  dlinkAdd(snap, &snap->node, &snapshot_list);
+}
+
+/* snapshot_offer()
+ *
+ * inputs       - CAPAB SNAP server that just linked
+ * output       - NONE
+ * side effects - our snapshot of it, if any, is attached to the
+ *                connection and its digests are sent, followed by
+ *                SNAPDIGEST END.  To be sent ahead of our burst.
+ */
+void
+snapshot_offer(struct Client *client_p)
+{
+  struct Snapshot *const snap = snapshot_find(client_p->name, client_p->id);
+
+  client_p->connection->snapshot = snap;
+
+  if (snap)
+  {
+    for (unsigned int table = 0; table < SNAPSHOT_TABLES; ++table)
+    {
+      for (unsigned int first = 0; first < SNAPSHOT_RANGES; first += SNAPSHOT_DIGESTS_PER_LINE)
+      {
+        char buf[IRCD_BUFSIZE] = "";
+        char *p = buf;
+
+        for (unsigned int i = first; i < first + SNAPSHOT_DIGESTS_PER_LINE && i < SNAPSHOT_RANGES; ++i)
+        {
+          const uint64_t digest = snap->range[table][i].digest;
+
+          if (digest)
+            ++snap->offered[table];
+
+          p += sprintf(p, p == buf ? "%jx" : " %jx", (uintmax_t)digest);
+        }
+
+        sendto_one(client_p, ":%s SNAPDIGEST %u %c %u :%s", me.id, SNAPSHOT_VERSION,
+                   snapshot_table_name[table], first, buf);
+      }
+    }
+  }
+
+  sendto_one(client_p, ":%s SNAPDIGEST %u END", me.id, SNAPSHOT_VERSION);
+}
+
+/* snapshot_release()
+ *
+ * inputs       - directly connected server
+ * output       - NONE
+ * side effects - the snapshot attached by snapshot_offer() is freed,
+ *                once the server has finished its burst or exits
+ */
+void
+snapshot_release(struct Client *client_p)
+{
+  struct Snapshot *const snap = client_p->connection->snapshot;
+
+  if (snap == NULL)
+    return;
+
+  if (HasFlag(client_p, FLAGS_EOB))
+    sendto_realops_flags(UMODE_SERVNOTICE, L_ALL, SEND_NOTICE,
+                         "Relinked %s from snapshot: replayed %u/%u user and %u/%u channel ranges",
+                         client_p->name,
+                         snap->replayed[SNAPSHOT_USERS], snap->offered[SNAPSHOT_USERS],
+                         snap->replayed[SNAPSHOT_CHANNELS], snap->offered[SNAPSHOT_CHANNELS]);
+
+  client_p->connection->snapshot = NULL;
+  snapshot_free(snap);
+}
+
+/* snapshot_table()
+ *
+ * inputs       - table name as used in SNAPDIGEST and SNAPUSE
+ * output       - table, or -1 if unknown
+ */
+int
+snapshot_table(const char *name)
+{
+  for (int table = 0; table < SNAPSHOT_TABLES; ++table)
+    if (name[0] == snapshot_table_name[table] && name[1] == '\0')
+      return table;
+
+  return -1;
+}
+
+/* snapshot_delta_digests()
+ *
+ * inputs       - server being sent our burst
+ *              - SNAPSHOT_VERSION of the server
+ *              - table
+ *              - first range
+ *              - space separated hex digests of that and the following
+ *                ranges
+ * output       - NONE
+ * side effects - the digests are stored until SNAPDIGEST END
+ */
+void
+snapshot_delta_digests(struct Client *client_p, unsigned int version,
+                       unsigned int table, unsigned int first, char *list)
+{
+  const struct BurstTask *const task = client_p->connection->burst_task;
+  char *p = NULL;
+
+  if (task == NULL || task->delta == NULL || task->delta->ready)
+    return;
+
+  struct SnapshotDelta *const delta = task->delta;
+
+  if (version != SNAPSHOT_VERSION || table >= SNAPSHOT_TABLES)
+  {
+    delta->ignore = 1;
+    return;
+  }
+
+  for (const char *digest = strtok_r(list, " ", &p); digest && first < SNAPSHOT_RANGES;
+                   digest = strtok_r(NULL, " ", &p))
+    delta->digest[table][first++] = strtoull(digest, NULL, 16);
+}
+
+/* snapshot_delta_ready()
+ *
+ * inputs       - server being sent our burst
+ * output       - NONE
+ * side effects - on SNAPDIGEST END, ranges with digests equal to ours
+ *                are left out of the burst, which is then started.
+ *                Only the ranges the server sent a digest for are
+ *                digested here; with none, the burst just starts.
+ */
+void
+snapshot_delta_ready(struct Client *client_p)
+{
+  const struct BurstTask *const task = client_p->connection->burst_task;
+  uint64_t digest[SNAPSHOT_TABLES][SNAPSHOT_RANGES];
+  unsigned int offered[SNAPSHOT_TABLES] = { 0 };
+  struct dbuf_queue lines;
+
+  if (task == NULL || task->delta == NULL || task->delta->ready)
+    return;
+
+  struct SnapshotDelta *const delta = task->delta;
+
+  delta->ready = 1;
+
+  if (delta->ignore)
+  {
+    server_burst_continue(client_p);
+    return;
+  }
+
+  for (unsigned int table = 0; table < SNAPSHOT_TABLES; ++table)
+    for (unsigned int i = 0; i < SNAPSHOT_RANGES; ++i)
+      if (delta->digest[table][i])
+        ++offered[table];
+
+  if (offered[SNAPSHOT_USERS] == 0 && offered[SNAPSHOT_CHANNELS] == 0)
+  {
+    server_burst_continue(client_p);
+    return;
+  }
+
+  memset(digest, 0, sizeof(digest));
+  memset(&lines, 0, sizeof(lines));
+
+  /* What the burst is going to go through, see server_burst() */
+  if (offered[SNAPSHOT_USERS])
+  {
+    for (dlink_node *node = task->client; node; node = node->next)
+    {
+      struct Client *target_p = node->data;
+
+      if (target_p->from == client_p)
+        continue;
+
+      const unsigned int i = snapshot_range(target_p->id);
+
+      if (delta->digest[SNAPSHOT_USERS][i] == 0)
+        continue;
+
+      server_burst_client(&lines, client_p, target_p);
+      digest[SNAPSHOT_USERS][i] += snapshot_hash_queue(&lines);
+      dbuf_clear(&lines);
+    }
+  }
+
+  if (offered[SNAPSHOT_CHANNELS])
+  {
+    for (dlink_node *node = task->channel; node; node = node->next)
+    {
+      struct Channel *chptr = node->data;
+      const unsigned int i = snapshot_range(chptr->name);
+
+      if (delta->digest[SNAPSHOT_CHANNELS][i] == 0)
+        continue;
+
+      digest[SNAPSHOT_CHANNELS][i] += snapshot_channel_digest(client_p, chptr, 0);
+    }
+  }
+
+  for (unsigned int table = 0; table < SNAPSHOT_TABLES; ++table)
+    for (unsigned int i = 0; i < SNAPSHOT_RANGES; ++i)
+      if (digest[table][i] && digest[table][i] == delta->digest[table][i])
+        delta->use[table][i / 8] |= 1 << (i % 8);
+
+  server_burst_continue(client_p);
+}
+
+/* snapshot_delta_announce()
+ *
+ * inputs       - server being sent our burst
+ *              - its SnapshotDelta, if any
+ *              - table about to be burst
+ * output       - NONE
+ * side effects - once per table, the server is sent SNAPUSE for the
+ *                ranges it should replay instead
+ */
+void
+snapshot_delta_announce(struct Client *client_p, struct SnapshotDelta *delta, unsigned int table)
+{
+  char buf[SNAPSHOT_RANGES / 4 + 1];
+  unsigned int used = 0;
+
+  if (delta == NULL || (delta->announced & (1U << table)))
+    return;
+
+  delta->announced |= 1U << table;
+
+  for (unsigned int i = 0; i < SNAPSHOT_RANGES / 8; ++i)
+  {
+    sprintf(buf + i * 2, "%02x", delta->use[table][i]);
+    used |= delta->use[table][i];
+  }
+
+  if (used)
+    sendto_one(client_p, ":%s SNAPUSE %c %s", me.id, snapshot_table_name[table], buf);
+}
+
+/* snapshot_delta_skip()
+ *
+ * inputs       - SnapshotDelta of a burst, if any
+ *              - table
+ *              - client ID or channel name
+ * output       - 1 if the server replays it from its snapshot
+ */
+int
+snapshot_delta_skip(const struct SnapshotDelta *delta, unsigned int table, const char *key)
+{
+  if (delta == NULL)
+    return 0;
+
+  const unsigned int i = snapshot_range(key);
+  return (delta->use[table][i / 8] & (1 << (i % 8))) != 0;
+}
+
+/* snapshot_replay()
+ *
+ * inputs       - server sending us its burst
+ *              - table
+ *              - SNAPUSE bitmap in hex
+ * output       - NONE
+ * side effects - the lines of the ranges set in the bitmap are queued
+ *                to be parsed ahead of anything received afterwards,
+ *                see parse_one_line()
+ */
+void
+snapshot_replay(struct Client *client_p, unsigned int table, const char *bitmap)
+{
+  struct Snapshot *const snap = client_p->connection->snapshot;
+
+  if (snap == NULL || table >= SNAPSHOT_TABLES || strlen(bitmap) != SNAPSHOT_RANGES / 4)
+    return;
+
+  for (unsigned int i = 0; i < SNAPSHOT_RANGES / 8; ++i)
+  {
+    const char hex[3] = { bitmap[i * 2], bitmap[i * 2 + 1], '\0' };
+    const unsigned int bits = strtoul(hex, NULL, 16);
+
+    for (unsigned int bit = 0; bit < 8; ++bit)
+    {
+      struct SnapshotRange *const range = &snap->range[table][i * 8 + bit];
+
+      if (!(bits & (1U << bit)) || range->digest == 0)
+        continue;
+
+      dbuf_move(&snap->replay, &range->lines);
+      range->digest = 0;
+      ++snap->replayed[table];
+    }
+  }
+}
+
+void
+snapshot_init(void)
+{
+  static struct event event_expire =
+  {
+    .name = "snapshot_expire",
+    .handler = snapshot_expire,
+    .when = 60
+  };
+
+  event_add(&event_expire, NULL);
+}
@@ -462,6 +462,7 @@ register_local_user(struct Client *client_p)
 
   dlink_move_node(&client_p->connection->lclient_node,
                   &unknown_list, &local_client_list);
+  client_ban_index_host(client_p);
 
   if (dlink_list_length(&local_client_list) > Count.max_loc)
   {
@@ -731,6 +732,7 @@ user_set_hostmask(struct Client *client_p, const char *hostname)
   {
     sendto_one_numeric(client_p, &me, RPL_VISIBLEHOST, client_p->host);
     clear_ban_cache_list(&client_p->channel);
+    client_ban_index_host(client_p);
   }
 
   if (!ConfigGeneral.cycle_on_host_change)
@@ -764,13 +766,7 @@ user_set_hostmask(struct Client *client_p, const char *hostname)
 
     *p = '\0';
 
-    sendto_channel_local(client_p, member->chptr, 0, CAP_EXTENDED_JOIN, CAP_CHGHOST, ":%s!%s@%s JOIN %s %s :%s",
-                         client_p->name, client_p->username,
-                         client_p->host, member->chptr->name,
-                         client_p->account, client_p->info);
-    sendto_channel_local(client_p, member->chptr, 0, 0, CAP_EXTENDED_JOIN | CAP_CHGHOST, ":%s!%s@%s JOIN :%s",
-                         client_p->name, client_p->username,
-                         client_p->host, member->chptr->name);
+    channel_send_join(member->chptr, client_p, client_p, CAP_CHGHOST);
 
     if (nickbuf[0])
       sendto_channel_local(client_p, member->chptr, 0, 0, CAP_CHGHOST, ":%s MODE %s +%s %s",
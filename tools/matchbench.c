@@ -0,0 +1,278 @@
+/*
+ *  ircd-hybrid: an advanced, lightweight Internet Relay Chat Daemon (ircd)
+ *
+ *  Copyright (c) 2017 ircd-hybrid development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ *  USA
+ */
+
+/*! \file matchbench.c
+ * \brief Times match(), irccmp() and ircncmp() against the byte loops.
+ * \version $Id$
+ *
+ * Not built by default; "make matchbench" in tools/.  The reference
+ * functions are the plain byte loops match.c uses where it can't take
+ * 16 bytes at a time.  Every result is checked against them, including
+ * for strings that end right before an unmapped page.
+ */
+
+#include "stdinc.h"
+#include "irc_string.h"
+#include <sys/mman.h>
+
+enum { STRINGS = 4096, PASSES = 2000 };
+
+static const char *const hosts[] =
+{
+  "localhost", "127.0.0.1", "irc.example.net", "cpe-24-58-112-9.nyc.res.rr.com",
+  "2001:db8:85a3::8a2e:370:7334", "ip-10-0-3-17.eu-west-1.compute.internal",
+  "staff.ircd-hybrid.org", "d54C1A3F2.access.telenet.be"
+};
+
+static const char *const masks[] =
+{
+  "*", "*!*@*", "*!*@*.example.net", "*!*@127.0.0.*", "*.rr.com", "*!~*@*",
+  "nick*!*@*", "*!*user*@*.compute.internal", "?*!*@cpe-*.nyc.res.rr.com",
+  "*\\**", "*!*@2001:db8:*"
+};
+
+static char *names[STRINGS], *folded[STRINGS];
+
+
+static int
+ref_match(const char *mask, const char *name)
+{
+  const char *m = mask, *n = name;
+  const char *m_tmp = mask, *n_tmp = name;
+  unsigned int star = 0;
+
+  while (1)
+  {
+    switch (*m)
+    {
+      case '\0':
+        if (*n == '\0')
+          return 0;
+  backtrack:
+        if (m_tmp == mask)
+          return 1;
+
+        m = m_tmp;
+        n = ++n_tmp;
+
+        if (*n == '\0')
+          return 1;
+        break;
+      case '\\':
+        ++m;
+
+        if (*m++ != *n++)
+          goto backtrack;
+        break;
+      case '*':
+      case '?':
+        for (star = 0; ; ++m)
+        {
+          if (*m == '*')
+            star = 1;
+          else if (*m == '?')
+          {
+            if (*n++ == '\0')
+              goto backtrack;
+          }
+          else
+            break;
+        }
+
+        if (star)
+        {
+          if (*m == '\0')
+            return 0;
+          else if (*m == '\\')
+          {
+            m_tmp = ++m;
+
+            if (*m == '\0')
+              return 1;
+            for (n_tmp = n; *n && *n != *m; ++n)
+              ;
+          }
+          else
+          {
+            m_tmp = m;
+            for (n_tmp = n; *n && (ToLower(*n) != ToLower(*m)); ++n)
+              ;
+          }
+        }
+        /* and fall through */
+      default:
+        if (*n == '\0')
+          return *m != '\0';
+        if (ToLower(*m) != ToLower(*n))
+          goto backtrack;
+        ++m;
+        ++n;
+        break;
+    }
+  }
+}
+
+static int
+ref_ircncmp(const char *s1, const char *s2, size_t n)
+{
+  const unsigned char *str1 = (const unsigned char *)s1;
+  const unsigned char *str2 = (const unsigned char *)s2;
+
+  for (; ToUpper(*str1) == ToUpper(*str2); ++str1, ++str2)
+    if (--n == 0 || *str1 == '\0')
+      return 0;
+
+  return 1;
+}
+
+static int
+ref_irccmp(const char *s1, const char *s2)
+{
+  return ref_ircncmp(s1, s2, SIZE_MAX);
+}
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Random nick!user@host, with a random number of its letters in upper case */
+static char *
+make_name(void)
+{
+  char buf[128];
+  const unsigned int nicklen = 3 + rand() % 13;
+
+  for (unsigned int i = 0; i < nicklen; ++i)
+    buf[i] = "abcdefghijklmnopqrstuvwxyz[]\\^_`{|}-0123456789"[rand() % (i ? 46 : 32)];
+
+  snprintf(buf + nicklen, sizeof(buf) - nicklen, "!%suser%u@%s", rand() % 2 ? "~" : "",
+           rand() % 100, hosts[rand() % (sizeof(hosts) / sizeof(hosts[0]))]);
+  return strdup(buf);
+}
+
+static char *
+make_folded(const char *name)
+{
+  char *copy = strdup(name);
+
+  for (char *p = copy; *p; ++p)
+    if (rand() % 4 == 0)
+      *p = rand() % 2 ? ToUpper(*p) : ToLower(*p);
+
+  if (rand() % 8 == 0)  /* Some that differ */
+    copy[rand() % strlen(copy)] ^= 1;
+
+  return copy;
+}
+
+/* Compare with the byte loops for strings that end right before an unmapped page */
+static int
+check_page_ends(void)
+{
+  const long page = sysconf(_SC_PAGESIZE);
+  char *area = mmap(NULL, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  int errors = 0;
+
+  if (area == MAP_FAILED || mprotect(area + page, page, PROT_NONE))
+  {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+
+  for (unsigned int i = 0; i < STRINGS; ++i)
+  {
+    const size_t len = strlen(names[i]);
+    char *name = area + page - len - 1;
+
+    memcpy(name, names[i], len + 1);
+
+    for (unsigned int j = 0; j < sizeof(masks) / sizeof(masks[0]); ++j)
+      errors += !match(masks[j], name) != !ref_match(masks[j], name);
+
+    errors += !irccmp(name, folded[i]) != !ref_irccmp(name, folded[i]);
+    errors += !irccmp(folded[i], name) != !ref_irccmp(folded[i], name);
+    errors += !ircncmp(name, folded[i], len / 2 + 1) != !ref_ircncmp(name, folded[i], len / 2 + 1);
+  }
+
+  munmap(area, page * 2);
+  return errors;
+}
+
+#define BENCH(label, ours, ref, expr) \
+  do { \
+    double t_ours, t_ref; \
+    unsigned int r_ours = 0, r_ref = 0; \
+    t_ours = now(); \
+    for (unsigned int pass = 0; pass < PASSES; ++pass) \
+      for (unsigned int i = 0; i < STRINGS; ++i) \
+        r_ours += !ours expr; \
+    t_ours = now() - t_ours; \
+    t_ref = now(); \
+    for (unsigned int pass = 0; pass < PASSES; ++pass) \
+      for (unsigned int i = 0; i < STRINGS; ++i) \
+        r_ref += !ref expr; \
+    t_ref = now() - t_ref; \
+    printf("%-36s %8.1f ns %8.1f ns %6.2fx%s\n", label, \
+           t_ours * 1e9 / ((double)PASSES * STRINGS), t_ref * 1e9 / ((double)PASSES * STRINGS), \
+           t_ref / t_ours, r_ours == r_ref ? "" : "  RESULTS DIFFER"); \
+    errors += r_ours != r_ref; \
+  } while (0)
+
+int
+main(void)
+{
+  int errors = 0;
+
+  srand(1);
+
+  for (unsigned int i = 0; i < STRINGS; ++i)
+  {
+    names[i] = make_name();
+    folded[i] = make_folded(names[i]);
+  }
+
+  errors += check_page_ends();
+
+  printf("%-36s %11s %11s %7s\n", "", "ircd", "byte loops", "");
+  BENCH("irccmp", irccmp, ref_irccmp, (names[i], folded[i]));
+  BENCH("ircncmp NICKLEN", ircncmp, ref_ircncmp, (names[i], folded[i], 30));
+
+  for (unsigned int j = 0; j < sizeof(masks) / sizeof(masks[0]); ++j)
+  {
+    char label[64];
+
+    snprintf(label, sizeof(label), "match %s", masks[j]);
+    BENCH(label, match, ref_match, (masks[j], names[i]));
+  }
+
+  if (errors)
+  {
+    fprintf(stderr, "%d results differ from the byte loops\n", errors);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}